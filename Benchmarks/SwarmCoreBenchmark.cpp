@@ -0,0 +1,538 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+// Times the stages of a simulation step (cell assignment, sort, offsets, rearrange, neighbour query, steering and
+// integration) for the algorithmic variants of the swarm core, without the editor or a GPU. Every variant runs on
+// uniform, clustered and single-cell positions, and the sorts and queries are checked against each other.
+//
+//   SwarmCoreBenchmark [--items N] [--single-cell-items N] [--repetitions N] [--threads N]
+
+#include "SwarmCore/SwarmCoreBoids.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace SwarmCore;
+
+// A parallel-for over a fixed set of threads. Each call hands out its indices one at a time from an atomic counter,
+// so idle threads take the remaining work.
+class ThreadPoolFor
+{
+public:
+	explicit ThreadPoolFor(uint32_t numThreads)
+	{
+		for (uint32_t t = 1; t < numThreads; ++t)
+			_threads.emplace_back([this]() { _workerLoop(); });
+	}
+
+	~ThreadPoolFor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+
+		_wake.notify_all();
+
+		for (std::thread& thread : _threads)
+			thread.join();
+	}
+
+	template<typename Body>
+	void operator()(uint32_t count, const Body& body) const
+	{
+		_run(count, [](const void * context, uint32_t i) { (*static_cast<const Body*>(context))(i); }, &body);
+	}
+
+	uint32_t numThreads() const { return uint32_t(_threads.size()) + 1; }
+
+protected:
+	typedef void (*FunctionType)(const void *, uint32_t);
+
+	void _run(uint32_t count, FunctionType function, const void * context) const
+	{
+		if (count == 0)
+			return;
+
+		if (count == 1 || _threads.empty())
+		{
+			for (uint32_t i = 0; i < count; ++i)
+				function(context, i);
+
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			_function = function;
+			_context = context;
+			_count = count;
+			_next = 0;
+			_busy = uint32_t(_threads.size());
+			_generation++;
+		}
+
+		_wake.notify_all();
+
+		// the calling thread helps
+		_work();
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [this]() { return _busy == 0; });
+	}
+
+	void _work() const
+	{
+		for (;;)
+		{
+			const uint32_t i = _next.fetch_add(1);
+
+			if (i >= _count)
+				return;
+
+			_function(_context, i);
+		}
+	}
+
+	void _workerLoop()
+	{
+		uint64_t seen = 0;
+
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [&]() { return _stop || _generation != seen; });
+
+				if (_stop)
+					return;
+
+				seen = _generation;
+			}
+
+			_work();
+
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			if (--_busy == 0)
+				_done.notify_one();
+		}
+	}
+
+protected:
+	std::vector<std::thread> _threads;
+
+	mutable std::mutex _mutex;
+	mutable std::condition_variable _wake;
+	mutable std::condition_variable _done;
+
+	mutable FunctionType _function = nullptr;
+	mutable const void * _context = nullptr;
+	mutable uint32_t _count = 0;
+	mutable std::atomic<uint32_t> _next{ 0 };
+	mutable uint32_t _busy = 0;
+	mutable uint64_t _generation = 0;
+
+	bool _stop = false;
+};
+
+enum class Distribution
+{
+	Uniform,
+	Clustered,
+	SingleCell
+};
+
+static const char * distributionName(Distribution distribution)
+{
+	switch (distribution)
+	{
+	case Distribution::Uniform: return "uniform";
+	case Distribution::Clustered: return "clustered";
+	default: return "single cell";
+	}
+}
+
+// Positions in cells of size 1. Uniform has about 4 boids per cell, clustered packs them in 32 gaussian blobs and the
+// single cell worst case puts every boid in the same cell, so that every query visits all of them.
+static std::vector<Float4> makePositions(Distribution distribution, uint32_t numItems, std::mt19937& rng)
+{
+	std::vector<Float4> positions(numItems);
+
+	const float extent = std::cbrt(float(numItems) / 4.0f);
+
+	std::uniform_real_distribution<float> uniform(-0.5f * extent, 0.5f * extent);
+	std::uniform_real_distribution<float> unit(0.0f, 0.999f);
+	std::normal_distribution<float> normal(0.0f, 2.0f);
+
+	std::vector<Float4> centres(32);
+
+	for (Float4& centre : centres)
+		centre = Float4{ uniform(rng), uniform(rng), uniform(rng), 0.0f };
+
+	for (uint32_t i = 0; i < numItems; ++i)
+	{
+		Float4& p = positions[i];
+
+		if (distribution == Distribution::Uniform)
+		{
+			p = Float4{ uniform(rng), uniform(rng), uniform(rng), 0.0f };
+		}
+		else if (distribution == Distribution::Clustered)
+		{
+			const Float4& centre = centres[i % centres.size()];
+
+			p = Float4{ centre.x + normal(rng), centre.y + normal(rng), centre.z + normal(rng), 0.0f };
+		}
+		else
+		{
+			p = Float4{ unit(rng), unit(rng), unit(rng), 0.0f };
+		}
+	}
+
+	return positions;
+}
+
+static std::vector<Float4> makeDirections(uint32_t numItems, std::mt19937& rng)
+{
+	std::vector<Float4> directions(numItems);
+
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+
+	for (uint32_t i = 0; i < numItems; ++i)
+	{
+		const Vec3 d = safeNormal(Vec3(normal(rng), normal(rng), normal(rng)), Vec3(1.0f, 0.0f, 0.0f));
+
+		// w is the boid's stable id
+		directions[i] = Float4{ d.x, d.y, d.z, float(i) };
+	}
+
+	return directions;
+}
+
+struct Variant
+{
+	const char * name;
+
+	GridSort sort;
+	CellKey key;
+	NeighbourScan scan;
+	bool arrayOfStructures;
+};
+
+enum Stage
+{
+	StageCells,
+	StageSort,
+	StageOffsets,
+	StageRearrange,
+	StageQuery,
+	StageSteering,
+	StageIntegrate,
+	NumStages
+};
+
+static const char * stageNames[NumStages] = { "cells", "sort", "offsets", "rearrange", "query", "steering", "integrate" };
+
+struct VariantResult
+{
+	double milliseconds[NumStages] = { 0.0 };
+
+	uint64_t neighbourCount = 0;
+	std::vector<uint32_t> particleIndices;
+};
+
+// The boids in both layouts, the one that isn't benchmarked stays empty
+struct BoidStorage
+{
+	std::vector<float> arrays[11];
+	std::vector<Float4> float4s[3];
+
+	BoidsSoA soa()
+	{
+		BoidsSoA boids;
+
+		float ** pointers[11] = { &boids.px, &boids.py, &boids.pz, &boids.pw, &boids.dx, &boids.dy, &boids.dz, &boids.dw, &boids.sx, &boids.sy, &boids.sz };
+
+		for (int a = 0; a < 11; ++a)
+			*pointers[a] = arrays[a].data();
+
+		return boids;
+	}
+
+	BoidsAoS aos()
+	{
+		BoidsAoS boids;
+		boids.positionData = float4s[0].data();
+		boids.directionData = float4s[1].data();
+		boids.steeringData = float4s[2].data();
+
+		return boids;
+	}
+
+	void init(bool arrayOfStructures, const std::vector<Float4>& positions, const std::vector<Float4>& directions)
+	{
+		const size_t n = positions.size();
+
+		for (std::vector<float>& array : arrays)
+			array.clear();
+
+		for (std::vector<Float4>& array : float4s)
+			array.clear();
+
+		if (arrayOfStructures)
+		{
+			float4s[0] = positions;
+			float4s[1] = directions;
+			float4s[2] = directions;
+
+			return;
+		}
+
+		for (std::vector<float>& array : arrays)
+			array.resize(n);
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			const float values[11] = {
+				positions[i].x, positions[i].y, positions[i].z, positions[i].w,
+				directions[i].x, directions[i].y, directions[i].z, directions[i].w,
+				directions[i].x, directions[i].y, directions[i].z
+			};
+
+			for (int a = 0; a < 11; ++a)
+				arrays[a][i] = values[a];
+		}
+	}
+
+	// rearrangePositions
+	void rearrange(uint32_t numItems, const uint32_t * order, const ThreadPoolFor& parallelFor)
+	{
+		if (!float4s[0].empty())
+		{
+			std::vector<Float4> scratch(numItems);
+
+			for (std::vector<Float4>& array : float4s)
+			{
+				gather(numItems, order, array.data(), scratch.data(), parallelFor);
+				array.swap(scratch);
+			}
+		}
+		else
+		{
+			std::vector<float> scratch(numItems);
+
+			for (std::vector<float>& array : arrays)
+			{
+				gather(numItems, order, array.data(), scratch.data(), parallelFor);
+				array.swap(scratch);
+			}
+		}
+	}
+};
+
+static double millisecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+template<typename Boids>
+static void runStep(
+	const Variant& variant,
+	HashedGrid& grid,
+	BoidStorage& storage,
+	Boids (BoidStorage::*view)(),
+	uint32_t numItems,
+	uint32_t numQueries,
+	const BoidParameters& parameters,
+	const ThreadPoolFor& parallelFor,
+	VariantResult& result
+)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+
+	Clock::time_point start = Clock::now();
+	grid.assign(numItems, (storage.*view)().positions(), parallelFor);
+	result.milliseconds[StageCells] += millisecondsSince(start);
+
+	start = Clock::now();
+	grid.sortItems(parallelFor);
+	result.milliseconds[StageSort] += millisecondsSince(start);
+
+	start = Clock::now();
+	grid.buildOffsets(parallelFor);
+	result.milliseconds[StageOffsets] += millisecondsSince(start);
+
+	start = Clock::now();
+	storage.rearrange(numItems, grid.particleIndices.data(), parallelFor);
+	result.milliseconds[StageRearrange] += millisecondsSince(start);
+
+	const Boids boids = (storage.*view)();
+
+	start = Clock::now();
+	result.neighbourCount = countNeighbours(grid.shape, variant.scan, grid.cellOffsets.data(), grid.cellEnds.data(), boids, numQueries, parameters.neighbourhoodDistance, parallelFor);
+	result.milliseconds[StageQuery] += millisecondsSince(start);
+
+	start = Clock::now();
+	updateSteering(grid.shape, variant.scan, grid.cellOffsets.data(), grid.cellEnds.data(), boids, numItems, parameters, parallelFor);
+	result.milliseconds[StageSteering] += millisecondsSince(start);
+
+	start = Clock::now();
+	integrate(boids, numItems, parameters, parallelFor);
+	result.milliseconds[StageIntegrate] += millisecondsSince(start);
+
+	result.particleIndices.assign(grid.particleIndices.begin(), grid.particleIndices.begin() + numItems);
+}
+
+int main(int argc, char ** argv)
+{
+	uint32_t numItems = 1 << 18;
+	uint32_t numSingleCellItems = 1 << 12;
+	uint32_t repetitions = 5;
+	uint32_t numThreads = std::thread::hardware_concurrency();
+
+	for (int a = 1; a + 1 < argc; a += 2)
+	{
+		const uint32_t value = uint32_t(std::strtoul(argv[a + 1], nullptr, 10));
+
+		if (std::strcmp(argv[a], "--items") == 0)
+			numItems = value;
+		else if (std::strcmp(argv[a], "--single-cell-items") == 0)
+			numSingleCellItems = value;
+		else if (std::strcmp(argv[a], "--repetitions") == 0)
+			repetitions = value;
+		else if (std::strcmp(argv[a], "--threads") == 0)
+			numThreads = value;
+		else
+		{
+			std::fprintf(stderr, "unknown option %s\n", argv[a]);
+			return 2;
+		}
+	}
+
+	numItems = numItems > 0 ? numItems : 1;
+	numSingleCellItems = numSingleCellItems > 0 ? numSingleCellItems : 1;
+	repetitions = repetitions > 0 ? repetitions : 1;
+	numThreads = numThreads > 0 ? numThreads : 1;
+
+	const ThreadPoolFor parallelFor(numThreads);
+
+	const Variant variants[] = {
+		{ "radix    linear 27-cell SoA", GridSort::Radix, CellKey::Linear, NeighbourScan::Cells, false },
+		{ "counting linear 27-cell SoA", GridSort::Counting, CellKey::Linear, NeighbourScan::Cells, false },
+		{ "bitonic  linear 27-cell SoA", GridSort::Bitonic, CellKey::Linear, NeighbourScan::Cells, false },
+		{ "radix    morton 27-cell SoA", GridSort::Radix, CellKey::Morton, NeighbourScan::Cells, false },
+		{ "radix    linear ranges  SoA", GridSort::Radix, CellKey::Linear, NeighbourScan::Ranges, false },
+		{ "radix    linear 27-cell AoS", GridSort::Radix, CellKey::Linear, NeighbourScan::Cells, true },
+		{ "radix    linear ranges  AoS", GridSort::Radix, CellKey::Linear, NeighbourScan::Ranges, true },
+	};
+
+	std::printf("SwarmCoreBenchmark: %u threads, %u repetitions, throughput in millions of items per second (mean ms)\n", parallelFor.numThreads(), repetitions);
+
+	bool valid = true;
+
+	for (Distribution distribution : { Distribution::Uniform, Distribution::Clustered, Distribution::SingleCell })
+	{
+		const uint32_t n = distribution == Distribution::SingleCell ? numSingleCellItems : numItems;
+
+		// every single cell query visits every boid, a sample is enough
+		const uint32_t numQueries = distribution == Distribution::SingleCell ? (n < 1024 ? n : 1024) : n;
+
+		std::mt19937 rng(1234);
+
+		const std::vector<Float4> positions = makePositions(distribution, n, rng);
+		const std::vector<Float4> directions = makeDirections(n, rng);
+
+		BoidParameters parameters;
+		parameters.dt = 1.0f / 60.0f;
+		parameters.neighbourhoodDistance = 1.0f;
+		parameters.separationDistance = 0.3f;
+		parameters.homeInnerRadius = 100.0f;
+		parameters.boidSpeed = 1.0f;
+
+		std::printf("\n%s, %u items\n", distributionName(distribution), n);
+		std::printf("%-28s", "variant");
+
+		for (const char * stage : stageNames)
+			std::printf(" %18s", stage);
+
+		std::printf(" %14s\n", "neighbours");
+
+		std::vector<VariantResult> results;
+
+		for (const Variant& variant : variants)
+		{
+			HashedGrid grid;
+			grid.shape.dimensions[0] = 128;
+			grid.shape.dimensions[1] = 128;
+			grid.shape.dimensions[2] = 128;
+			grid.shape.cellSize = 1.0f;
+			grid.shape.key = variant.key;
+			grid.sort = variant.sort;
+			grid.init(n);
+
+			VariantResult result;
+			BoidStorage storage;
+
+			for (uint32_t r = 0; r < repetitions; ++r)
+			{
+				// every repetition starts from the same state
+				storage.init(variant.arrayOfStructures, positions, directions);
+
+				if (variant.arrayOfStructures)
+					runStep(variant, grid, storage, &BoidStorage::aos, n, numQueries, parameters, parallelFor, result);
+				else
+					runStep(variant, grid, storage, &BoidStorage::soa, n, numQueries, parameters, parallelFor, result);
+			}
+
+			std::printf("%-28s", variant.name);
+
+			for (int stage = 0; stage < NumStages; ++stage)
+			{
+				const double milliseconds = result.milliseconds[stage] / repetitions;
+				const uint32_t stageItems = stage == StageQuery ? numQueries : n;
+				const double throughput = milliseconds > 0.0 ? stageItems / (milliseconds * 1000.0) : 0.0;
+
+				char cell[32];
+				std::snprintf(cell, sizeof(cell), "%.3g (%.3g)", throughput, milliseconds);
+				std::printf(" %18s", cell);
+			}
+
+			std::printf(" %14llu\n", (unsigned long long)result.neighbourCount);
+
+			results.push_back(result);
+		}
+
+		// the sorts are stable, so every sort of the same keys gives the same order, and every variant finds the same
+		// neighbours
+		for (size_t v = 1; v < results.size(); ++v)
+		{
+			const bool sameKeys = variants[v].key == variants[0].key;
+
+			if (sameKeys && results[v].particleIndices != results[0].particleIndices)
+			{
+				std::printf("MISMATCH: %s sorted differently from %s\n", variants[v].name, variants[0].name);
+				valid = false;
+			}
+
+			if (results[v].neighbourCount != results[0].neighbourCount)
+			{
+				std::printf("MISMATCH: %s found %llu neighbours, %s %llu\n", variants[v].name, (unsigned long long)results[v].neighbourCount, variants[0].name, (unsigned long long)results[0].neighbourCount);
+				valid = false;
+			}
+		}
+	}
+
+	std::printf("\n%s\n", valid ? "All variants agree." : "Variants disagree.");
+
+	return valid ? 0 : 1;
+}
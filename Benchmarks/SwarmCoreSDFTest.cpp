@@ -0,0 +1,199 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+// Bakes known primitives with the swarm core's SDF baker and checks the distances and signs at the nodes: a closed
+// cube against its exact distance, a box with a missing face and a lone wall for the sign of open geometry. Exits with
+// a non-zero status on a failure.
+//
+//   SwarmCoreSDFTest
+
+#include "SwarmCore/SwarmCoreSDF.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace SwarmCore;
+
+struct TriangleSoup
+{
+	std::vector<float> vertices;
+	std::vector<int32_t> indices;
+
+	void addQuad(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d)
+	{
+		const int32_t base = int32_t(vertices.size() / 3);
+
+		for (const Vec3& v : { a, b, c, d })
+		{
+			vertices.push_back(v.x);
+			vertices.push_back(v.y);
+			vertices.push_back(v.z);
+		}
+
+		for (int32_t i : { 0, 1, 2, 0, 2, 3 })
+			indices.push_back(base + i);
+	}
+
+	int32_t numTriangles() const { return int32_t(indices.size() / 3); }
+};
+
+// The faces of the box from lo to hi, skipping the -x face for an open box
+static TriangleSoup box(const Vec3& lo, const Vec3& hi, bool withNegativeX)
+{
+	TriangleSoup soup;
+
+	if (withNegativeX)
+		soup.addQuad(Vec3(lo.x, lo.y, lo.z), Vec3(lo.x, lo.y, hi.z), Vec3(lo.x, hi.y, hi.z), Vec3(lo.x, hi.y, lo.z));
+
+	soup.addQuad(Vec3(hi.x, lo.y, lo.z), Vec3(hi.x, hi.y, lo.z), Vec3(hi.x, hi.y, hi.z), Vec3(hi.x, lo.y, hi.z));
+	soup.addQuad(Vec3(lo.x, lo.y, lo.z), Vec3(hi.x, lo.y, lo.z), Vec3(hi.x, lo.y, hi.z), Vec3(lo.x, lo.y, hi.z));
+	soup.addQuad(Vec3(lo.x, hi.y, lo.z), Vec3(lo.x, hi.y, hi.z), Vec3(hi.x, hi.y, hi.z), Vec3(hi.x, hi.y, lo.z));
+	soup.addQuad(Vec3(lo.x, lo.y, lo.z), Vec3(lo.x, hi.y, lo.z), Vec3(hi.x, hi.y, lo.z), Vec3(hi.x, lo.y, lo.z));
+	soup.addQuad(Vec3(lo.x, lo.y, hi.z), Vec3(hi.x, lo.y, hi.z), Vec3(hi.x, hi.y, hi.z), Vec3(lo.x, hi.y, hi.z));
+
+	return soup;
+}
+
+static float boxDistance(const Vec3& p, const Vec3& lo, const Vec3& hi)
+{
+	const Vec3 centre = (lo + hi) * 0.5f;
+	const Vec3 extent = (hi - lo) * 0.5f;
+
+	const Vec3 q(std::abs(p.x - centre.x) - extent.x, std::abs(p.y - centre.y) - extent.y, std::abs(p.z - centre.z) - extent.z);
+	const Vec3 outside(std::max(q.x, 0.0f), std::max(q.y, 0.0f), std::max(q.z, 0.0f));
+
+	return length(outside) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+}
+
+// A 33^3 grid over [-1, 1]^3 with nodes on the multiples of 1/16, offset by a fraction of a cell so that no node sits
+// on a face
+static SDFGrid testGrid()
+{
+	SDFGrid grid;
+	grid.resolution[0] = grid.resolution[1] = grid.resolution[2] = 33;
+	grid.dx = Vec3(2.0f / 32.0f, 2.0f / 32.0f, 2.0f / 32.0f);
+	grid.origin = Vec3(-1.0f, -1.0f, -1.0f) + grid.dx * 0.3f;
+
+	return grid;
+}
+
+static std::vector<float> bake(const TriangleSoup& soup, const SDFGrid& grid)
+{
+	std::vector<float> distances(grid.numNodes());
+
+	bakeSDF(soup.vertices.data(), soup.indices.data(), soup.numTriangles(), grid, distances.data());
+
+	return distances;
+}
+
+static int failures = 0;
+
+static void expect(bool condition, const char * test, const char * what, const Vec3& p, float baked, float expected)
+{
+	if (condition)
+		return;
+
+	if (failures < 20)
+		std::printf("FAIL %s: %s at (%.3f, %.3f, %.3f), baked %.4f expected %.4f\n", test, what, p.x, p.y, p.z, baked, expected);
+
+	failures++;
+}
+
+// Every node of a closed cube has its exact distance and sign
+static void testClosedCube()
+{
+	const Vec3 lo(-0.5f, -0.4f, -0.6f), hi(0.5f, 0.6f, 0.4f);
+	const SDFGrid grid = testGrid();
+	const std::vector<float> distances = bake(box(lo, hi, true), grid);
+
+	const float tolerance = 1e-4f;
+
+	for (int32_t k = 0; k < grid.resolution[2]; ++k)
+	{
+		for (int32_t j = 0; j < grid.resolution[1]; ++j)
+		{
+			for (int32_t i = 0; i < grid.resolution[0]; ++i)
+			{
+				const Vec3 p = grid.position(i, j, k);
+				const float expected = boxDistance(p, lo, hi);
+				const float baked = distances[grid.flatIndex(i, j, k)];
+
+				expect(std::abs(baked - expected) <= tolerance, "closed cube", "distance", p, baked, expected);
+			}
+		}
+	}
+}
+
+// A box without its -x face: the nodes inside stay inside (only the -x ray escapes) and the nodes past the +x face
+// stay outside (only the -x ray crosses the surface), where the parity of a +x ray gets both wrong
+static void testOpenBox()
+{
+	const Vec3 lo(-0.5f, -0.5f, -0.5f), hi(0.5f, 0.5f, 0.5f);
+	const SDFGrid grid = testGrid();
+	const std::vector<float> distances = bake(box(lo, hi, false), grid);
+
+	for (int32_t k = 0; k < grid.resolution[2]; ++k)
+	{
+		for (int32_t j = 0; j < grid.resolution[1]; ++j)
+		{
+			for (int32_t i = 0; i < grid.resolution[0]; ++i)
+			{
+				const Vec3 p = grid.position(i, j, k);
+				const float expected = boxDistance(p, lo, hi);
+				const float baked = distances[grid.flatIndex(i, j, k)];
+
+				const bool insideBox = expected < 0.0f;
+				const bool pastPositiveX = p.x > hi.x && std::abs(p.y) < hi.y && std::abs(p.z) < hi.z;
+
+				if (insideBox)
+					expect(baked < 0.0f, "open box", "inside sign", p, baked, expected);
+				else if (pastPositiveX)
+					expect(baked > 0.0f, "open box", "outside sign", p, baked, expected);
+			}
+		}
+	}
+}
+
+// A wall across the volume has nothing behind it, every node is outside at its distance from the plane
+static void testLoneWall()
+{
+	const float wallX = 0.1f;
+
+	TriangleSoup soup;
+	soup.addQuad(Vec3(wallX, -2.0f, -2.0f), Vec3(wallX, 2.0f, -2.0f), Vec3(wallX, 2.0f, 2.0f), Vec3(wallX, -2.0f, 2.0f));
+
+	const SDFGrid grid = testGrid();
+	const std::vector<float> distances = bake(soup, grid);
+
+	for (int32_t k = 0; k < grid.resolution[2]; ++k)
+	{
+		for (int32_t j = 0; j < grid.resolution[1]; ++j)
+		{
+			for (int32_t i = 0; i < grid.resolution[0]; ++i)
+			{
+				const Vec3 p = grid.position(i, j, k);
+				const float expected = std::abs(p.x - wallX);
+				const float baked = distances[grid.flatIndex(i, j, k)];
+
+				expect(std::abs(baked - expected) <= 1e-4f, "lone wall", "distance", p, baked, expected);
+			}
+		}
+	}
+}
+
+int main()
+{
+	testClosedCube();
+	testOpenBox();
+	testLoneWall();
+
+	if (failures > 0)
+	{
+		std::printf("%d failures\n", failures);
+		return 1;
+	}
+
+	std::printf("all passed\n");
+	return 0;
+}
@@ -0,0 +1,135 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "BoidFlowField.h"
+
+#include "RHIStaticStates.h"
+#include "Shader.h"
+#include "GlobalShader.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+#include "RHICommandList.h"
+
+class FFlowField_curlNoise_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FFlowField_curlNoise_CS);
+	SHADER_USE_PARAMETER_STRUCT(FFlowField_curlNoise_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(FIntVector, resolution)
+		SHADER_PARAMETER(float, frequency)
+		SHADER_PARAMETER(uint32, tile)
+		SHADER_PARAMETER(float, amplitude)
+		SHADER_PARAMETER(FVector, noiseOffset)
+		SHADER_PARAMETER(float, time)
+
+		SHADER_PARAMETER_UAV(RWTexture3D<float4>, flowField)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FFlowField_curlNoise_CS, "/ComputeShaderPlugin/FlowField.usf", "curlNoise", SF_Compute);
+
+static FIntVector clampedResolution(FIntVector resolution)
+{
+	return FIntVector(FMath::Max(resolution.X, 1), FMath::Max(resolution.Y, 1), FMath::Max(resolution.Z, 1));
+}
+
+void FBoidFlowFieldData::createTexture(FTexture3DRHIRef& texture_out, FUnorderedAccessViewRHIRef& uav_out) const
+{
+	const FIntVector n = clampedResolution(resolution);
+
+	FRHIResourceCreateInfo createInfo;
+
+	texture_out = RHICreateTexture3D(n.X, n.Y, n.Z, PF_FloatRGBA, 1, TexCreate_ShaderResource | TexCreate_UAV, createInfo);
+	uav_out = RHICreateUnorderedAccessView(texture_out, 0);
+}
+
+void FBoidFlowFieldData::fill(
+	float time,
+	FTexture3DRHIRef texture,
+	FUnorderedAccessViewRHIRef textureUAV,
+	FRHICommandListImmediate& commands) const
+{
+	const FIntVector n = clampedResolution(resolution);
+
+	if (source == EBoidFlowFieldSource::Baked)
+	{
+		const int32 numTexels = n.X * n.Y * n.Z;
+
+		TArray<FFloat16Color> texels;
+		texels.Init(FFloat16Color(FLinearColor(0.0f, 0.0f, 0.0f, 0.0f)), numTexels);
+
+		const int32 numBaked = FMath::Min(numTexels, bakedVectors.Num());
+
+		for (int32 i = 0; i < numBaked; ++i)
+			texels[i] = FFloat16Color(FLinearColor(bakedVectors[i].X, bakedVectors[i].Y, bakedVectors[i].Z, 0.0f));
+
+		const uint32 rowPitch = n.X * sizeof(FFloat16Color);
+		const uint32 depthPitch = rowPitch * n.Y;
+
+		RHIUpdateTexture3D(texture, 0, FUpdateTextureRegion3D(0, 0, 0, 0, 0, 0, n.X, n.Y, n.Z), rowPitch, depthPitch, reinterpret_cast<const uint8*>(texels.GetData()));
+	}
+	else
+	{
+		FFlowField_curlNoise_CS::FParameters parameters;
+		parameters.resolution = n;
+		// a tiled field repeats the noise, so it has to fit a whole number of periods
+		parameters.frequency = tile ? FMath::Max(FMath::RoundToFloat(noiseFrequency), 1.0f) : noiseFrequency;
+		parameters.tile = tile ? 1 : 0;
+		parameters.amplitude = noiseAmplitude;
+		parameters.noiseOffset = noiseOffset;
+		parameters.time = time * animationSpeed;
+		parameters.flowField = textureUAV;
+
+		const FIntVector groupCount((n.X + 3) / 4, (n.Y + 3) / 4, (n.Z + 3) / 4);
+
+		TShaderMapRef<FFlowField_curlNoise_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupCount
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::EReadable,
+			EResourceTransitionPipeline::EComputeToCompute,
+			textureUAV
+		);
+	}
+}
+
+TSharedPtr<const FBoidFlowFieldData, ESPMode::ThreadSafe> UBoidFlowField::renderData() const
+{
+	TSharedPtr<FBoidFlowFieldData, ESPMode::ThreadSafe> data = MakeShared<FBoidFlowFieldData, ESPMode::ThreadSafe>();
+
+	data->source = source;
+	data->resolution = clampedResolution(resolution);
+	data->tile = tile;
+
+	uvwTransform(data->uvwScale, data->uvwOffset);
+
+	if (source == EBoidFlowFieldSource::Baked)
+		data->bakedVectors = bakedVectors;
+
+	data->noiseFrequency = noiseFrequency;
+	data->noiseAmplitude = noiseAmplitude;
+	data->noiseOffset = noiseOffset;
+	data->animationSpeed = animationSpeed;
+
+	return data;
+}
+
+void UBoidFlowField::uvwTransform(FVector& scale_out, FVector& offset_out) const
+{
+	const FVector size = bounds.GetSize().ComponentMax(FVector(KINDA_SMALL_NUMBER));
+
+	scale_out = FVector(1.0f) / size;
+	offset_out = -bounds.Min * scale_out;
+}
@@ -0,0 +1,106 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "RHIResources.h"
+#include "RHICommandList.h"
+
+#include "BoidFlowField.generated.h"
+
+UENUM(BlueprintType)
+enum class EBoidFlowFieldSource : uint8
+{
+	// The vectors in bakedVectors
+	Baked,
+	// Divergence-free noise generated on the GPU
+	CurlNoise
+};
+
+// A copy of a flow field for the render thread, made on the game thread with UBoidFlowField::renderData() so that the
+// render thread never reads the asset
+struct UNREALGPUSWARM_API FBoidFlowFieldData
+{
+	// Create an empty volume texture for the field, fill it with fill().
+	void createTexture(FTexture3DRHIRef& texture_out, FUnorderedAccessViewRHIRef& uav_out) const;
+
+	// Render thread, upload bakedVectors or generate the curl noise into a texture from createTexture(). time
+	// animates the noise.
+	void fill(
+		float time,
+		FTexture3DRHIRef texture,
+		FUnorderedAccessViewRHIRef textureUAV,
+		FRHICommandListImmediate& commands
+	) const;
+
+	// Does the field change over time?
+	bool isAnimated() const { return source == EBoidFlowFieldSource::CurlNoise && animationSpeed != 0.0f; }
+
+	EBoidFlowFieldSource source = EBoidFlowFieldSource::CurlNoise;
+
+	FIntVector resolution = FIntVector(1, 1, 1);
+	bool tile = false;
+
+	// uvw = position * uvwScale + uvwOffset
+	FVector uvwScale = FVector(1.0f);
+	FVector uvwOffset = FVector::ZeroVector;
+
+	// Only copied for a baked field
+	TArray<FVector> bakedVectors;
+
+	float noiseFrequency = 4.0f;
+	float noiseAmplitude = 1.0f;
+	FVector noiseOffset = FVector::ZeroVector;
+	float animationSpeed = 0.0f;
+};
+
+// A 3D vector field that the boids follow, for wind, weather and choreographed shapes. The field covers bounds, in the
+// space of the boids' actor, and is sampled once per boid.
+UCLASS(BlueprintType)
+class UNREALGPUSWARM_API UBoidFlowField : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	// Game thread, copy what the render thread needs to create and fill the field's texture.
+	TSharedPtr<const FBoidFlowFieldData, ESPMode::ThreadSafe> renderData() const;
+
+	// Does the field change over time?
+	bool isAnimated() const { return source == EBoidFlowFieldSource::CurlNoise && animationSpeed != 0.0f; }
+
+	// The scale and offset to go from a position to the field's uvw, uvw = position * scale + offset
+	void uvwTransform(FVector& scale_out, FVector& offset_out) const;
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EBoidFlowFieldSource source = EBoidFlowFieldSource::CurlNoise;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FBox bounds = FBox(FVector(-1000.0f), FVector(1000.0f));
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FIntVector resolution = FIntVector(32, 32, 32);
+
+	// Repeat the field outside of bounds, otherwise boids outside of it aren't affected
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool tile = false;
+
+	// resolution.X * resolution.Y * resolution.Z vectors, x fastest
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FVector> bakedVectors;
+
+	// Curl noise, in noise periods per bounds. Rounded to a whole number with tile, so the noise repeats with the field.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float noiseFrequency = 4.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float noiseAmplitude = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector noiseOffset = FVector::ZeroVector;
+
+	// How fast the noise moves through its fourth dimension, zero generates it once
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float animationSpeed = 0.0f;
+};
@@ -0,0 +1,206 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "BoidImpulseQueue.h"
+
+void FBoidImpulseQueue::init(int32 capacity)
+{
+	_ring.SetNum(FMath::Max(capacity, 1));
+	_head = 0;
+	_count = 0;
+}
+
+void FBoidImpulseQueue::_push(const FEvent& event)
+{
+	if (_ring.Num() == 0)
+		return;
+
+	_ring[_head] = event;
+	_head = (_head + 1) % _ring.Num();
+	_count = FMath::Min(_count + 1, _ring.Num());
+}
+
+void FBoidImpulseQueue::addImpulse(const FVector& centre, float radius, float strength)
+{
+	FEvent event;
+	event.centre = centre;
+	event.radius = radius;
+	event.strength = strength;
+	event.isImpulse = true;
+
+	_push(event);
+}
+
+void FBoidImpulseQueue::addForceField(const FVector& centre, float radius, float strength, float duration)
+{
+	FEvent event;
+	event.centre = centre;
+	event.radius = radius;
+	event.strength = strength;
+	event.timeRemaining = duration;
+	event.isImpulse = false;
+
+	_push(event);
+}
+
+uint32 FBoidImpulseQueue::maxWords(int32 capacity, uint32 bucketCount)
+{
+	return (bucketCount + 2) + uint32(capacity) * (maxCellsPerEvent + eventWords);
+}
+
+uint32 FBoidImpulseQueue::bucketOf(const FIntVector& cell, uint32 bucketCount)
+{
+	const uint32 x = uint32(cell.X), y = uint32(cell.Y), z = uint32(cell.Z);
+
+	return ((x * 73856093u) ^ (y * 19349663u) ^ (z * 83492791u)) % bucketCount;
+}
+
+void FBoidImpulseQueue::takeLive(float dt, TArray<FEvent>& live_out)
+{
+	live_out.Reset();
+
+	const int32 ringSize = _ring.Num();
+
+	if (ringSize == 0)
+		return;
+
+	// gather the live events, oldest first, and compact the ring
+	live_out.Reserve(_count);
+
+	const int32 tail = (_head - _count + ringSize) % ringSize;
+
+	for (int32 i = 0; i < _count; ++i)
+	{
+		const FEvent& event = _ring[(tail + i) % ringSize];
+
+		if (event.isImpulse || event.timeRemaining > 0.0f)
+			live_out.Add(event);
+	}
+
+	_count = 0;
+	_head = tail;
+
+	for (const FEvent& event : live_out)
+	{
+		FEvent aged = event;
+		aged.timeRemaining -= dt;
+
+		// impulses are applied once
+		if (!aged.isImpulse && aged.timeRemaining > 0.0f)
+			_push(aged);
+	}
+}
+
+uint32 FBoidImpulseQueue::pack(float dt, float cellSize, uint32 bucketCount, TArray<uint32>& data_out, uint32& eventsOffset_out)
+{
+	data_out.Reset();
+
+	const int32 ringSize = _ring.Num();
+
+	if (ringSize == 0 || bucketCount == 0)
+	{
+		eventsOffset_out = 0;
+		return 0;
+	}
+
+	TArray<FEvent> live;
+	takeLive(dt, live);
+
+	const uint32 numEvents = live.Num();
+	const float cellSizeReciprocal = 1.0f / FMath::Max(cellSize, KINDA_SMALL_NUMBER);
+
+	// the buckets an event touches, without duplicates, an empty list means the unbucketed list
+	TArray<TArray<uint32, TInlineAllocator<maxCellsPerEvent>>> eventBuckets;
+	eventBuckets.SetNum(numEvents);
+
+	TArray<uint32> counts;
+	counts.Init(0, bucketCount + 1);
+
+	for (uint32 e = 0; e < numEvents; ++e)
+	{
+		const FEvent& event = live[e];
+
+		const FVector lo = (event.centre - FVector(event.radius)) * cellSizeReciprocal;
+		const FVector hi = (event.centre + FVector(event.radius)) * cellSizeReciprocal;
+
+		const FIntVector cellLo(FMath::FloorToInt(lo.X), FMath::FloorToInt(lo.Y), FMath::FloorToInt(lo.Z));
+		const FIntVector cellHi(FMath::FloorToInt(hi.X), FMath::FloorToInt(hi.Y), FMath::FloorToInt(hi.Z));
+
+		const int64 numCells = int64(cellHi.X - cellLo.X + 1) * int64(cellHi.Y - cellLo.Y + 1) * int64(cellHi.Z - cellLo.Z + 1);
+
+		if (numCells > maxCellsPerEvent)
+		{
+			counts[bucketCount]++;
+			continue;
+		}
+
+		for (int32 z = cellLo.Z; z <= cellHi.Z; ++z)
+		{
+			for (int32 y = cellLo.Y; y <= cellHi.Y; ++y)
+			{
+				for (int32 x = cellLo.X; x <= cellHi.X; ++x)
+				{
+					const uint32 bucket = bucketOf(FIntVector(x, y, z), bucketCount);
+
+					if (!eventBuckets[e].Contains(bucket))
+					{
+						eventBuckets[e].Add(bucket);
+						counts[bucket]++;
+					}
+				}
+			}
+		}
+	}
+
+	// offsets, a prefix sum over the counts
+	const uint32 entriesOffset = bucketCount + 2;
+
+	uint32 numEntries = 0;
+
+	data_out.SetNumUninitialized(entriesOffset);
+
+	for (uint32 b = 0; b <= bucketCount; ++b)
+	{
+		data_out[b] = numEntries;
+		numEntries += counts[b];
+	}
+
+	data_out[bucketCount + 1] = numEntries;
+
+	// entries
+	eventsOffset_out = entriesOffset + numEntries;
+
+	data_out.SetNumUninitialized(eventsOffset_out + numEvents * eventWords);
+
+	TArray<uint32> cursor;
+	cursor.SetNumUninitialized(bucketCount + 1);
+
+	for (uint32 b = 0; b <= bucketCount; ++b)
+		cursor[b] = data_out[b];
+
+	for (uint32 e = 0; e < numEvents; ++e)
+	{
+		if (eventBuckets[e].Num() == 0)
+			data_out[entriesOffset + cursor[bucketCount]++] = e;
+
+		for (uint32 bucket : eventBuckets[e])
+			data_out[entriesOffset + cursor[bucket]++] = e;
+	}
+
+	// events
+	for (uint32 e = 0; e < numEvents; ++e)
+	{
+		const FEvent& event = live[e];
+
+		uint32 * words = &data_out[eventsOffset_out + e * eventWords];
+
+		FMemory::Memcpy(&words[0], &event.centre.X, sizeof(float));
+		FMemory::Memcpy(&words[1], &event.centre.Y, sizeof(float));
+		FMemory::Memcpy(&words[2], &event.centre.Z, sizeof(float));
+		FMemory::Memcpy(&words[3], &event.radius, sizeof(float));
+		FMemory::Memcpy(&words[4], &event.strength, sizeof(float));
+
+		words[5] = event.isImpulse ? impulseFlag : 0;
+	}
+
+	return numEvents;
+}
@@ -0,0 +1,70 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// A ring buffer of spherical impulses (one-shot velocity kicks) and force fields (accelerations that last a while), for
+// explosions and gameplay effects, owned by the render thread's FBoidSimulationProxy. Once a frame the live events are
+// packed, with a tiny spatial bucketing, into one array of words that is uploaded with a single copy and read by
+// IntegrateBoidPosition.
+//
+// Layout of the packed words:
+//   [0, bucketCount + 2)        offsets into the entries, bucket b is [offset[b], offset[b + 1]), bucket bucketCount
+//                               holds the events too big to bucket and every boid visits it
+//   [bucketCount + 2, events)   entries, event indices
+//   [events, ...)               eventWords per event: centre xyz, radius, strength (floats) and flags
+//
+// When the ring is full the oldest events are overwritten.
+struct UNREALGPUSWARM_API FBoidImpulseQueue
+{
+public:
+	struct FEvent
+	{
+		FVector centre = FVector::ZeroVector;
+		float radius = 0.0f;
+		float strength = 0.0f;
+		float timeRemaining = 0.0f;
+		bool isImpulse = false;
+	};
+
+	static constexpr uint32 eventWords = 6;
+	static constexpr uint32 impulseFlag = 1;
+
+	// An event overlapping more than this many cells goes into the unbucketed list
+	static constexpr int32 maxCellsPerEvent = 27;
+
+public:
+	void init(int32 capacity);
+
+	int32 capacity() const { return _ring.Num(); }
+	int32 num() const { return _count; }
+
+	// strength is a change in velocity, positive pushes away from the centre
+	void addImpulse(const FVector& centre, float radius, float strength);
+
+	// strength is an acceleration, positive pushes away from the centre
+	void addForceField(const FVector& centre, float radius, float strength, float duration);
+
+	// Pack the live events into data_out and age them by dt, impulses only live for one pack. Returns the number of
+	// packed events and the word offset of the first event.
+	uint32 pack(float dt, float cellSize, uint32 bucketCount, TArray<uint32>& data_out, uint32& eventsOffset_out);
+
+	// The live events, oldest first, unpacked for the CPU backend. Ages them by dt like pack.
+	void takeLive(float dt, TArray<FEvent>& live_out);
+
+	// The most words pack() can write
+	static uint32 maxWords(int32 capacity, uint32 bucketCount);
+
+	// Must match impulseBucket in Boid.usf
+	static uint32 bucketOf(const FIntVector& cell, uint32 bucketCount);
+
+protected:
+	void _push(const FEvent& event);
+
+protected:
+	TArray<FEvent> _ring;
+
+	int32 _head = 0; // the next slot to write
+	int32 _count = 0;
+};
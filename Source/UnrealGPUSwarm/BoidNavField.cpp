@@ -0,0 +1,392 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "BoidNavField.h"
+
+#include "RHIStaticStates.h"
+#include "Shader.h"
+#include "GlobalShader.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+#include "RHICommandList.h"
+#include "RenderUtils.h"
+
+#include "BoidSDFBaker.h"
+
+class FNavField_reset_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FNavField_reset_CS);
+	SHADER_USE_PARAMETER_STRUCT(FNavField_reset_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(FIntVector, resolution)
+		SHADER_PARAMETER(FIntVector, goalCell)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, navField)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, navField_other)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FNavField_reset_CS, "/ComputeShaderPlugin/NavField.usf", "resetNavField", SF_Compute);
+
+class FNavField_relax_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FNavField_relax_CS);
+	SHADER_USE_PARAMETER_STRUCT(FNavField_relax_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(FIntVector, resolution)
+		SHADER_PARAMETER(FVector, cellSize)
+		SHADER_PARAMETER(FIntVector, goalCell)
+
+		SHADER_PARAMETER(uint32, useSDF)
+		SHADER_PARAMETER(float, agentRadius)
+		SHADER_PARAMETER_TEXTURE(Texture3D, sdfTexture)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, navField)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, navField_other)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FNavField_relax_CS, "/ComputeShaderPlugin/NavField.usf", "relaxNavField", SF_Compute);
+
+class FNavField_publish_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FNavField_publish_CS);
+	SHADER_USE_PARAMETER_STRUCT(FNavField_publish_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(FIntVector, resolution)
+		SHADER_PARAMETER(FVector, cellSize)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, navField)
+		SHADER_PARAMETER_UAV(RWTexture3D<float4>, navTexture)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FNavField_publish_CS, "/ComputeShaderPlugin/NavField.usf", "publishNavField", SF_Compute);
+
+static FIntVector groupCount(FIntVector resolution)
+{
+	return FIntVector((resolution.X + 3) / 4, (resolution.Y + 3) / 4, (resolution.Z + 3) / 4);
+}
+
+void FBoidNavField::init(FIntVector resolution_in, const FBox& bounds_in)
+{
+	resolution = FIntVector(FMath::Max(resolution_in.X, 2), FMath::Max(resolution_in.Y, 2), FMath::Max(resolution_in.Z, 2));
+	bounds = bounds_in;
+	cellSize = FBoidSDFBaker::cellSize(bounds, resolution);
+
+	const int32 numVoxels = resolution.X * resolution.Y * resolution.Z;
+	const size_t size = sizeof(float);
+
+	TResourceArray<float> resourceArray;
+	resourceArray.Init(farDistance(), numVoxels);
+
+	FRHIResourceCreateInfo createInfo;
+	createInfo.ResourceArray = &resourceArray;
+
+	TResourceArray<float> otherArray = resourceArray;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		_fieldBuffer[i] = RHICreateStructuredBuffer(size, size * numVoxels, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_fieldBufferUAV[i] = RHICreateUnorderedAccessView(_fieldBuffer[i], false, false);
+
+		createInfo.ResourceArray = &otherArray;
+	}
+
+	FRHIResourceCreateInfo textureCreateInfo;
+
+	texture = RHICreateTexture3D(resolution.X, resolution.Y, resolution.Z, PF_FloatRGBA, 1, TexCreate_ShaderResource | TexCreate_UAV, textureCreateInfo);
+	textureUAV = RHICreateUnorderedAccessView(texture, 0);
+
+	_current = 0;
+	_goalCell = FIntVector(-1, -1, -1);
+}
+
+FIntVector FBoidNavField::cellOf(const FVector& position) const
+{
+	const FVector local = (position - bounds.Min) / cellSize.ComponentMax(FVector(KINDA_SMALL_NUMBER));
+
+	return FIntVector(FMath::RoundToInt(local.X), FMath::RoundToInt(local.Y), FMath::RoundToInt(local.Z));
+}
+
+void FBoidNavField::reset(
+	FIntVector goalCell,
+	FTexture3DRHIRef sdf,
+	float agentRadius,
+	FRHICommandListImmediate& commands)
+{
+	_goalCell = goalCell;
+	_sdf = sdf;
+	_agentRadius = agentRadius;
+
+	FNavField_reset_CS::FParameters parameters;
+	parameters.resolution = resolution;
+	parameters.goalCell = goalCell;
+	parameters.navField = _fieldBufferUAV[0];
+	parameters.navField_other = _fieldBufferUAV[1];
+
+	TShaderMapRef<FNavField_reset_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+	FComputeShaderUtils::Dispatch(
+		commands,
+		*computeShader,
+		parameters,
+		groupCount(resolution)
+	);
+
+	_current = 0;
+}
+
+void FBoidNavField::moveGoal(FIntVector goalCell)
+{
+	// the relaxation pins the goal to zero and updates every other voxel from its neighbours, so the old goal rises
+	// to its distance from the new one
+	_goalCell = goalCell;
+}
+
+bool FBoidNavField::contains(FIntVector cell) const
+{
+	return cell.X >= 0 && cell.Y >= 0 && cell.Z >= 0 && cell.X < resolution.X && cell.Y < resolution.Y && cell.Z < resolution.Z;
+}
+
+void FBoidNavField::relax(int32 iterations, FRHICommandListImmediate& commands)
+{
+	TShaderMapRef<FNavField_relax_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+
+	for (int32 i = 0; i < iterations; ++i)
+	{
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			_fieldBufferUAV[_current]
+		);
+
+		FNavField_relax_CS::FParameters parameters;
+		parameters.resolution = resolution;
+		parameters.cellSize = cellSize;
+		parameters.goalCell = _goalCell;
+
+		parameters.useSDF = _sdf.IsValid() ? 1 : 0;
+		parameters.agentRadius = _agentRadius;
+		parameters.sdfTexture = _sdf.IsValid() ? _sdf.GetReference() : GBlackVolumeTexture->TextureRHI.GetReference();
+
+		parameters.navField = _fieldBufferUAV[_current];
+		parameters.navField_other = _fieldBufferUAV[1 - _current];
+
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupCount(resolution)
+		);
+
+		_current = 1 - _current;
+	}
+}
+
+void FBoidNavField::publish(FRHICommandListImmediate& commands)
+{
+	commands.TransitionResource(
+		EResourceTransitionAccess::ERWBarrier,
+		EResourceTransitionPipeline::EComputeToCompute,
+		_fieldBufferUAV[_current]
+	);
+
+	FNavField_publish_CS::FParameters parameters;
+	parameters.resolution = resolution;
+	parameters.cellSize = cellSize;
+	parameters.navField = _fieldBufferUAV[_current];
+	parameters.navTexture = textureUAV;
+
+	TShaderMapRef<FNavField_publish_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+	FComputeShaderUtils::Dispatch(
+		commands,
+		*computeShader,
+		parameters,
+		groupCount(resolution)
+	);
+
+	commands.TransitionResource(
+		EResourceTransitionAccess::EReadable,
+		EResourceTransitionPipeline::EComputeToCompute,
+		textureUAV
+	);
+}
+
+// ------------------------------------------------------------------------------------------------
+// CPU reference
+// ------------------------------------------------------------------------------------------------
+
+namespace
+{
+	void sortPair(float& a, float& ha, float& b, float& hb)
+	{
+		if (b < a)
+		{
+			Swap(a, b);
+			Swap(ha, hb);
+		}
+	}
+
+	// Must match godunovUpdate in NavField.usf
+	float godunovUpdate(FVector a, FVector h)
+	{
+		sortPair(a.X, h.X, a.Y, h.Y);
+		sortPair(a.Y, h.Y, a.Z, h.Z);
+		sortPair(a.X, h.X, a.Y, h.Y);
+
+		if (a.X >= FBoidNavField::farDistance())
+			return FBoidNavField::farDistance();
+
+		float u = a.X + h.X;
+
+		if (u <= a.Y)
+			return u;
+
+		// two dimensions
+		{
+			const float A = 1.0f / (h.X * h.X) + 1.0f / (h.Y * h.Y);
+			const float B = -2.0f * (a.X / (h.X * h.X) + a.Y / (h.Y * h.Y));
+			const float C = (a.X * a.X) / (h.X * h.X) + (a.Y * a.Y) / (h.Y * h.Y) - 1.0f;
+
+			u = (-B + FMath::Sqrt(FMath::Max(B * B - 4.0f * A * C, 0.0f))) / (2.0f * A);
+		}
+
+		if (u <= a.Z)
+			return u;
+
+		// three dimensions
+		{
+			const FVector ih2 = FVector(1.0f) / (h * h);
+
+			const float A = ih2.X + ih2.Y + ih2.Z;
+			const float B = -2.0f * FVector::DotProduct(a, ih2);
+			const float C = FVector::DotProduct(a * a, ih2) - 1.0f;
+
+			u = (-B + FMath::Sqrt(FMath::Max(B * B - 4.0f * A * C, 0.0f))) / (2.0f * A);
+		}
+
+		return u;
+	}
+}
+
+void FBoidNavField::solveReference(
+	const TArray<uint8>& blocked,
+	FIntVector n,
+	FVector h,
+	FIntVector goal,
+	TArray<float>& u)
+{
+	const int32 numVoxels = n.X * n.Y * n.Z;
+
+	check(blocked.Num() == 0 || blocked.Num() == numVoxels);
+
+	auto flat = [&](int32 i, int32 j, int32 k) { return i + j * n.X + k * n.X * n.Y; };
+
+	auto at = [&](int32 i, int32 j, int32 k) -> float
+	{
+		if (i < 0 || j < 0 || k < 0 || i >= n.X || j >= n.Y || k >= n.Z)
+			return farDistance();
+
+		return u[flat(i, j, k)];
+	};
+
+	u.Init(farDistance(), numVoxels);
+
+	const bool goalInside = goal.X >= 0 && goal.Y >= 0 && goal.Z >= 0 && goal.X < n.X && goal.Y < n.Y && goal.Z < n.Z;
+
+	if (!goalInside)
+		return;
+
+	u[flat(goal.X, goal.Y, goal.Z)] = 0.0f;
+
+	// Gauss-Seidel sweeps in the eight orderings until nothing changes
+	bool changed = true;
+
+	for (int32 pass = 0; changed && pass < 64; ++pass)
+	{
+		changed = false;
+
+		for (int32 sweep = 0; sweep < 8; ++sweep)
+		{
+			const int32 di = sweep & 1 ? -1 : 1;
+			const int32 dj = sweep & 2 ? -1 : 1;
+			const int32 dk = sweep & 4 ? -1 : 1;
+
+			for (int32 k = dk > 0 ? 0 : n.Z - 1; k >= 0 && k < n.Z; k += dk)
+			{
+				for (int32 j = dj > 0 ? 0 : n.Y - 1; j >= 0 && j < n.Y; j += dj)
+				{
+					for (int32 i = di > 0 ? 0 : n.X - 1; i >= 0 && i < n.X; i += di)
+					{
+						const int32 f = flat(i, j, k);
+
+						if (FIntVector(i, j, k) == goal || (blocked.Num() && blocked[f]))
+							continue;
+
+						const FVector a(
+							FMath::Min(at(i - 1, j, k), at(i + 1, j, k)),
+							FMath::Min(at(i, j - 1, k), at(i, j + 1, k)),
+							FMath::Min(at(i, j, k - 1), at(i, j, k + 1))
+						);
+
+						const float updated = godunovUpdate(a, h);
+
+						if (updated < u[f])
+						{
+							changed |= (u[f] - updated) > 1e-4f * h.GetMin();
+							u[f] = updated;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+void FBoidNavField::blockedFromSDF(const TArray<float>& sdf, float agentRadius, TArray<uint8>& blocked_out)
+{
+	blocked_out.SetNumUninitialized(sdf.Num());
+
+	for (int32 i = 0; i < sdf.Num(); ++i)
+		blocked_out[i] = sdf[i] < agentRadius ? 1 : 0;
+}
+
+float FBoidNavField::maxDifference(const TArray<float>& a, const TArray<float>& b)
+{
+	float result = 0.0f;
+
+	const int32 num = FMath::Min(a.Num(), b.Num());
+
+	for (int32 i = 0; i < num; ++i)
+	{
+		if (a[i] >= farDistance() || b[i] >= farDistance())
+			continue;
+
+		result = FMath::Max(result, FMath::Abs(a[i] - b[i]));
+	}
+
+	return result;
+}
@@ -0,0 +1,87 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+#include "RHICommandList.h"
+
+// A distance-to-goal field over a voxel grid of the level, solved on the GPU (see NavField.usf). Boids follow its
+// downhill direction to reach the goal around obstacles, without any per-boid pathfinding.
+//
+// The solve is incremental: reset() seeds a new goal, relax() runs a budget of Jacobi iterations (call it every frame)
+// and publish() writes the field into the volume texture the boids sample. The previously published field stays in
+// use while a new goal converges. moveGoal() warm starts the solve from the current field instead of reseeding it.
+struct UNREALGPUSWARM_API FBoidNavField
+{
+public:
+	// Allocate the field for resolution voxels spanning bounds, voxel i sits at bounds.Min + i * cellSize.
+	void init(FIntVector resolution, const FBox& bounds);
+
+	bool isInitialized() const { return _fieldBuffer[0].IsValid(); }
+
+	// The voxel containing position, it may be outside of the grid
+	FIntVector cellOf(const FVector& position) const;
+
+	// Render thread, restart the solve towards goalCell. Voxels with sdf < agentRadius are blocked when sdf is valid,
+	// the sdf must use the same grid as the field.
+	void reset(
+		FIntVector goalCell,
+		FTexture3DRHIRef sdf,
+		float agentRadius,
+		FRHICommandListImmediate& commands
+	);
+
+	// Render thread, move the goal of a field that was reset() without reseeding it. The relaxation carries on from the
+	// current distances, which are already within the goal's displacement of the new ones, so the field stays usable
+	// while it converges and a goal that moves a voxel or two settles in a few iterations.
+	void moveGoal(FIntVector goalCell);
+
+	bool contains(FIntVector cell) const;
+
+	// Render thread, run a number of Jacobi iterations
+	void relax(int32 iterations, FRHICommandListImmediate& commands);
+
+	// Render thread, write the downhill direction (xyz) and the distance (w) into texture
+	void publish(FRHICommandListImmediate& commands);
+
+	// The structured buffer holding the latest iteration, for readback
+	FStructuredBufferRHIRef currentFieldBuffer() const { return _fieldBuffer[_current]; }
+
+	// CPU reference solver, fast sweeping with the same Godunov update as the GPU. Unreachable and blocked voxels are
+	// farDistance().
+	static void solveReference(
+		const TArray<uint8>& blocked,
+		FIntVector resolution,
+		FVector cellSize,
+		FIntVector goalCell,
+		TArray<float>& distances_out
+	);
+
+	// Voxels closer than agentRadius to the geometry
+	static void blockedFromSDF(const TArray<float>& sdf, float agentRadius, TArray<uint8>& blocked_out);
+
+	// The largest difference between two fields, over the voxels both reached
+	static float maxDifference(const TArray<float>& a, const TArray<float>& b);
+
+	static constexpr float farDistance() { return 1e30f; }
+
+public:
+	FIntVector resolution = FIntVector(0, 0, 0);
+	FBox bounds = FBox(ForceInit);
+	FVector cellSize = FVector::ZeroVector;
+
+	FTexture3DRHIRef texture;
+	FUnorderedAccessViewRHIRef textureUAV;
+
+protected:
+	FStructuredBufferRHIRef _fieldBuffer[2];
+	FUnorderedAccessViewRHIRef _fieldBufferUAV[2];
+
+	int32 _current = 0;
+
+	FIntVector _goalCell = FIntVector(-1, -1, -1);
+
+	FTexture3DRHIRef _sdf;
+	float _agentRadius = 0.0f;
+};
@@ -0,0 +1,181 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "BoidSDFBaker.h"
+
+#include "SwarmCore/SwarmCoreSDF.h"
+
+#include "RHI.h"
+#include "RHICommandList.h"
+
+#include "Engine/World.h"
+#include "Engine/StaticMesh.h"
+#include "Components/StaticMeshComponent.h"
+#include "StaticMeshResources.h"
+#include "UObject/UObjectIterator.h"
+
+namespace
+{
+	class FBoidSDFBulkData : public FResourceBulkDataInterface
+	{
+	public:
+		FBoidSDFBulkData(const void * data, uint32 size) : _data(data), _size(size) {}
+
+		virtual const void* GetResourceBulkData() const override { return _data; }
+		virtual uint32 GetResourceBulkDataSize() const override { return _size; }
+		virtual void Discard() override {}
+
+	protected:
+		const void * _data;
+		uint32 _size;
+	};
+}
+
+FVector FBoidSDFBaker::cellSize(const FBox& bounds, FIntVector resolution)
+{
+	const FVector intervals(
+		FMath::Max(resolution.X - 1, 1),
+		FMath::Max(resolution.Y - 1, 1),
+		FMath::Max(resolution.Z - 1, 1)
+	);
+
+	return bounds.GetSize() / intervals;
+}
+
+void FBoidSDFBaker::bake(
+	const TArray<FVector>& vertices,
+	const TArray<int32>& indices,
+	const FBox& bounds,
+	FIntVector resolution,
+	TArray<float>& distances_out,
+	int32 exactBand /*= 1*/)
+{
+	SwarmCore::SDFGrid grid;
+	grid.resolution[0] = FMath::Max(resolution.X, 2);
+	grid.resolution[1] = FMath::Max(resolution.Y, 2);
+	grid.resolution[2] = FMath::Max(resolution.Z, 2);
+
+	const FVector dx = cellSize(bounds, FIntVector(grid.resolution[0], grid.resolution[1], grid.resolution[2]));
+
+	grid.origin = SwarmCore::Vec3(bounds.Min.X, bounds.Min.Y, bounds.Min.Z);
+	grid.dx = SwarmCore::Vec3(dx.X, dx.Y, dx.Z);
+
+	distances_out.SetNumUninitialized(grid.numNodes());
+
+	static_assert(sizeof(FVector) == sizeof(float) * 3, "the core reads the vertices as xyz triples");
+
+	SwarmCore::bakeSDF(
+		reinterpret_cast<const float*>(vertices.GetData()),
+		indices.GetData(),
+		indices.Num() / 3,
+		grid,
+		distances_out.GetData(),
+		exactBand
+	);
+}
+
+void FBoidSDFBaker::gatherStaticGeometry(
+	UWorld * world,
+	const FBox& bounds,
+	const FTransform& worldToSDF,
+	TArray<FVector>& vertices_out,
+	TArray<int32>& indices_out,
+	const AActor * ignore /*= nullptr*/)
+{
+	if (!world)
+		return;
+
+	const FBox worldBounds = bounds.TransformBy(worldToSDF.Inverse());
+
+	for (TObjectIterator<UStaticMeshComponent> it; it; ++it)
+	{
+		UStaticMeshComponent * component = *it;
+
+		if (component->GetWorld() != world || component->Mobility != EComponentMobility::Static)
+			continue;
+
+		if (ignore && component->GetOwner() == ignore)
+			continue;
+
+		if (!component->Bounds.GetBox().Intersect(worldBounds))
+			continue;
+
+		UStaticMesh * mesh = component->GetStaticMesh();
+
+		if (!mesh || !mesh->RenderData || mesh->RenderData->LODResources.Num() == 0)
+			continue;
+
+		const FStaticMeshLODResources& lod = mesh->RenderData->LODResources[0];
+		const FPositionVertexBuffer& positions = lod.VertexBuffers.PositionVertexBuffer;
+		const FIndexArrayView lodIndices = lod.IndexBuffer.GetArrayView();
+
+		const FTransform toSDF = component->GetComponentTransform() * worldToSDF;
+
+		const int32 base = vertices_out.Num();
+
+		for (uint32 i = 0; i < positions.GetNumVertices(); ++i)
+			vertices_out.Add(toSDF.TransformPosition(positions.VertexPosition(i)));
+
+		for (int32 i = 0; i < lodIndices.Num(); ++i)
+			indices_out.Add(base + int32(lodIndices[i]));
+	}
+}
+
+void FBoidSDFBaker::uvwTransform(const FBox& bounds, FIntVector resolution, FVector& scale_out, FVector& offset_out)
+{
+	const FVector dx = cellSize(bounds, resolution);
+	const FVector n(resolution);
+
+	// node i sits in the centre of texel i
+	scale_out = FVector(1.0f) / (dx * n);
+	offset_out = FVector(0.5f) / n - bounds.Min * scale_out;
+}
+
+FTexture3DRHIRef FBoidSDFBaker::createTexture(const TArray<float>& distances, FIntVector resolution, const FBox& bounds)
+{
+	const FIntVector& n = resolution;
+
+	check(distances.Num() == n.X * n.Y * n.Z);
+
+	const FVector dx = cellSize(bounds, resolution);
+
+	auto distanceAt = [&](int32 i, int32 j, int32 k) -> float
+	{
+		i = FMath::Clamp(i, 0, n.X - 1);
+		j = FMath::Clamp(j, 0, n.Y - 1);
+		k = FMath::Clamp(k, 0, n.Z - 1);
+
+		return distances[i + j * n.X + k * n.X * n.Y];
+	};
+
+	TArray<FFloat16Color> texels;
+	texels.SetNumUninitialized(distances.Num());
+
+	for (int32 k = 0; k < n.Z; ++k)
+	{
+		for (int32 j = 0; j < n.Y; ++j)
+		{
+			for (int32 i = 0; i < n.X; ++i)
+			{
+				const FVector gradient(
+					(distanceAt(i + 1, j, k) - distanceAt(i - 1, j, k)) / dx.X,
+					(distanceAt(i, j + 1, k) - distanceAt(i, j - 1, k)) / dx.Y,
+					(distanceAt(i, j, k + 1) - distanceAt(i, j, k - 1)) / dx.Z
+				);
+
+				const FVector normal = gradient.GetSafeNormal();
+
+				// stay inside the range of a half
+				const float distance = FMath::Clamp(distanceAt(i, j, k), -65000.0f, 65000.0f);
+
+				texels[i + j * n.X + k * n.X * n.Y] = FFloat16Color(FLinearColor(normal.X, normal.Y, normal.Z, distance));
+			}
+		}
+	}
+
+	FBoidSDFBulkData bulkData(texels.GetData(), texels.Num() * texels.GetTypeSize());
+
+	FRHIResourceCreateInfo createInfo;
+	createInfo.BulkData = &bulkData;
+
+	return RHICreateTexture3D(n.X, n.Y, n.Z, PF_FloatRGBA, 1, TexCreate_ShaderResource, createInfo);
+}
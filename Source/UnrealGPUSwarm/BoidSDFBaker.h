@@ -0,0 +1,48 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+
+class UWorld;
+class AActor;
+
+// Bakes triangle soups into a signed distance field on the CPU, after Batty's SDFGen. Distances are exact within
+// exactBand cells of a triangle, propagated outwards with fast sweeping, and signed by a majority vote of the crossings
+// along six rays, so open level geometry keeps a sensible sign (see SwarmCore::bakeSDF).
+//
+// The field is sampled at resolution.X * resolution.Y * resolution.Z nodes spanning the bounds, x fastest.
+struct UNREALGPUSWARM_API FBoidSDFBaker
+{
+public:
+	static void bake(
+		const TArray<FVector>& vertices,
+		const TArray<int32>& indices,
+		const FBox& bounds,
+		FIntVector resolution,
+		TArray<float>& distances_out,
+		int32 exactBand = 1
+	);
+
+	// Collect the LOD0 triangles of the static mesh components in world that overlap bounds (in SDF space).
+	// worldToSDF takes world positions into the SDF space, ignore is skipped.
+	static void gatherStaticGeometry(
+		UWorld * world,
+		const FBox& bounds,
+		const FTransform& worldToSDF,
+		TArray<FVector>& vertices_out,
+		TArray<int32>& indices_out,
+		const AActor * ignore = nullptr
+	);
+
+	// The distance between two nodes along each axis
+	static FVector cellSize(const FBox& bounds, FIntVector resolution);
+
+	// A half-float volume with the normalised gradient in rgb and the signed distance in a, for one trilinear fetch
+	// per boid.
+	static FTexture3DRHIRef createTexture(const TArray<float>& distances, FIntVector resolution, const FBox& bounds);
+
+	// The scale and offset to go from a position to the volume's uvw, uvw = position * scale + offset
+	static void uvwTransform(const FBox& bounds, FIntVector resolution, FVector& scale_out, FVector& offset_out);
+};
@@ -0,0 +1,1803 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "BoidSimulationProxy.h"
+
+#include "ShaderParameterUtils.h"
+#include "RHIStaticStates.h"
+#include "Shader.h"
+#include "GlobalShader.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+#include "UniformBuffer.h"
+
+#include "BoidFlowField.h"
+#include "BoidSDFBaker.h"
+#include "Private/InstanceBufferMesh.h"
+
+#include "RenderUtils.h"
+#include "TextureResource.h"
+#include "SceneView.h"
+
+
+class FBoidsComputeShader : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FBoidsComputeShader);
+	SHADER_USE_PARAMETER_STRUCT(FBoidsComputeShader, FGlobalShader);
+
+	// Use wave votes to skip empty neighbour cells for the whole wave
+	class FWaveOccupancyDim : SHADER_PERMUTATION_BOOL("USE_WAVE_OCCUPANCY");
+
+	// Only update the boids in the simulation LOD active list, dispatched indirectly
+	class FActiveListDim : SHADER_PERMUTATION_BOOL("USE_ACTIVE_LIST");
+
+	// Look up the species interaction matrix for every neighbour
+	class FSpeciesDim : SHADER_PERMUTATION_BOOL("USE_SPECIES");
+
+	// Find neighbours in the xy plane with a 9 cell stencil
+	class FPlanarDim : SHADER_PERMUTATION_BOOL("PLANAR_2D");
+
+	// The behaviour rules compiled into the kernel, a mask of EBoidRule
+	class FRulesDim : SHADER_PERMUTATION_INT("BOID_RULES", EBoidRule::All + 1);
+
+	// Find neighbours by traversing the LBVH instead of the hashed grid
+	class FSpatialIndexDim : SHADER_PERMUTATION_BOOL("USE_LBVH");
+
+	using FPermutationDomain = TShaderPermutationDomain<FWaveOccupancyDim, FActiveListDim, FSpeciesDim, FPlanarDim, FRulesDim, FSpatialIndexDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(float, dt)
+		SHADER_PARAMETER(float, totalTime)
+		SHADER_PARAMETER(float, boidSpeed)
+		SHADER_PARAMETER(float, boidSpeedVariation)
+		SHADER_PARAMETER(float, boidRotationSpeed)
+		SHADER_PARAMETER(float, homeInnerRadius)
+		SHADER_PARAMETER(float, separationDistance)
+		SHADER_PARAMETER(float, neighbourhoodDistance)
+
+		SHADER_PARAMETER(float, homeUrge)
+		SHADER_PARAMETER(float, separationUrge)
+		SHADER_PARAMETER(float, cohesionUrge)
+		SHADER_PARAMETER(float, alignmentUrge)
+
+		SHADER_PARAMETER_ARRAY(FVector4, speciesInteractions, [FBoidSimulationProxy::maxSpecies * FBoidSimulationProxy::maxSpecies])
+
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, newDirections)
+
+		SHADER_PARAMETER(uint32, sliceOffset)
+		SHADER_PARAMETER(uint32, sliceSize)
+
+		SHADER_PARAMETER(uint32, useSuperBoids)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidLeaders)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidCounts)
+
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, cellSizeReciprocal)
+		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
+		SHADER_PARAMETER(FIntVector, gridDimensions)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
+
+		SHADER_PARAMETER(FIntVector, blockDimensions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOccupancyBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, blockOccupancyBuffer)
+
+		SHADER_PARAMETER(uint32, numLBVHItems)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, lbvhChildren)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, lbvhNodeMin)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, lbvhNodeMax)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, activeBoidIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, simulationLODCounters)
+
+		SHADER_PARAMETER(uint32, numInfluencers)
+		SHADER_PARAMETER(float, influencerCellSizeReciprocal)
+		SHADER_PARAMETER(FIntVector, influencerGridDimensions)
+		SHADER_PARAMETER(uint32, influencerCellOffsetBufferSize)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, influencerPositions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, influencerShapes)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, influencerParticleIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, influencerCellIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, influencerCellOffsetBuffer)
+
+		SHADER_PARAMETER(uint32, useSDF)
+		SHADER_PARAMETER(FVector, sdfUVWScale)
+		SHADER_PARAMETER(FVector, sdfUVWOffset)
+		SHADER_PARAMETER(float, sdfAvoidanceDistance)
+		SHADER_PARAMETER(float, sdfAvoidanceUrge)
+
+		SHADER_PARAMETER_TEXTURE(Texture3D, sdfTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, sdfSampler)
+
+		SHADER_PARAMETER(uint32, useFlowField)
+		SHADER_PARAMETER(uint32, flowTile)
+		SHADER_PARAMETER(FVector, flowUVWScale)
+		SHADER_PARAMETER(FVector, flowUVWOffset)
+		SHADER_PARAMETER(float, flowUrge)
+
+		SHADER_PARAMETER_TEXTURE(Texture3D, flowTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, flowSampler)
+
+		SHADER_PARAMETER(uint32, useNavField)
+		SHADER_PARAMETER(FVector, navUVWScale)
+		SHADER_PARAMETER(FVector, navUVWOffset)
+		SHADER_PARAMETER(float, navUrge)
+
+		SHADER_PARAMETER_TEXTURE(Texture3D, navTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, navSampler)
+		
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	// Must match RULES_USE_NEIGHBOURS in Boid.usf, without the neighbour rules the kernel doesn't read a spatial index
+	static bool usesNeighbours(uint32 ruleMask, bool useSpecies)
+	{
+		return (ruleMask & (EBoidRule::Separation | EBoidRule::Alignment | EBoidRule::Cohesion)) != 0 || useSpecies;
+	}
+
+	// The shader compilers that provide the wave votes (COMPILER_SUPPORTS_WAVE_VOTE), elsewhere the wave permutation
+	// compiles to the same code as the plain one
+	static bool supportsWaveVotes(EShaderPlatform platform)
+	{
+		return IsFeatureLevelSupported(platform, ERHIFeatureLevel::SM5) && (IsD3DPlatform(platform, true) || IsConsolePlatform(platform));
+	}
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		FPermutationDomain PermutationVector(Parameters.PermutationId);
+
+		if (PermutationVector.Get<FWaveOccupancyDim>() && !supportsWaveVotes(Parameters.Platform))
+			return false;
+
+		// the wave votes are over grid cells, the LBVH doesn't use them
+		if (PermutationVector.Get<FWaveOccupancyDim>() && PermutationVector.Get<FSpatialIndexDim>())
+			return false;
+
+		// the wave votes and the spatial index only change the neighbour search
+		const bool neighbours = usesNeighbours(PermutationVector.Get<FRulesDim>(), PermutationVector.Get<FSpeciesDim>());
+
+		if (!neighbours && (PermutationVector.Get<FWaveOccupancyDim>() || PermutationVector.Get<FSpatialIndexDim>()))
+			return false;
+
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+
+		FPermutationDomain PermutationVector(Parameters.PermutationId);
+
+		if (PermutationVector.Get<FWaveOccupancyDim>())
+			OutEnvironment.CompilerFlags.Add(CFLAG_WaveOperations);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FBoidsComputeShader, "/ComputeShaderPlugin/Boid.usf", "GridNeighboursBoidUpdate", SF_Compute);
+
+
+class FBoids_integratePosition_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FBoids_integratePosition_CS);
+	SHADER_USE_PARAMETER_STRUCT(FBoids_integratePosition_CS, FGlobalShader);
+
+	class FIntegratorDim : SHADER_PERMUTATION_INT("INTEGRATOR", 3);
+
+	// Keep the boids in the xy plane, optionally on a heightfield
+	class FPlanarDim : SHADER_PERMUTATION_BOOL("PLANAR_2D");
+
+	using FPermutationDomain = TShaderPermutationDomain<FIntegratorDim, FPlanarDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(float, dt)
+		SHADER_PARAMETER(float, totalTime)
+		SHADER_PARAMETER(float, boidSpeed)
+		SHADER_PARAMETER(float, boidSpeedVariation)
+		SHADER_PARAMETER(float, boidRotationSpeed)
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(FVector4, speciesSpeedScale)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, newDirections)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, previousPositions)
+
+		SHADER_PARAMETER(uint32, useSuperBoids)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidLeaders)
+
+		SHADER_PARAMETER(uint32, numImpulseEvents)
+		SHADER_PARAMETER(float, impulseCellSizeReciprocal)
+		SHADER_PARAMETER(uint32, impulseBucketCount)
+		SHADER_PARAMETER(uint32, impulseEventsOffset)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, impulseData)
+
+		SHADER_PARAMETER(uint32, useHeightfield)
+		SHADER_PARAMETER(FVector2D, heightfieldUVScale)
+		SHADER_PARAMETER(FVector2D, heightfieldUVOffset)
+		SHADER_PARAMETER(float, heightfieldScale)
+		SHADER_PARAMETER(float, heightOffset)
+		SHADER_PARAMETER_TEXTURE(Texture2D, heightfieldTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, heightfieldSampler)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FBoids_integratePosition_CS, "/ComputeShaderPlugin/Boid.usf", "IntegrateBoidPosition", SF_Compute);
+
+
+
+
+
+
+class FBoids_applyImpulses_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FBoids_applyImpulses_CS);
+	SHADER_USE_PARAMETER_STRUCT(FBoids_applyImpulses_CS, FGlobalShader);
+
+	class FPlanarDim : SHADER_PERMUTATION_BOOL("PLANAR_2D");
+
+	using FPermutationDomain = TShaderPermutationDomain<FPlanarDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(float, dt)
+		SHADER_PARAMETER(float, boidSpeed)
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(FVector4, speciesSpeedScale)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, newDirections)
+
+		SHADER_PARAMETER(uint32, numImpulseEvents)
+		SHADER_PARAMETER(float, impulseCellSizeReciprocal)
+		SHADER_PARAMETER(uint32, impulseBucketCount)
+		SHADER_PARAMETER(uint32, impulseEventsOffset)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, impulseData)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FBoids_applyImpulses_CS, "/ComputeShaderPlugin/Boid.usf", "applyImpulses", SF_Compute);
+
+class FBoids_rearrangePositions_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FBoids_rearrangePositions_CS);
+	SHADER_USE_PARAMETER_STRUCT(FBoids_rearrangePositions_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions_other)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions_other)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, newDirections)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, newDirections_other)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, previousPositions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, previousPositions_other)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float3>, particleIndexBuffer)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FBoids_rearrangePositions_CS, "/ComputeShaderPlugin/Boid.usf", "rearrangePositions", SF_Compute);
+
+
+
+
+class FSimulationLOD_reset_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSimulationLOD_reset_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSimulationLOD_reset_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, simulationLODCounters)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSimulationLOD_reset_CS, "/ComputeShaderPlugin/SimulationLOD.usf", "resetSimulationLOD", SF_Compute);
+
+
+class FSimulationLOD_assign_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSimulationLOD_assign_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSimulationLOD_assign_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(uint32, frameIndex)
+		SHADER_PARAMETER(uint32, sliceOffset)
+		SHADER_PARAMETER(uint32, sliceSize)
+
+		SHADER_PARAMETER(FVector, viewLocation)
+		SHADER_PARAMETER(FVector, viewForward)
+		SHADER_PARAMETER(float, viewCosHalfAngle)
+		SHADER_PARAMETER(uint32, cullOffscreen)
+
+		SHADER_PARAMETER(float, lodNearDistance)
+		SHADER_PARAMETER(float, lodMidDistance)
+		SHADER_PARAMETER(float, lodFarDistance)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+
+		SHADER_PARAMETER(uint32, useSuperBoids)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidLeaders)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, activeBoidIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, simulationLODCounters)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSimulationLOD_assign_CS, "/ComputeShaderPlugin/SimulationLOD.usf", "assignSimulationLOD", SF_Compute);
+
+
+class FSimulationLOD_buildArgs_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSimulationLOD_buildArgs_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSimulationLOD_buildArgs_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, simulationLODCounters)
+		SHADER_PARAMETER_UAV(RWBuffer<uint>, simulationLODArgs)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSimulationLOD_buildArgs_CS, "/ComputeShaderPlugin/SimulationLOD.usf", "buildSimulationLODArgs", SF_Compute);
+
+
+class FSuperBoids_reset_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSuperBoids_reset_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSuperBoids_reset_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidCounts)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidSpreads)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidCellLeaders)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSuperBoids_reset_CS, "/ComputeShaderPlugin/SuperBoids.usf", "resetSuperBoids", SF_Compute);
+
+
+class FSuperBoids_vote_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSuperBoids_vote_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSuperBoids_vote_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, superBoidDistance)
+		SHADER_PARAMETER(FVector, viewLocation)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidCellLeaders)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSuperBoids_vote_CS, "/ComputeShaderPlugin/SuperBoids.usf", "voteSuperBoidLeaders", SF_Compute);
+
+
+class FSuperBoids_elect_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSuperBoids_elect_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSuperBoids_elect_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, superBoidDistance)
+		SHADER_PARAMETER(FVector, viewLocation)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidCellLeaders)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSuperBoids_elect_CS, "/ComputeShaderPlugin/SuperBoids.usf", "electSuperBoidLeaders", SF_Compute);
+
+
+class FSuperBoids_assign_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSuperBoids_assign_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSuperBoids_assign_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, superBoidDistance)
+		SHADER_PARAMETER(float, superBoidMaxSpread)
+		SHADER_PARAMETER(uint32, superBoidPlanar)
+		SHADER_PARAMETER(FVector, viewLocation)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidLeaders)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidCounts)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidSpreads)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidCellLeaders)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSuperBoids_assign_CS, "/ComputeShaderPlugin/SuperBoids.usf", "assignSuperBoids", SF_Compute);
+
+
+class FSuperBoids_place_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSuperBoids_place_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSuperBoids_place_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, superBoidMaxSpread)
+		SHADER_PARAMETER(uint32, superBoidPlanar)
+		SHADER_PARAMETER(float, superBoidBlend)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, previousPositions)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidLeaders)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidCounts)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, superBoidSpreads)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSuperBoids_place_CS, "/ComputeShaderPlugin/SuperBoids.usf", "placeSuperBoidFollowers", SF_Compute);
+
+class FBoids_copyPositions_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FBoids_copyPositions_CS);
+	SHADER_USE_PARAMETER_STRUCT(FBoids_copyPositions_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, particleScale)
+		SHADER_PARAMETER(float, interpolationAlpha)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, previousPositions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions_other)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, transforms_other)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FBoids_copyPositions_CS, "/ComputeShaderPlugin/CopyPositions.usf", "copyPositions", SF_Compute);
+
+
+static FIntVector groupSize(int numElements)
+{
+	const int threadCount = 256;
+
+	int count = ((numElements - 1) / threadCount) + 1;
+
+	return FIntVector(count, 1, 1);
+}
+
+void FBoidSimulationProxy::init(FBoidSimulationProxyInit& init)
+{
+	check(IsInRenderingThread());
+
+	_numBoids = init.numBoids;
+	_planar2D = init.planar2D;
+	_scene = init.scene;
+	_current = 0;
+
+	const int32 numBoids = _numBoids;
+
+	// positions
+	{
+		TResourceArray<FVector4>& resourceArray = init.positions;
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &resourceArray;
+
+		const size_t size = sizeof(FVector4);
+
+		// the state before the last step, for interpolated rendering
+		TResourceArray<FVector4> previousArray = resourceArray;
+
+		for( int i = 0; i < 2; ++i )
+		{
+			_positionBuffer[i] = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+			_positionBufferUAV[i] = RHICreateUnorderedAccessView(_positionBuffer[i], false, false);
+            
+            // On platforms, like iOS, the resource array is discarded during RHICreateStructuredBuffer. Kill it. We only need one
+            // for the first positionBuffer[0].
+            createInfo.ResourceArray = nullptr; 
+		}
+
+		createInfo.ResourceArray = &previousArray;
+
+		for (int i = 0; i < 2; ++i)
+		{
+			_previousPositionBuffer[i] = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+			_previousPositionBufferUAV[i] = RHICreateUnorderedAccessView(_previousPositionBuffer[i], false, false);
+
+			createInfo.ResourceArray = nullptr;
+		}
+	}
+    
+	// directions
+	{
+		TResourceArray<FVector4>& resourceArray = init.directions;
+
+		// the initial steering is the initial heading
+		TResourceArray<FVector4> steeringArray = resourceArray;
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &resourceArray;
+
+		const size_t size = sizeof(FVector4);
+
+		for( int i = 0; i < 2; ++i )
+		{
+			_directionsBuffer[i] = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+			_directionsBufferUAV[i] = RHICreateUnorderedAccessView(_directionsBuffer[i], false, false);
+            
+            // only platforms, like iOS, the resource array is discarded during RHICreateStructuredBuffer. Kill it. We only need one.
+            createInfo.ResourceArray = nullptr;
+		}
+
+		createInfo.ResourceArray = &steeringArray;
+
+		for (int i = 0; i < 2; ++i)
+		{
+			_newDirectionsBuffer[i] = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+			_newDirectionsBufferUAV[i] = RHICreateUnorderedAccessView(_newDirectionsBuffer[i], false, false);
+
+			createInfo.ResourceArray = nullptr;
+		}
+	}
+
+	// hashed grid
+	_grid.init(numBoids, init.gridDimensions);
+
+	if (init.useLBVH)
+		_lbvh.init(numBoids);
+
+	// influencers
+	{
+		const size_t size = sizeof(FVector4);
+		const int32 count = FMath::Max(init.maxInfluencers, 1);
+
+		TResourceArray<FVector4> resourceArray;
+		resourceArray.Init(FVector4(0.0f, 0.0f, 0.0f, 0.0f), count);
+
+		TResourceArray<FVector4> shapeArray = resourceArray;
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &resourceArray;
+
+		_influencerPositionBuffer = RHICreateStructuredBuffer(size, size * count, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_influencerPositionBufferUAV = RHICreateUnorderedAccessView(_influencerPositionBuffer, false, false);
+
+		createInfo.ResourceArray = &shapeArray;
+
+		_influencerShapeBuffer = RHICreateStructuredBuffer(size, size * count, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_influencerShapeBufferUAV = RHICreateUnorderedAccessView(_influencerShapeBuffer, false, false);
+
+		_influencerGrid.init(count, init.influencerGridDimensions);
+	}
+
+	// obstacle avoidance volume, a far away placeholder when nothing has been baked
+	{
+		const FIntVector& resolution = init.sdfResolution;
+
+		const bool baked = resolution.X > 0 && resolution.Y > 0 && resolution.Z > 0
+			&& init.sdfDistances.Num() == resolution.X * resolution.Y * resolution.Z;
+
+		if (baked)
+		{
+			_sdfTexture = FBoidSDFBaker::createTexture(init.sdfDistances, resolution, init.sdfBounds);
+		}
+		else
+		{
+			TArray<float> placeholder;
+			placeholder.Init(65000.0f, 1);
+
+			_sdfTexture = FBoidSDFBaker::createTexture(placeholder, FIntVector(1, 1, 1), FBox(FVector(0.0f), FVector(1.0f)));
+		}
+
+		_hasSDF = baked;
+		_sdfResolution = resolution;
+		_sdfBounds = init.sdfBounds;
+	}
+
+	// impulses and force fields
+	{
+		_impulseQueue.init(init.impulseCapacity);
+
+		const size_t size = sizeof(uint32);
+		const uint32 numWords = FBoidImpulseQueue::maxWords(_impulseQueue.capacity(), FMath::Max(init.impulseBucketCount, 1));
+
+		TResourceArray<uint32> resourceArray;
+		resourceArray.Init(0, numWords);
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &resourceArray;
+
+		_impulseDataBuffer = RHICreateStructuredBuffer(size, size * numWords, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_impulseDataBufferUAV = RHICreateUnorderedAccessView(_impulseDataBuffer, false, false);
+	}
+
+	// navigation field, on the SDF's grid so that the SDF can block voxels
+	if (init.useNavField)
+	{
+		_navField.init(init.navResolution, init.navBounds);
+
+		_navGoalCell = FIntVector(-1, -1, -1);
+		_navIterations = 0;
+		_navPublished = false;
+		_navWarmStart = false;
+	}
+
+	// simulation LOD
+	{
+		const size_t size = sizeof(uint32_t);
+
+		TResourceArray<uint32_t> resourceArray;
+		resourceArray.Init(0, numBoids);
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &resourceArray;
+
+		_activeBoidIndexBuffer = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_activeBoidIndexBufferUAV = RHICreateUnorderedAccessView(_activeBoidIndexBuffer, false, false);
+
+		TResourceArray<uint32_t> counterArray;
+		counterArray.Init(0, 1);
+
+		createInfo.ResourceArray = &counterArray;
+
+		_simulationLODCounterBuffer = RHICreateStructuredBuffer(size, size, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_simulationLODCounterBufferUAV = RHICreateUnorderedAccessView(_simulationLODCounterBuffer, false, false);
+
+		TResourceArray<uint32_t> argsArray;
+		argsArray.Init(1, 3);
+
+		createInfo.ResourceArray = &argsArray;
+
+		_simulationLODArgsBuffer = RHICreateVertexBuffer(size * 3, BUF_Static | BUF_DrawIndirect | BUF_UnorderedAccess, createInfo);
+		_simulationLODArgsBufferUAV = RHICreateUnorderedAccessView(_simulationLODArgsBuffer, PF_R32_UINT);
+	}
+
+	// super-boids, every boid leads itself until the first assignment
+	{
+		const size_t size = sizeof(uint32_t);
+
+		TResourceArray<uint32_t> resourceArray;
+		resourceArray.SetNumUninitialized(numBoids);
+
+		for (int32 i = 0; i < numBoids; ++i)
+			resourceArray[i] = i;
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &resourceArray;
+
+		_superBoidLeaderBuffer = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_superBoidLeaderBufferUAV = RHICreateUnorderedAccessView(_superBoidLeaderBuffer, false, false);
+
+		// a resource array is discarded by the buffer it creates, each buffer gets its own
+		TResourceArray<uint32_t> countArray;
+		countArray.Init(0, numBoids);
+
+		TResourceArray<uint32_t> spreadArray = countArray;
+
+		TResourceArray<uint32_t> cellLeaderArray;
+		cellLeaderArray.Init(0xFFFFFFFF, numBoids);
+
+		createInfo.ResourceArray = &countArray;
+
+		_superBoidCountBuffer = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_superBoidCountBufferUAV = RHICreateUnorderedAccessView(_superBoidCountBuffer, false, false);
+
+		createInfo.ResourceArray = &spreadArray;
+
+		_superBoidSpreadBuffer = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_superBoidSpreadBufferUAV = RHICreateUnorderedAccessView(_superBoidSpreadBuffer, false, false);
+
+		createInfo.ResourceArray = &cellLeaderArray;
+
+		_superBoidCellLeaderBuffer = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		_superBoidCellLeaderBufferUAV = RHICreateUnorderedAccessView(_superBoidCellLeaderBuffer, false, false);
+	}
+
+	// the spawned boids are the first frame
+	_publish(~0u);
+}
+
+const FBoidSimulationFrame& FBoidSimulationProxy::currentFrame() const
+{
+	check(IsInRenderingThread());
+
+	return _frame;
+}
+
+void FBoidSimulationProxy::_publish(uint32 frameIndex)
+{
+	_frame.positions = _positionBufferUAV[_current];
+	_frame.directions = _directionsBufferUAV[_current];
+	_frame.previousPositions = _previousPositionBufferUAV[_current];
+	_frame.numBoids = _numBoids;
+	_frame.frameIndex = frameIndex;
+}
+
+void FBoidSimulationProxy::validateNavField(const TArray<uint8>& blocked)
+{
+	check(IsInRenderingThread());
+
+	if (!_navField.isInitialized())
+		return;
+
+	const FIntVector& n = _navField.resolution;
+	const int32 numVoxels = n.X * n.Y * n.Z;
+
+	TArray<float> gpuField;
+	gpuField.SetNumUninitialized(numVoxels);
+
+	FStructuredBufferRHIRef buffer = _navField.currentFieldBuffer();
+
+	float * data = (float*)RHILockStructuredBuffer(buffer, 0, numVoxels * sizeof(float), RLM_ReadOnly);
+	FMemory::Memcpy(gpuField.GetData(), data, numVoxels * sizeof(float));
+	RHIUnlockStructuredBuffer(buffer);
+
+	TArray<float> reference;
+	FBoidNavField::solveReference(blocked, n, _navField.cellSize, _navGoalCell, reference);
+
+	const float difference = FBoidNavField::maxDifference(gpuField, reference);
+
+	UE_LOG(LogTemp, Log, TEXT("FBoidSimulationProxy: nav field max difference to the CPU reference %f after %d iterations."), difference, _navIterations);
+}
+
+bool FBoidSimulationSettings::operator==(const FBoidSimulationSettings& other) const
+{
+	for (int32 i = 0; i < FBoidSimulationProxy::maxSpecies * FBoidSimulationProxy::maxSpecies; ++i)
+	{
+		if (speciesInteractions[i] != other.speciesInteractions[i])
+			return false;
+	}
+
+	// the flow field is compared by copy, the component only makes a new copy when the asset changes
+	return useFixedTimestep == other.useFixedTimestep
+		&& deterministic == other.deterministic
+		&& simulationRate == other.simulationRate
+		&& maxSubsteps == other.maxSubsteps
+		&& neighbourDistance == other.neighbourDistance
+		&& separationDistance == other.separationDistance
+		&& homeInnerRadius == other.homeInnerRadius
+		&& boidSpeed == other.boidSpeed
+		&& boidSpeedVariation == other.boidSpeedVariation
+		&& boidRotationSpeed == other.boidRotationSpeed
+		&& integrator == other.integrator
+		&& homeUrge == other.homeUrge
+		&& separationUrge == other.separationUrge
+		&& cohesionUrge == other.cohesionUrge
+		&& alignmentUrge == other.alignmentUrge
+		&& ruleMask == other.ruleMask
+		&& numSpecies == other.numSpecies
+		&& speciesSpeedScale == other.speciesSpeedScale
+		&& gridCellSize == other.gridCellSize
+		&& gridSortKeyValues == other.gridSortKeyValues
+		&& gridRadixSort == other.gridRadixSort
+		&& rearrangeBoids == other.rearrangeBoids
+		&& useLBVH == other.useLBVH
+		&& lbvhBounds == other.lbvhBounds
+		&& timeSliceCount == other.timeSliceCount
+		&& useSimulationLOD == other.useSimulationLOD
+		&& lodNearDistance == other.lodNearDistance
+		&& lodMidDistance == other.lodMidDistance
+		&& lodFarDistance == other.lodFarDistance
+		&& lodCullOffscreen == other.lodCullOffscreen
+		&& lodOffscreenMargin == other.lodOffscreenMargin
+		&& useSuperBoids == other.useSuperBoids
+		&& superBoidDistance == other.superBoidDistance
+		&& superBoidBlendTime == other.superBoidBlendTime
+		&& influencerCellSize == other.influencerCellSize
+		&& sdfAvoidanceDistance == other.sdfAvoidanceDistance
+		&& sdfAvoidanceUrge == other.sdfAvoidanceUrge
+		&& flowField == other.flowField
+		&& flowUrge == other.flowUrge
+		&& useNavField == other.useNavField
+		&& navUrge == other.navUrge
+		&& navAgentRadius == other.navAgentRadius
+		&& navIterationsPerStep == other.navIterationsPerStep
+		&& navIterationsPerGoal == other.navIterationsPerGoal
+		&& impulseCellSize == other.impulseCellSize
+		&& impulseBucketCount == other.impulseBucketCount
+		&& heightfield == other.heightfield
+		&& heightfieldOrigin == other.heightfieldOrigin
+		&& heightfieldSize == other.heightfieldSize
+		&& heightfieldScale == other.heightfieldScale
+		&& heightOffset == other.heightOffset;
+}
+
+void FBoidSimulationProxy::push(const FBoidSimulationSettings& settings, FBoidSimulationInputs& inputs)
+{
+	check(IsInRenderingThread());
+
+	_settings = settings;
+
+	for (const FBoidImpulseQueue::FEvent& event : inputs.events)
+	{
+		if (event.isImpulse)
+			_impulseQueue.addImpulse(event.centre, event.radius, event.strength);
+		else
+			_impulseQueue.addForceField(event.centre, event.radius, event.strength, event.timeRemaining);
+	}
+
+	inputs.events.Empty();
+
+	// the influencer grid is only rebuilt when the influencers change, a change stays pending until a step uploads it
+	_influencersChanged |= !_hasInputs
+		|| inputs.numInfluencers != _inputs.numInfluencers
+		|| inputs.influencerPositions != _inputs.influencerPositions
+		|| inputs.influencerShapes != _inputs.influencerShapes;
+
+	_inputs = MoveTemp(inputs);
+	_hasInputs = true;
+}
+
+void FBoidSimulationProxy::setInstanceTarget(TSharedPtr<FIBMPerInstanceRenderData, ESPMode::ThreadSafe> renderData, float particleScale)
+{
+	check(IsInRenderingThread());
+
+	_instanceRenderData = renderData;
+	_instanceScale = particleScale;
+
+	_instanceOriginBuffer.SafeRelease();
+	_instanceOriginUAV.SafeRelease();
+	_instanceTransformBuffer.SafeRelease();
+	_instanceTransformUAV.SafeRelease();
+}
+
+void FBoidSimulationProxy::update(FRHICommandListImmediate& RHICommands, const FSceneViewFamily& viewFamily)
+{
+	check(IsInRenderingThread());
+
+	if (!isInitialized() || !_hasInputs || viewFamily.Scene != _scene || viewFamily.Views.Num() == 0)
+		return;
+
+	const FSceneView * view = viewFamily.Views[0];
+
+	// scene captures render our scene too, they don't drive the simulation
+	if (view->bIsSceneCapture || view->bIsReflectionCapture)
+		return;
+
+	if (viewFamily.FrameNumber == _lastFrameNumber)
+		return;
+
+	_lastFrameNumber = viewFamily.FrameNumber;
+	_updatedThisFrame = true;
+
+	// the frames without a view keep the world's pause state as the last view saw it
+	_worldPaused = viewFamily.DeltaWorldTime <= 0.0f;
+
+	_advance(RHICommands, viewFamily.DeltaWorldTime, viewFamily.CurrentWorldTime, view);
+}
+
+void FBoidSimulationProxy::endFrame(FRHICommandListImmediate& RHICommands)
+{
+	check(IsInRenderingThread());
+
+	const double now = FPlatformTime::Seconds();
+	const double lastEndFrame = _lastEndFrameSeconds;
+
+	_lastEndFrameSeconds = now;
+
+	const bool updated = _updatedThisFrame;
+	_updatedThisFrame = false;
+
+	if (updated || !isInitialized() || !_hasInputs || lastEndFrame == 0.0)
+		return;
+
+	// no view of our scene rendered this frame, step with the real frame time so the swarm doesn't freeze and jump
+	// when a view comes back. A long gap (a hitch, a minimised window) is clamped like the fixed step's backlog.
+	const float deltaTime = _worldPaused ? 0.0f : FMath::Min(float(now - lastEndFrame), maxUnrenderedDeltaTime);
+
+	_advance(RHICommands, deltaTime, _worldTime + deltaTime, nullptr);
+}
+
+void FBoidSimulationProxy::_advance(FRHICommandListImmediate& RHICommands, float deltaTime, float worldTime, const FSceneView * view)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FBoidSimulationProxy_Update);
+
+	const FBoidSimulationSettings& settings = _settings;
+
+	_worldTime = worldTime;
+
+	// work out how many simulation steps to take this frame, nothing moves while the world is paused
+	int numSteps = deltaTime > 0.0f ? 1 : 0;
+	float dt = FMath::Min(1.0f / 60.0f, deltaTime);
+	float totalTime = worldTime;
+
+	if (settings.deterministic)
+	{
+		// one step per frame, independent of the frame time
+		dt = 1.0f / FMath::Max(settings.simulationRate, 1.0f);
+
+		_interpolationAlpha = 1.0f;
+
+		totalTime = _simulationTime;
+	}
+	else if (settings.useFixedTimestep && settings.simulationRate > 0.0f)
+	{
+		dt = 1.0f / settings.simulationRate;
+
+		_timeAccumulator += deltaTime;
+
+		numSteps = FMath::Min(FMath::FloorToInt(_timeAccumulator / dt), FMath::Max(settings.maxSubsteps, 1));
+
+		_timeAccumulator -= numSteps * dt;
+
+		// if we can't keep up, drop the backlog rather than spiral
+		_timeAccumulator = FMath::Min(_timeAccumulator, dt);
+
+		// the fraction of a step between the previous and current states, for rendering
+		_interpolationAlpha = FMath::Clamp(_timeAccumulator / dt, 0.0f, 1.0f);
+
+		totalTime = _simulationTime;
+	}
+	else
+	{
+		_interpolationAlpha = 1.0f;
+	}
+
+	if (numSteps > 0)
+	{
+		const FTransform& simulationTransform = _inputs.simulationTransform;
+
+		FBoidSimulationStep simulationStep;
+		simulationStep.dt = dt;
+		simulationStep.totalTime = totalTime;
+
+		// the view for the simulation LOD, in the space of the simulation. Without a view we keep the last one.
+		if (view && (settings.useSimulationLOD || settings.useSuperBoids))
+		{
+			_viewLocation = simulationTransform.InverseTransformPosition(view->ViewMatrices.GetViewOrigin());
+			_viewForward = simulationTransform.InverseTransformVectorNoScale(view->GetViewDirection());
+			_viewCosHalfAngle = -1.0f;
+
+			// the horizontal field of view, like the camera's FOV angle
+			if (view->ViewMatrices.IsPerspectiveProjection())
+			{
+				const float halfFOV = FMath::RadiansToDegrees(FMath::Atan(1.0f / view->ViewMatrices.GetProjectionMatrix().M[0][0]));
+
+				const float halfAngle = FMath::Min(halfFOV + settings.lodOffscreenMargin, 180.0f);
+				_viewCosHalfAngle = FMath::Cos(FMath::DegreesToRadians(halfAngle));
+			}
+		}
+
+		simulationStep.viewLocation = _viewLocation;
+		simulationStep.viewForward = _viewForward;
+		simulationStep.viewCosHalfAngle = _viewCosHalfAngle;
+
+		simulationStep.navGoal = _inputs.navGoal;
+
+		// the influencers are only uploaded when they change
+		simulationStep.numInfluencers = _inputs.numInfluencers;
+
+		if (_influencersChanged)
+		{
+			simulationStep.influencerPositions = _inputs.influencerPositions;
+			simulationStep.influencerShapes = _inputs.influencerShapes;
+
+			_influencersChanged = false;
+		}
+
+		// pack the impulses and force fields, impulses are only applied by the first step
+		simulationStep.numImpulseEvents = _impulseQueue.pack(dt * numSteps, settings.impulseCellSize, FMath::Max(settings.impulseBucketCount, 1), simulationStep.impulseData, simulationStep.impulseEventsOffset);
+		simulationStep.applyImpulses = true;
+
+		for (int i = 0; i < numSteps; ++i)
+		{
+			simulationStep.frameIndex = _simulationFrame++;
+
+			step(RHICommands, settings, simulationStep);
+
+			simulationStep.influencerPositions.Empty();
+			simulationStep.influencerShapes.Empty();
+
+			simulationStep.impulseData.Empty();
+			simulationStep.applyImpulses = false;
+
+			simulationStep.totalTime += dt;
+			_simulationTime += dt;
+		}
+	}
+
+	// every frame, the interpolation moves on even when we don't step
+	_copyInstances(RHICommands);
+}
+
+void FBoidSimulationProxy::_copyInstances(FRHICommandListImmediate& RHICommands)
+{
+	if (!_instanceRenderData.IsValid() || !_frame.positions)
+		return;
+
+	FIBMInstanceBuffer& instanceBuffer = _instanceRenderData->InstanceBuffer;
+
+	// the instance buffer mesh reallocates its buffers when its render state is recreated
+	if (instanceBuffer.GetNumInstances() != uint32(_numBoids))
+		return;
+
+	const uint8 format = PF_A32B32G32R32F;
+
+	if (_instanceOriginBuffer != instanceBuffer.InstanceOriginBuffer.VertexBufferRHI)
+	{
+		_instanceOriginBuffer = instanceBuffer.InstanceOriginBuffer.VertexBufferRHI;
+		_instanceOriginUAV = RHICreateUnorderedAccessView(_instanceOriginBuffer, format);
+	}
+
+	if (_instanceTransformBuffer != instanceBuffer.InstanceTransformBuffer.VertexBufferRHI)
+	{
+		_instanceTransformBuffer = instanceBuffer.InstanceTransformBuffer.VertexBufferRHI;
+		_instanceTransformUAV = RHICreateUnorderedAccessView(_instanceTransformBuffer, format);
+	}
+
+	if (!_instanceOriginBuffer || !_instanceTransformBuffer)
+		return;
+
+	FBoids_copyPositions_CS::FParameters parameters;
+	parameters.positions = _frame.positions;
+	parameters.previousPositions = _frame.previousPositions;
+	parameters.interpolationAlpha = _interpolationAlpha;
+	parameters.positions_other = _instanceOriginUAV;
+	parameters.directions = _frame.directions;
+	parameters.transforms_other = _instanceTransformUAV;
+	parameters.numParticles = _numBoids;
+	parameters.particleScale = _instanceScale;
+
+	TShaderMapRef<FBoids_copyPositions_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+	FComputeShaderUtils::Dispatch(
+		RHICommands,
+		*computeShader,
+		parameters,
+		groupSize(_numBoids)
+	);
+}
+
+void FBoidSimulationProxy::step(FRHICommandListImmediate& RHICommands, const FBoidSimulationSettings& settings, const FBoidSimulationStep& step)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FBoidSimulationProxy_Step);
+
+	const float dt = step.dt;
+	const float totalTime = step.totalTime;
+	const uint32 frameIndex = step.frameIndex;
+
+	// time slicing, update a rotating 1/N slice of the boids' steering every frame
+	const uint32 numSlices = FMath::Clamp(settings.timeSliceCount, 1, FMath::Max(_numBoids, 1));
+	const uint32 sliceSize = (_numBoids + numSlices - 1) / numSlices;
+	const uint32 sliceOffset = (frameIndex % numSlices) * sliceSize;
+	const uint32 sliceCount = FMath::Min(sliceSize, uint32(_numBoids) - FMath::Min(sliceOffset, uint32(_numBoids)));
+
+	const uint32_t cellOffsetBufferSize = _grid.cellOffsetBufferSize();
+
+	const int32 numSpecies = settings.numSpecies;
+
+	auto& positionsBufferUAV = _positionBufferUAV[_current];
+	auto& directionsBufferUAV = _directionsBufferUAV[_current];
+	auto& newDirectionsBufferUAV = _newDirectionsBufferUAV[_current];
+
+	// build the spatial index
+	const bool useLBVH = settings.useLBVH && _lbvh.isInitialized();
+
+	if (useLBVH)
+	{
+		_lbvh.bounds = settings.lbvhBounds;
+		_lbvh.build(_numBoids, positionsBufferUAV, RHICommands);
+	}
+	else
+	{
+		_grid.sortKeyValues = settings.gridSortKeyValues;
+		_grid.radixSort = settings.gridRadixSort;
+		_grid.build(_numBoids, settings.gridCellSize, positionsBufferUAV, RHICommands);
+	}
+
+	FGPUSpatialIndex& neighbourIndex = useLBVH ? static_cast<FGPUSpatialIndex&>(_lbvh) : static_cast<FGPUSpatialIndex&>(_grid);
+
+	// a new flow field is filled again, the texture is only recreated when the resolution changed
+	if (settings.flowField != _flowField)
+	{
+		if (!settings.flowField)
+		{
+			_flowFieldTexture.SafeRelease();
+			_flowFieldTextureUAV.SafeRelease();
+		}
+		else if (!_flowFieldTexture.IsValid() || _flowFieldTexture->GetSizeXYZ() != settings.flowField->resolution)
+			settings.flowField->createTexture(_flowFieldTexture, _flowFieldTextureUAV);
+
+		_flowField = settings.flowField;
+		_flowFieldFilled = false;
+	}
+
+	// generate the flow field, once or every step when it is animated
+	if (settings.flowField && _flowFieldTexture.IsValid() && (!_flowFieldFilled || settings.flowField->isAnimated()))
+	{
+		settings.flowField->fill(step.totalTime, _flowFieldTexture, _flowFieldTextureUAV, RHICommands);
+
+		_flowFieldFilled = true;
+	}
+
+	// solve the navigation field a few iterations at a time. A goal that moves to another voxel warm starts the solve
+	// from the current field, only the first goal and goals entering or leaving the grid reseed it.
+	if (settings.useNavField && _navField.isInitialized())
+	{
+		const FIntVector goalCell = _navField.cellOf(step.navGoal);
+
+		if (goalCell != _navGoalCell)
+		{
+			_navWarmStart = _navField.contains(_navGoalCell) && _navField.contains(goalCell);
+
+			if (_navWarmStart)
+				_navField.moveGoal(goalCell);
+			else
+				_navField.reset(goalCell, _hasSDF ? _sdfTexture : FTexture3DRHIRef(), settings.navAgentRadius, RHICommands);
+
+			_navGoalCell = goalCell;
+			_navIterations = 0;
+		}
+
+		const FIntVector& n = _navField.resolution;
+		const int32 iterationsPerGoal = settings.navIterationsPerGoal > 0 ? settings.navIterationsPerGoal : 2 * (n.X + n.Y + n.Z);
+
+		if (_navIterations < iterationsPerGoal)
+		{
+			const int32 iterations = FMath::Min(FMath::Max(settings.navIterationsPerStep, 1), iterationsPerGoal - _navIterations);
+
+			_navField.relax(iterations, RHICommands);
+			_navIterations += iterations;
+
+			// once a field has converged, a warm started one is close to the new goal's from its first iteration, so
+			// publish it as it converges rather than hold on to the old goal
+			if (_navIterations >= iterationsPerGoal || (_navWarmStart && _navPublished))
+			{
+				_navField.publish(RHICommands);
+				_navPublished = true;
+			}
+		}
+	}
+
+	// upload the impulses and force fields, in one copy
+	if (step.impulseData.Num() > 0)
+	{
+		const uint32 size = step.impulseData.Num() * sizeof(uint32);
+
+		void * data = RHILockStructuredBuffer(_impulseDataBuffer, 0, size, RLM_WriteOnly);
+		FMemory::Memcpy(data, step.impulseData.GetData(), size);
+		RHIUnlockStructuredBuffer(_impulseDataBuffer);
+	}
+
+	// upload and index the influencers
+	if (step.influencerPositions.Num() > 0)
+	{
+		const uint32 size = step.influencerPositions.Num() * sizeof(FVector4);
+
+		void * positionData = RHILockStructuredBuffer(_influencerPositionBuffer, 0, size, RLM_WriteOnly);
+		FMemory::Memcpy(positionData, step.influencerPositions.GetData(), size);
+		RHIUnlockStructuredBuffer(_influencerPositionBuffer);
+
+		void * shapeData = RHILockStructuredBuffer(_influencerShapeBuffer, 0, size, RLM_WriteOnly);
+		FMemory::Memcpy(shapeData, step.influencerShapes.GetData(), size);
+		RHIUnlockStructuredBuffer(_influencerShapeBuffer);
+
+		_influencerGrid.build(step.numInfluencers, settings.influencerCellSize, _influencerPositionBufferUAV, RHICommands);
+	}
+
+	if (false)
+	{
+		TArray<uint32> cellIndexBuffer;
+		cellIndexBuffer.Init(0, _numBoids);
+
+		TArray<uint32> particleIndexBuffer;
+		particleIndexBuffer.Init(0, _numBoids);
+
+		TArray<uint32> cellOffsetBuffer;
+		cellOffsetBuffer.Init(0, cellOffsetBufferSize);
+
+		uint8* cellIndexData = (uint8*)RHILockStructuredBuffer(_grid.cellIndexBuffer, 0, _numBoids * sizeof(uint32_t), RLM_ReadOnly);
+		FMemory::Memcpy(cellIndexBuffer.GetData(), cellIndexData, _numBoids * sizeof(uint32_t));
+		RHIUnlockStructuredBuffer(_grid.cellIndexBuffer);
+
+		uint8* particleIndexData = (uint8*)RHILockStructuredBuffer(_grid.particleIndexBuffer, 0, _numBoids * sizeof(uint32_t), RLM_ReadOnly);
+		FMemory::Memcpy(particleIndexBuffer.GetData(), particleIndexData, _numBoids * sizeof(uint32_t));
+		RHIUnlockStructuredBuffer(_grid.particleIndexBuffer);
+
+		uint8* cellOffsetData = (uint8*)RHILockStructuredBuffer(_grid.cellOffsetBuffer, 0, cellOffsetBufferSize * sizeof(uint32_t), RLM_ReadOnly);
+		FMemory::Memcpy(cellOffsetBuffer.GetData(), cellOffsetData, cellOffsetBufferSize * sizeof(uint32_t));
+		RHIUnlockStructuredBuffer(_grid.cellOffsetBuffer);
+	}
+
+
+	// merge the distant boids in each cell into super-boids, the grid gives us each boid's cell
+	const bool superBoids = settings.useSuperBoids && !useLBVH;
+
+	if (superBoids)
+	{
+		{
+			FSuperBoids_reset_CS::FParameters parameters;
+			parameters.numParticles = _numBoids;
+			parameters.superBoidCounts = _superBoidCountBufferUAV;
+			parameters.superBoidSpreads = _superBoidSpreadBufferUAV;
+			parameters.superBoidCellLeaders = _superBoidCellLeaderBufferUAV;
+
+			TShaderMapRef<FSuperBoids_reset_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::Dispatch(
+				RHICommands,
+				*computeShader,
+				parameters,
+				groupSize(_numBoids)
+			);
+		}
+
+		// the leader of a cell is its distant boid with the lowest stable id, the same boid from frame to frame
+		{
+			FSuperBoids_vote_CS::FParameters parameters;
+			parameters.numParticles = _numBoids;
+			parameters.superBoidDistance = settings.superBoidDistance;
+			parameters.viewLocation = step.viewLocation;
+
+			parameters.positions = positionsBufferUAV;
+			parameters.directions = directionsBufferUAV;
+			parameters.cellIndexBuffer = _grid.cellIndexBufferUAV;
+			parameters.cellOffsetBuffer = _grid.cellOffsetBufferUAV;
+
+			parameters.superBoidCellLeaders = _superBoidCellLeaderBufferUAV;
+
+			TShaderMapRef<FSuperBoids_vote_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::Dispatch(
+				RHICommands,
+				*computeShader,
+				parameters,
+				groupSize(_numBoids)
+			);
+		}
+
+		RHICommands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			_superBoidCellLeaderBufferUAV
+		);
+
+		{
+			FSuperBoids_elect_CS::FParameters parameters;
+			parameters.numParticles = _numBoids;
+			parameters.superBoidDistance = settings.superBoidDistance;
+			parameters.viewLocation = step.viewLocation;
+
+			parameters.positions = positionsBufferUAV;
+			parameters.directions = directionsBufferUAV;
+			parameters.cellIndexBuffer = _grid.cellIndexBufferUAV;
+			parameters.cellOffsetBuffer = _grid.cellOffsetBufferUAV;
+
+			parameters.superBoidCellLeaders = _superBoidCellLeaderBufferUAV;
+
+			TShaderMapRef<FSuperBoids_elect_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::Dispatch(
+				RHICommands,
+				*computeShader,
+				parameters,
+				groupSize(_numBoids)
+			);
+		}
+
+		RHICommands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			_superBoidCellLeaderBufferUAV
+		);
+
+		{
+			FSuperBoids_assign_CS::FParameters parameters;
+			parameters.numParticles = _numBoids;
+			parameters.superBoidDistance = settings.superBoidDistance;
+			parameters.superBoidMaxSpread = settings.gridCellSize * FMath::Sqrt(3.0f);
+			parameters.superBoidPlanar = _planar2D ? 1 : 0;
+			parameters.viewLocation = step.viewLocation;
+
+			parameters.positions = positionsBufferUAV;
+			parameters.directions = directionsBufferUAV;
+			parameters.cellIndexBuffer = _grid.cellIndexBufferUAV;
+			parameters.cellOffsetBuffer = _grid.cellOffsetBufferUAV;
+
+			parameters.superBoidLeaders = _superBoidLeaderBufferUAV;
+			parameters.superBoidCounts = _superBoidCountBufferUAV;
+			parameters.superBoidSpreads = _superBoidSpreadBufferUAV;
+			parameters.superBoidCellLeaders = _superBoidCellLeaderBufferUAV;
+
+			TShaderMapRef<FSuperBoids_assign_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::Dispatch(
+				RHICommands,
+				*computeShader,
+				parameters,
+				groupSize(_numBoids)
+			);
+		}
+
+		RHICommands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			_superBoidLeaderBufferUAV
+		);
+	}
+
+	// assign the simulation LOD bands and compact the boids to update this frame
+	if (settings.useSimulationLOD)
+	{
+		{
+			FSimulationLOD_reset_CS::FParameters parameters;
+			parameters.simulationLODCounters = _simulationLODCounterBufferUAV;
+
+			TShaderMapRef<FSimulationLOD_reset_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::Dispatch(
+				RHICommands,
+				*computeShader,
+				parameters,
+				FIntVector(1, 1, 1)
+			);
+		}
+
+		{
+			FSimulationLOD_assign_CS::FParameters parameters;
+			parameters.numParticles = _numBoids;
+			parameters.frameIndex = frameIndex;
+			parameters.sliceOffset = sliceOffset;
+			parameters.sliceSize = sliceCount;
+
+			parameters.viewLocation = step.viewLocation;
+			parameters.viewForward = step.viewForward;
+			parameters.viewCosHalfAngle = step.viewCosHalfAngle;
+			parameters.cullOffscreen = settings.lodCullOffscreen ? 1 : 0;
+
+			parameters.lodNearDistance = settings.lodNearDistance;
+			parameters.lodMidDistance = settings.lodMidDistance;
+			parameters.lodFarDistance = settings.lodFarDistance;
+
+			parameters.positions = positionsBufferUAV;
+			parameters.directions = directionsBufferUAV;
+
+			parameters.useSuperBoids = superBoids ? 1 : 0;
+			parameters.superBoidLeaders = _superBoidLeaderBufferUAV;
+
+			parameters.activeBoidIndexBuffer = _activeBoidIndexBufferUAV;
+			parameters.simulationLODCounters = _simulationLODCounterBufferUAV;
+
+			TShaderMapRef<FSimulationLOD_assign_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::Dispatch(
+				RHICommands,
+				*computeShader,
+				parameters,
+				groupSize(sliceCount)
+			);
+		}
+
+		// the previous step left the arguments readable for the indirect dispatch
+		{
+			RHICommands.TransitionResource(
+				EResourceTransitionAccess::EWritable,
+				EResourceTransitionPipeline::EComputeToCompute,
+				_simulationLODArgsBufferUAV
+			);
+
+			FSimulationLOD_buildArgs_CS::FParameters parameters;
+			parameters.simulationLODCounters = _simulationLODCounterBufferUAV;
+			parameters.simulationLODArgs = _simulationLODArgsBufferUAV;
+
+			TShaderMapRef<FSimulationLOD_buildArgs_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::Dispatch(
+				RHICommands,
+				*computeShader,
+				parameters,
+				FIntVector(1, 1, 1)
+			);
+		}
+
+		RHICommands.TransitionResource(
+			EResourceTransitionAccess::EReadable,
+			EResourceTransitionPipeline::EComputeToCompute,
+			_simulationLODArgsBufferUAV
+		);
+	}
+
+	// execute the main compute shader
+	{
+		FBoidsComputeShader::FParameters parameters;
+		parameters.dt = dt;
+		parameters.totalTime = totalTime;
+		parameters.separationDistance = settings.separationDistance;
+		parameters.boidSpeed = settings.boidSpeed;
+		parameters.boidSpeedVariation = settings.boidSpeedVariation;
+		parameters.separationDistance = settings.separationDistance;
+		parameters.boidRotationSpeed = settings.boidRotationSpeed;
+		parameters.homeInnerRadius = settings.homeInnerRadius;
+		parameters.neighbourhoodDistance = settings.neighbourDistance;
+
+		parameters.homeUrge = settings.homeUrge;
+		parameters.separationUrge = settings.separationUrge;
+		parameters.cohesionUrge = settings.cohesionUrge;
+		parameters.alignmentUrge = settings.alignmentUrge;
+
+		for (int32 i = 0; i < maxSpecies * maxSpecies; ++i)
+			parameters.speciesInteractions[i] = settings.speciesInteractions[i];
+
+		parameters.numParticles = _numBoids;
+		parameters.cellSizeReciprocal = 1.0f / settings.gridCellSize;
+		parameters.cellOffsetBufferSize = cellOffsetBufferSize;
+		parameters.gridDimensions = _grid.gridDimensions;
+
+		parameters.positions = positionsBufferUAV;
+		parameters.directions = directionsBufferUAV;
+		parameters.newDirections = newDirectionsBufferUAV;
+		parameters.cellOffsetBuffer = _grid.cellOffsetBufferUAV;
+
+		parameters.sliceOffset = sliceOffset;
+		parameters.sliceSize = sliceCount;
+		parameters.cellIndexBuffer = _grid.cellIndexBufferUAV;
+
+		parameters.useSuperBoids = superBoids ? 1 : 0;
+		parameters.superBoidLeaders = _superBoidLeaderBufferUAV;
+		parameters.superBoidCounts = _superBoidCountBufferUAV;
+		parameters.particleIndexBuffer = neighbourIndex.particleIndexBufferUAV;
+
+		parameters.blockDimensions = _grid.blockDimensions();
+		parameters.cellOccupancyBuffer = _grid.cellOccupancyBufferUAV;
+		parameters.blockOccupancyBuffer = _grid.blockOccupancyBufferUAV;
+
+		parameters.numLBVHItems = _numBoids;
+		parameters.lbvhChildren = _lbvh.childrenBufferUAV;
+		parameters.lbvhNodeMin = _lbvh.nodeMinBufferUAV;
+		parameters.lbvhNodeMax = _lbvh.nodeMaxBufferUAV;
+
+		parameters.activeBoidIndexBuffer = _activeBoidIndexBufferUAV;
+		parameters.simulationLODCounters = _simulationLODCounterBufferUAV;
+
+		parameters.numInfluencers = step.numInfluencers;
+		parameters.influencerCellSizeReciprocal = 1.0f / settings.influencerCellSize;
+		parameters.influencerGridDimensions = _influencerGrid.gridDimensions;
+		parameters.influencerCellOffsetBufferSize = _influencerGrid.cellOffsetBufferSize();
+
+		parameters.influencerPositions = _influencerPositionBufferUAV;
+		parameters.influencerShapes = _influencerShapeBufferUAV;
+		parameters.influencerParticleIndexBuffer = _influencerGrid.particleIndexBufferUAV;
+		parameters.influencerCellIndexBuffer = _influencerGrid.cellIndexBufferUAV;
+		parameters.influencerCellOffsetBuffer = _influencerGrid.cellOffsetBufferUAV;
+
+		FVector sdfUVWScale(0.0f), sdfUVWOffset(0.0f);
+
+		if (_hasSDF)
+			FBoidSDFBaker::uvwTransform(_sdfBounds, _sdfResolution, sdfUVWScale, sdfUVWOffset);
+
+		parameters.useSDF = _hasSDF && settings.sdfAvoidanceUrge != 0.0f ? 1 : 0;
+		parameters.sdfUVWScale = sdfUVWScale;
+		parameters.sdfUVWOffset = sdfUVWOffset;
+		parameters.sdfAvoidanceDistance = FMath::Max(settings.sdfAvoidanceDistance, KINDA_SMALL_NUMBER);
+		parameters.sdfAvoidanceUrge = settings.sdfAvoidanceUrge;
+
+		parameters.sdfTexture = _sdfTexture;
+		parameters.sdfSampler = TStaticSamplerState<SF_Trilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+
+		const bool hasFlowField = settings.flowField && _flowFieldTexture.IsValid();
+
+		const FVector flowUVWScale = hasFlowField ? settings.flowField->uvwScale : FVector(0.0f);
+		const FVector flowUVWOffset = hasFlowField ? settings.flowField->uvwOffset : FVector(0.0f);
+
+		parameters.useFlowField = hasFlowField && settings.flowUrge != 0.0f ? 1 : 0;
+		parameters.flowTile = hasFlowField && settings.flowField->tile ? 1 : 0;
+		parameters.flowUVWScale = flowUVWScale;
+		parameters.flowUVWOffset = flowUVWOffset;
+		parameters.flowUrge = settings.flowUrge;
+
+		// the volume must be bound even when we don't sample it
+		parameters.flowTexture = hasFlowField ? _flowFieldTexture : _sdfTexture;
+
+		if (hasFlowField && settings.flowField->tile)
+			parameters.flowSampler = TStaticSamplerState<SF_Trilinear, AM_Wrap, AM_Wrap, AM_Wrap>::GetRHI();
+		else
+			parameters.flowSampler = TStaticSamplerState<SF_Trilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+
+		FVector navUVWScale(0.0f), navUVWOffset(0.0f);
+
+		if (_navPublished)
+			FBoidSDFBaker::uvwTransform(_navField.bounds, _navField.resolution, navUVWScale, navUVWOffset);
+
+		parameters.useNavField = settings.useNavField && _navPublished && settings.navUrge != 0.0f ? 1 : 0;
+		parameters.navUVWScale = navUVWScale;
+		parameters.navUVWOffset = navUVWOffset;
+		parameters.navUrge = settings.navUrge;
+
+		parameters.navTexture = _navPublished ? _navField.texture : _sdfTexture;
+		parameters.navSampler = TStaticSamplerState<SF_Trilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+
+		// only pick a new kernel when the rules or the other settings change
+		const uint32 ruleMask = settings.ruleMask;
+		const uint32 permutationKey = ruleMask
+			| (settings.useSimulationLOD ? 1u << 8 : 0u)
+			| (numSpecies > 1 ? 1u << 9 : 0u)
+			| (_planar2D ? 1u << 10 : 0u)
+			| (useLBVH ? 1u << 11 : 0u);
+
+		if (permutationKey != _boidPermutationKey)
+		{
+			// the same choices as FBoidsComputeShader::ShouldCompilePermutation, the pruned permutations don't exist
+			const bool neighbours = FBoidsComputeShader::usesNeighbours(ruleMask, numSpecies > 1);
+			const bool waveVotes = GRHISupportsWaveOperations && FBoidsComputeShader::supportsWaveVotes(GMaxRHIShaderPlatform);
+
+			FBoidsComputeShader::FPermutationDomain permutationVector;
+			permutationVector.Set<FBoidsComputeShader::FWaveOccupancyDim>(waveVotes && neighbours && !useLBVH);
+			permutationVector.Set<FBoidsComputeShader::FActiveListDim>(settings.useSimulationLOD);
+			permutationVector.Set<FBoidsComputeShader::FSpeciesDim>(numSpecies > 1);
+			permutationVector.Set<FBoidsComputeShader::FPlanarDim>(_planar2D);
+			permutationVector.Set<FBoidsComputeShader::FRulesDim>(ruleMask);
+			permutationVector.Set<FBoidsComputeShader::FSpatialIndexDim>(neighbours && useLBVH);
+
+			_boidPermutationId = permutationVector.ToDimensionValueId();
+			_boidPermutationKey = permutationKey;
+		}
+
+		TShaderMapRef<FBoidsComputeShader> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), FBoidsComputeShader::FPermutationDomain(_boidPermutationId));
+
+		if (settings.useSimulationLOD)
+		{
+			FComputeShaderUtils::DispatchIndirect(
+				RHICommands,
+				*computeShader,
+				parameters,
+				_simulationLODArgsBuffer,
+				0
+			);
+		}
+		else
+		{
+			FComputeShaderUtils::Dispatch(
+				RHICommands,
+				*computeShader,
+				parameters,
+				groupSize(sliceCount)
+			);
+		}
+	}
+
+	// impulses, once per frame over every boid
+	if (step.applyImpulses && step.numImpulseEvents > 0)
+	{
+		FBoids_applyImpulses_CS::FParameters parameters;
+		parameters.dt = dt;
+		parameters.boidSpeed = settings.boidSpeed;
+		parameters.numParticles = _numBoids;
+		parameters.speciesSpeedScale = settings.speciesSpeedScale;
+
+		parameters.positions = positionsBufferUAV;
+		parameters.directions = directionsBufferUAV;
+		parameters.newDirections = newDirectionsBufferUAV;
+
+		parameters.numImpulseEvents = step.numImpulseEvents;
+		parameters.impulseCellSizeReciprocal = 1.0f / settings.impulseCellSize;
+		parameters.impulseBucketCount = FMath::Max(settings.impulseBucketCount, 1);
+		parameters.impulseEventsOffset = step.impulseEventsOffset;
+		parameters.impulseData = _impulseDataBufferUAV;
+
+		FBoids_applyImpulses_CS::FPermutationDomain permutationVector;
+		permutationVector.Set<FBoids_applyImpulses_CS::FPlanarDim>(_planar2D);
+
+		TShaderMapRef<FBoids_applyImpulses_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), permutationVector);
+		FComputeShaderUtils::Dispatch(
+			RHICommands,
+			*computeShader,
+			parameters,
+			groupSize(_numBoids)
+		);
+	}
+
+	// integrate positions
+	{
+		FBoids_integratePosition_CS::FParameters parameters;
+		parameters.dt = dt;
+		parameters.totalTime = totalTime;
+		parameters.boidSpeed = settings.boidSpeed;
+		parameters.boidSpeedVariation = settings.boidSpeedVariation;
+		parameters.boidRotationSpeed = settings.boidRotationSpeed;
+		parameters.speciesSpeedScale = settings.speciesSpeedScale;
+
+		parameters.numParticles = _numBoids;
+
+		parameters.positions = positionsBufferUAV;
+		parameters.directions = directionsBufferUAV;
+		parameters.newDirections = newDirectionsBufferUAV;
+		parameters.previousPositions = _previousPositionBufferUAV[_current];
+
+		parameters.useSuperBoids = superBoids ? 1 : 0;
+		parameters.superBoidLeaders = _superBoidLeaderBufferUAV;
+
+		parameters.numImpulseEvents = step.numImpulseEvents;
+		parameters.impulseCellSizeReciprocal = 1.0f / settings.impulseCellSize;
+		parameters.impulseBucketCount = FMath::Max(settings.impulseBucketCount, 1);
+		parameters.impulseEventsOffset = step.impulseEventsOffset;
+		parameters.impulseData = _impulseDataBufferUAV;
+
+		const bool hasHeightfield = _planar2D && settings.heightfield && settings.heightfield->TextureRHI.IsValid();
+
+		const FVector2D heightfieldUVScale = FVector2D(1.0f, 1.0f) / settings.heightfieldSize.ComponentMax(FVector2D(KINDA_SMALL_NUMBER, KINDA_SMALL_NUMBER));
+
+		parameters.useHeightfield = hasHeightfield ? 1 : 0;
+		parameters.heightfieldUVScale = heightfieldUVScale;
+		parameters.heightfieldUVOffset = -settings.heightfieldOrigin * heightfieldUVScale;
+		parameters.heightfieldScale = settings.heightfieldScale;
+		parameters.heightOffset = settings.heightOffset;
+		parameters.heightfieldTexture = hasHeightfield ? settings.heightfield->TextureRHI.GetReference() : GBlackTexture->TextureRHI.GetReference();
+		parameters.heightfieldSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+
+		FBoids_integratePosition_CS::FPermutationDomain permutationVector;
+		permutationVector.Set<FBoids_integratePosition_CS::FIntegratorDim>(int32(settings.integrator));
+		permutationVector.Set<FBoids_integratePosition_CS::FPlanarDim>(_planar2D);
+
+		TShaderMapRef<FBoids_integratePosition_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), permutationVector);
+		FComputeShaderUtils::Dispatch(
+			RHICommands,
+			*computeShader,
+			parameters,
+			groupSize(_numBoids)
+		);
+	}
+
+	// move the super-boids' followers with them
+	if (superBoids)
+	{
+		FSuperBoids_place_CS::FParameters parameters;
+		parameters.numParticles = _numBoids;
+		parameters.superBoidMaxSpread = settings.gridCellSize * FMath::Sqrt(3.0f);
+		parameters.superBoidPlanar = _planar2D ? 1 : 0;
+		parameters.superBoidBlend = settings.superBoidBlendTime > 0.0f ? 1.0f - FMath::Exp(-dt / settings.superBoidBlendTime) : 1.0f;
+
+		parameters.positions = positionsBufferUAV;
+		parameters.directions = directionsBufferUAV;
+		parameters.previousPositions = _previousPositionBufferUAV[_current];
+
+		parameters.superBoidLeaders = _superBoidLeaderBufferUAV;
+		parameters.superBoidCounts = _superBoidCountBufferUAV;
+		parameters.superBoidSpreads = _superBoidSpreadBufferUAV;
+
+		TShaderMapRef<FSuperBoids_place_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			RHICommands,
+			*computeShader,
+			parameters,
+			groupSize(_numBoids)
+		);
+	}
+
+	// rearrange positions for better cache-coherence on the next run
+	if (settings.rearrangeBoids)
+	{
+		FBoids_rearrangePositions_CS::FParameters parameters;
+
+		parameters.positions = positionsBufferUAV;
+		parameters.directions = directionsBufferUAV;
+
+		parameters.positions_other = _positionBufferUAV[(_current + 1) % 2];
+		parameters.directions_other = _directionsBufferUAV[(_current + 1) % 2];
+
+		parameters.newDirections = newDirectionsBufferUAV;
+		parameters.newDirections_other = _newDirectionsBufferUAV[(_current + 1) % 2];
+
+		parameters.previousPositions = _previousPositionBufferUAV[_current];
+		parameters.previousPositions_other = _previousPositionBufferUAV[(_current + 1) % 2];
+
+		parameters.particleIndexBuffer = neighbourIndex.particleIndexBufferUAV;
+		parameters.numParticles = _numBoids;
+
+		TShaderMapRef<FBoids_rearrangePositions_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			RHICommands,
+			*computeShader,
+			parameters,
+			groupSize(_numBoids)
+		); 
+
+		// rotate our buffers
+		_current = (_current + 1) % 2;
+	}
+
+	_publish(step.frameIndex);
+}
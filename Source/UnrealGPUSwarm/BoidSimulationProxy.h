@@ -0,0 +1,396 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+#include "RHICommandList.h"
+#include "Containers/DynamicRHIResourceArray.h"
+
+#include "GPUHashedGrid.h"
+#include "GPULBVH.h"
+#include "BoidNavField.h"
+#include "BoidImpulseQueue.h"
+
+struct FBoidFlowFieldData;
+class FTextureResource;
+class FSceneInterface;
+class FSceneView;
+class FSceneViewFamily;
+struct FIBMPerInstanceRenderData;
+
+// The behaviour rules compiled into the neighbour pass, must match the BOID_RULE_* defines in Boid.usf
+namespace EBoidRule
+{
+	enum Type : uint32
+	{
+		Separation = 1,
+		Alignment = 2,
+		Cohesion = 4,
+		Home = 8,
+		// Influencers, the SDF, the flow and nav fields
+		External = 16,
+
+		All = 31
+	};
+}
+
+// Everything the proxy allocates, fixed at BeginPlay
+struct FBoidSimulationProxyInit
+{
+	// The scene of the component's world, only the views of this scene update the simulation
+	FSceneInterface * scene = nullptr;
+
+	int32 numBoids = 0;
+
+	// For planar swarms the Z dimension is 1
+	FIntVector gridDimensions = FIntVector(256, 256, 256);
+	bool planar2D = false;
+
+	// Allocate the LBVH as well as the hashed grid
+	bool useLBVH = false;
+
+	int32 maxInfluencers = 1;
+	FIntVector influencerGridDimensions = FIntVector(64, 64, 64);
+
+	// The baked obstacle volume, empty for none
+	TArray<float> sdfDistances;
+	FIntVector sdfResolution = FIntVector(0, 0, 0);
+	FBox sdfBounds = FBox(ForceInit);
+
+	int32 impulseCapacity = 1;
+	int32 impulseBucketCount = 1;
+
+	// The navigation field's voxels, on the SDF's grid
+	bool useNavField = false;
+	FIntVector navResolution = FIntVector(0, 0, 0);
+	FBox navBounds = FBox(ForceInit);
+
+	// The spawned boids, w is the species and the boid's id
+	TResourceArray<FVector4> positions;
+	TResourceArray<FVector4> directions;
+};
+
+// A copy of the component's settings, the render thread never reads the component. The fields mirror the component's
+// properties.
+struct FBoidSimulationSettings
+{
+	// The clock, see the component's useFixedTimestep and deterministic
+	bool useFixedTimestep = false;
+	bool deterministic = false;
+	float simulationRate = 30.0f;
+	int32 maxSubsteps = 4;
+
+	float neighbourDistance = 10.0f;
+	float separationDistance = 3.0f;
+	float homeInnerRadius = 200.0f;
+
+	float boidSpeed = 10.0f;
+	float boidSpeedVariation = 1.0f;
+	float boidRotationSpeed = 10.0f;
+
+	// Must match EBoidIntegrator
+	uint32 integrator = 0;
+
+	float homeUrge = 0.1f;
+	float separationUrge = 0.1f;
+	float cohesionUrge = 0.01f;
+	float alignmentUrge = 0.1f;
+
+	// A mask of EBoidRule
+	uint32 ruleMask = 31;
+
+	int32 numSpecies = 1;
+	FVector4 speciesSpeedScale = FVector4(1.0f, 1.0f, 1.0f, 1.0f);
+	FVector4 speciesInteractions[4 * 4];
+
+	float gridCellSize = 5.0f;
+	bool gridSortKeyValues = true;
+	bool gridRadixSort = false;
+	bool rearrangeBoids = true;
+
+	bool useLBVH = false;
+	FBox lbvhBounds = FBox(FVector(-2000.0f), FVector(2000.0f));
+
+	int32 timeSliceCount = 1;
+
+	bool useSimulationLOD = false;
+	float lodNearDistance = 1000.0f;
+	float lodMidDistance = 2000.0f;
+	float lodFarDistance = 4000.0f;
+	bool lodCullOffscreen = true;
+	float lodOffscreenMargin = 15.0f;
+
+	bool useSuperBoids = false;
+	float superBoidDistance = 4000.0f;
+	float superBoidBlendTime = 0.25f;
+
+	float influencerCellSize = 200.0f;
+
+	float sdfAvoidanceDistance = 100.0f;
+	float sdfAvoidanceUrge = 1.0f;
+
+	// The flow field asset copied on the game thread, shared between pushes until the asset changes
+	TSharedPtr<const FBoidFlowFieldData, ESPMode::ThreadSafe> flowField;
+	float flowUrge = 1.0f;
+
+	bool useNavField = false;
+	float navUrge = 1.0f;
+	float navAgentRadius = 10.0f;
+	int32 navIterationsPerStep = 16;
+	int32 navIterationsPerGoal = 0;
+
+	float impulseCellSize = 500.0f;
+	int32 impulseBucketCount = 1024;
+
+	// The heightfield's render resource, owned by the render thread
+	FTextureResource * heightfield = nullptr;
+	FVector2D heightfieldOrigin = FVector2D(-5000.0f, -5000.0f);
+	FVector2D heightfieldSize = FVector2D(10000.0f, 10000.0f);
+	float heightfieldScale = 1000.0f;
+	float heightOffset = 0.0f;
+
+	// Field by field, the component only pushes settings that changed. A new field has to be added here too.
+	bool operator==(const FBoidSimulationSettings& other) const;
+	bool operator!=(const FBoidSimulationSettings& other) const { return !(*this == other); }
+};
+
+// Everything a single simulation step needs from the game thread
+struct FBoidSimulationStep
+{
+	float dt = 0.0f;
+	float totalTime = 0.0f;
+	uint32 frameIndex = 0;
+
+	// the view for the simulation LOD, in simulation space
+	FVector viewLocation = FVector::ZeroVector;
+	FVector viewForward = FVector::ForwardVector;
+	float viewCosHalfAngle = -1.0f;
+
+	// the navigation goal, in simulation space
+	FVector navGoal = FVector::ZeroVector;
+
+	// impulses and force fields in simulation space, uploaded when impulseData isn't empty (the first step in a frame)
+	uint32 numImpulseEvents = 0;
+	uint32 impulseEventsOffset = 0;
+	bool applyImpulses = false;
+	TArray<uint32> impulseData;
+
+	// influencers in simulation space, uploaded when the arrays aren't empty (the first step after they change)
+	uint32 numInfluencers = 0;
+	TArray<FVector4> influencerPositions; // centre, radius
+	TArray<FVector4> influencerShapes;    // half axis, strength
+};
+
+// The game thread's inputs that aren't settings, pushed with the settings whenever either changes
+struct FBoidSimulationInputs
+{
+	// The actor's transform, the simulation runs in its space
+	FTransform simulationTransform = FTransform::Identity;
+
+	// The navigation goal, in simulation space
+	FVector navGoal = FVector::ZeroVector;
+
+	// Influencers in simulation space
+	uint32 numInfluencers = 0;
+	TArray<FVector4> influencerPositions; // centre, radius
+	TArray<FVector4> influencerShapes;    // half axis, strength
+
+	// The impulses and force fields queued since the last push, in simulation space
+	TArray<FBoidImpulseQueue::FEvent> events;
+};
+
+// The buffers of the last finished step, what the renderer draws
+struct FBoidSimulationFrame
+{
+	FUnorderedAccessViewRHIRef positions;
+	FUnorderedAccessViewRHIRef directions;
+
+	// The positions before the step, blend towards positions with the interpolation alpha
+	FUnorderedAccessViewRHIRef previousPositions;
+
+	uint32 numBoids = 0;
+
+	// The simulation frame of the step, ~0 before the first step
+	uint32 frameIndex = ~0u;
+};
+
+// The render thread side of a GPU swarm. It owns every RHI resource of the simulation and all of the state the passes
+// carry between steps (the double buffered boids, the spatial indices, the navigation solve, the clock). The component
+// creates it at BeginPlay and registers it with FBoidSimulationViewExtension, which calls update() once per frame
+// before the scene renders. The game thread only pushes copies of its settings and inputs when they change, so a swarm
+// costs it nothing on the frames in between.
+//
+// Every method runs on the render thread, init included. The buffers the renderer should draw are published in
+// currentFrame() at the end of every step, and copied into the instance target (if any) at the end of every update.
+class UNREALGPUSWARM_API FBoidSimulationProxy
+{
+public:
+	// Render thread, allocate everything and upload the spawned boids, init's arrays are consumed
+	void init(FBoidSimulationProxyInit& init);
+
+	bool isInitialized() const { return _numBoids > 0; }
+
+	// Render thread, the settings and inputs for the following updates, the events are consumed
+	void push(const FBoidSimulationSettings& settings, FBoidSimulationInputs& inputs);
+
+	// Render thread, the instance buffer mesh the boids are copied into after every update, null for none
+	void setInstanceTarget(TSharedPtr<FIBMPerInstanceRenderData, ESPMode::ThreadSafe> renderData, float particleScale);
+
+	// Render thread, advance the clock with the view family's world time, run the steps it owes and copy the boids
+	// into the instance target. Only the first view family of our scene in a frame does anything.
+	void update(FRHICommandListImmediate& RHICommands, const FSceneViewFamily& viewFamily);
+
+	// Render thread, at the end of every frame. When no view family of our scene rendered (a minimised window, hidden
+	// viewports) the simulation is advanced by the real frame time from the last view, so it doesn't freeze.
+	void endFrame(FRHICommandListImmediate& RHICommands);
+
+	// The most time a frame without a view advances the simulation by
+	static constexpr float maxUnrenderedDeltaTime = 0.1f;
+
+	// Render thread, run one step of the simulation
+	void step(FRHICommandListImmediate& RHICommands, const FBoidSimulationSettings& settings, const FBoidSimulationStep& step);
+
+	// Render thread, the buffers of the last step
+	const FBoidSimulationFrame& currentFrame() const;
+
+	// Render thread, compare the navigation field with the CPU reference solver and log the difference
+	void validateNavField(const TArray<uint8>& blocked);
+
+	// Must match MAX_SPECIES in Boid.usf
+	static constexpr int32 maxSpecies = 4;
+
+protected:
+	// Run the steps deltaTime owes and copy the boids into the instance target, view is null when none rendered
+	void _advance(FRHICommandListImmediate& RHICommands, float deltaTime, float worldTime, const FSceneView * view);
+
+	void _publish(uint32 frameIndex);
+
+	void _copyInstances(FRHICommandListImmediate& RHICommands);
+
+protected:
+	int32 _numBoids = 0;
+	bool _planar2D = false;
+
+	FSceneInterface * _scene = nullptr;
+
+	// The last push from the game thread, nothing is stepped before the first
+	FBoidSimulationSettings _settings;
+	FBoidSimulationInputs _inputs;
+	bool _hasInputs = false;
+	bool _influencersChanged = false;
+
+	// The clock
+	uint32 _lastFrameNumber = ~0u;
+	uint32 _simulationFrame = 0;
+	float _timeAccumulator = 0.0f;
+	float _simulationTime = 0.0f;
+	float _interpolationAlpha = 1.0f;
+
+	// The frames without a view, see endFrame
+	bool _updatedThisFrame = false;
+	bool _worldPaused = false;
+	double _lastEndFrameSeconds = 0.0;
+	float _worldTime = 0.0f;
+
+	// The last view, in the space of the simulation
+	FVector _viewLocation = FVector::ZeroVector;
+	FVector _viewForward = FVector::ForwardVector;
+	float _viewCosHalfAngle = -1.0f;
+
+	// The copy into the instance buffer mesh, the UAVs are rebuilt whenever its buffers are reallocated
+	TSharedPtr<FIBMPerInstanceRenderData, ESPMode::ThreadSafe> _instanceRenderData;
+	float _instanceScale = 1.0f;
+
+	FVertexBufferRHIRef _instanceOriginBuffer;
+	FUnorderedAccessViewRHIRef _instanceOriginUAV; // float4
+
+	FVertexBufferRHIRef _instanceTransformBuffer;
+	FUnorderedAccessViewRHIRef _instanceTransformUAV; // float4x4
+
+	// Which of the double buffers holds the current boids
+	uint32 _current = 0;
+
+	FBoidSimulationFrame _frame;
+
+	// The neighbour pass permutation, rebuilt when the rule set changes
+	uint32 _boidPermutationKey = ~0u;
+	int32 _boidPermutationId = 0;
+
+	FStructuredBufferRHIRef _positionBuffer[2];
+	FUnorderedAccessViewRHIRef _positionBufferUAV[2];     // we need a UAV for writing
+
+	FStructuredBufferRHIRef _directionsBuffer[2];
+	FUnorderedAccessViewRHIRef _directionsBufferUAV[2];
+
+	// The positions before the last integration, rearranged with the positions
+	FStructuredBufferRHIRef _previousPositionBuffer[2];
+	FUnorderedAccessViewRHIRef _previousPositionBufferUAV[2];
+
+	// The steering from the last neighbour update, rearranged with the positions and directions
+	FStructuredBufferRHIRef _newDirectionsBuffer[2];
+	FUnorderedAccessViewRHIRef _newDirectionsBufferUAV[2];
+
+	// Hashed grid data structures
+	FGPUHashedGrid _grid;
+
+	// The alternative to the grid, see ESpatialIndex
+	FGPULBVH _lbvh;
+
+	// Influencers and their hashed grid
+	FStructuredBufferRHIRef _influencerPositionBuffer;
+	FUnorderedAccessViewRHIRef _influencerPositionBufferUAV;
+
+	FStructuredBufferRHIRef _influencerShapeBuffer;
+	FUnorderedAccessViewRHIRef _influencerShapeBufferUAV;
+
+	FGPUHashedGrid _influencerGrid;
+
+	// Obstacle avoidance volume
+	FTexture3DRHIRef _sdfTexture;
+	bool _hasSDF = false;
+	FIntVector _sdfResolution = FIntVector(0, 0, 0);
+	FBox _sdfBounds = FBox(ForceInit);
+
+	// Flow field volume, created for the settings' flow field and filled again when they point at another copy
+	TSharedPtr<const FBoidFlowFieldData, ESPMode::ThreadSafe> _flowField;
+	FTexture3DRHIRef _flowFieldTexture;
+	FUnorderedAccessViewRHIRef _flowFieldTextureUAV;
+	bool _flowFieldFilled = false;
+
+	// Navigation field, solved incrementally
+	FBoidNavField _navField;
+	FIntVector _navGoalCell = FIntVector(-1, -1, -1);
+	int32 _navIterations = 0;
+	bool _navPublished = false;
+	bool _navWarmStart = false;
+
+	// Impulses and force fields, queued here and uploaded in one copy
+	FBoidImpulseQueue _impulseQueue;
+
+	FStructuredBufferRHIRef _impulseDataBuffer;
+	FUnorderedAccessViewRHIRef _impulseDataBufferUAV;
+
+	// Simulation LOD
+	FStructuredBufferRHIRef _activeBoidIndexBuffer;
+	FUnorderedAccessViewRHIRef _activeBoidIndexBufferUAV;
+
+	FStructuredBufferRHIRef _simulationLODCounterBuffer;
+	FUnorderedAccessViewRHIRef _simulationLODCounterBufferUAV;
+
+	FVertexBufferRHIRef _simulationLODArgsBuffer; // indirect dispatch args
+	FUnorderedAccessViewRHIRef _simulationLODArgsBufferUAV;
+
+	// Super-boids, per boid its leader, per leader its count and spread and per cell its leader
+	FStructuredBufferRHIRef _superBoidLeaderBuffer;
+	FUnorderedAccessViewRHIRef _superBoidLeaderBufferUAV;
+
+	FStructuredBufferRHIRef _superBoidCountBuffer;
+	FUnorderedAccessViewRHIRef _superBoidCountBufferUAV;
+
+	FStructuredBufferRHIRef _superBoidSpreadBuffer;
+	FUnorderedAccessViewRHIRef _superBoidSpreadBufferUAV;
+
+	FStructuredBufferRHIRef _superBoidCellLeaderBuffer;
+	FUnorderedAccessViewRHIRef _superBoidCellLeaderBufferUAV;
+};
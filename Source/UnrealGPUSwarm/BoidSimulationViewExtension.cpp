@@ -0,0 +1,61 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "BoidSimulationViewExtension.h"
+
+#include "Misc/CoreDelegates.h"
+
+#include "BoidSimulationProxy.h"
+
+FBoidSimulationViewExtension::FBoidSimulationViewExtension(const FAutoRegister& autoRegister)
+	: FSceneViewExtensionBase(autoRegister)
+{
+	_endFrameHandle = FCoreDelegates::OnEndFrameRT.AddRaw(this, &FBoidSimulationViewExtension::_endFrame);
+}
+
+FBoidSimulationViewExtension::~FBoidSimulationViewExtension()
+{
+	FCoreDelegates::OnEndFrameRT.Remove(_endFrameHandle);
+}
+
+TSharedRef<FBoidSimulationViewExtension, ESPMode::ThreadSafe> FBoidSimulationViewExtension::get()
+{
+	check(IsInGameThread());
+
+	static TSharedPtr<FBoidSimulationViewExtension, ESPMode::ThreadSafe> extension;
+
+	if (!extension.IsValid())
+		extension = FSceneViewExtensions::NewExtension<FBoidSimulationViewExtension>();
+
+	return extension.ToSharedRef();
+}
+
+void FBoidSimulationViewExtension::addProxy(TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe> proxy)
+{
+	check(IsInRenderingThread());
+
+	_proxies.AddUnique(proxy);
+}
+
+void FBoidSimulationViewExtension::removeProxy(TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe> proxy)
+{
+	check(IsInRenderingThread());
+
+	_proxies.Remove(proxy);
+}
+
+void FBoidSimulationViewExtension::PreRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily)
+{
+	for (const TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe>& proxy : _proxies)
+		proxy->update(RHICmdList, InViewFamily);
+}
+
+void FBoidSimulationViewExtension::_endFrame()
+{
+	if (_proxies.Num() == 0)
+		return;
+
+	FRHICommandListImmediate& RHICommands = FRHICommandListExecutor::GetImmediateCommandList();
+
+	for (const TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe>& proxy : _proxies)
+		proxy->endFrame(RHICommands);
+}
@@ -0,0 +1,43 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SceneViewExtension.h"
+
+class FBoidSimulationProxy;
+
+// Drives every GPU swarm from the render thread. Before a view family renders, each registered proxy gets an update()
+// in which it steps its simulation and copies the boids into its instance buffer, so neither happens on the game thread.
+// There is one extension for the whole engine, the proxies filter the view families by scene. At the end of every
+// render thread frame the proxies get an endFrame(), which steps the swarms whose scene didn't render.
+class UNREALGPUSWARM_API FBoidSimulationViewExtension : public FSceneViewExtensionBase
+{
+public:
+	FBoidSimulationViewExtension(const FAutoRegister& autoRegister);
+	virtual ~FBoidSimulationViewExtension();
+
+	// Game thread, the extension, created on first use
+	static TSharedRef<FBoidSimulationViewExtension, ESPMode::ThreadSafe> get();
+
+	// Render thread
+	void addProxy(TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe> proxy);
+	void removeProxy(TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe> proxy);
+
+	// ISceneViewExtension
+	virtual void SetupViewFamily(FSceneViewFamily& InViewFamily) override {}
+	virtual void SetupView(FSceneViewFamily& InViewFamily, FSceneView& InView) override {}
+	virtual void BeginRenderViewFamily(FSceneViewFamily& InViewFamily) override {}
+	virtual void PreRenderView_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneView& InView) override {}
+	virtual void PreRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily) override;
+
+protected:
+	// Render thread, FCoreDelegates::OnEndFrameRT
+	void _endFrame();
+
+protected:
+	// Render thread
+	TArray<TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe>> _proxies;
+
+	FDelegateHandle _endFrameHandle;
+};
@@ -0,0 +1,292 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "CPUBoidSimulation.h"
+
+#include "Async/ParallelFor.h"
+
+void FCPUBoidSimulation::init(uint32 numBoids_in, FIntVector gridDimensions, bool planar2D_in, const FVector4 * positions, const FVector4 * directions)
+{
+	numBoids = numBoids_in;
+	planar2D = planar2D_in;
+
+	// a 2D key for planar swarms, like the GPU grid
+	grid.planar2D = planar2D;
+	grid.init(numBoids, planar2D ? FIntVector(gridDimensions.X, gridDimensions.Y, 1) : gridDimensions);
+
+	TArray<float> * arrays[] = {
+		&positionX, &positionY, &positionZ, &positionW,
+		&directionX, &directionY, &directionZ, &directionW,
+		&steeringX, &steeringY, &steeringZ,
+		&_scratch
+	};
+
+	for (TArray<float> * array : arrays)
+		array->SetNumUninitialized(numBoids);
+
+	for (uint32 i = 0; i < numBoids; ++i)
+	{
+		positionX[i] = positions[i].X;
+		positionY[i] = positions[i].Y;
+		positionZ[i] = positions[i].Z;
+		positionW[i] = positions[i].W;
+
+		directionX[i] = directions[i].X;
+		directionY[i] = directions[i].Y;
+		directionZ[i] = directions[i].Z;
+		directionW[i] = directions[i].W;
+
+		// the initial steering is the initial heading
+		steeringX[i] = directions[i].X;
+		steeringY[i] = directions[i].Y;
+		steeringZ[i] = directions[i].Z;
+	}
+}
+
+void FCPUBoidSimulation::initEffects(int32 maxInfluencers, FIntVector influencerGridDimensions, int32 impulseCapacity)
+{
+	influencerGrid.init(FMath::Max(maxInfluencers, 1), influencerGridDimensions);
+	impulses.init(impulseCapacity);
+}
+
+void FCPUBoidSimulation::step(const FCPUBoidSimulationStep& step)
+{
+	if (!isInitialized())
+		return;
+
+	grid.build(numBoids, step.cellSize, positionX.GetData(), positionY.GetData(), positionZ.GetData());
+
+	_rearrange();
+
+	const SwarmCore::BoidsSoA boids = _boids();
+	const SwarmCore::BoidParameters parameters = _parameters(step);
+
+	// GridNeighboursBoidUpdate
+	SwarmCore::updateSteering(grid.shape(), neighbourScan, grid.cellOffsetBuffer.GetData(), grid.cellEnds.GetData(), boids, numBoids, parameters, FSwarmCoreParallelFor());
+
+	if ((step.ruleMask & SwarmCore::ruleExternal) != 0 && step.influencerPositions.Num() > 0)
+		_applyInfluencers(step);
+
+	// applyImpulses and IntegrateBoidPosition, with its force fields
+	impulses.takeLive(step.dt, _events);
+
+	if (_events.Num() > 0)
+		_applyEvents(step, true);
+
+	SwarmCore::integrate(boids, numBoids, parameters, FSwarmCoreParallelFor());
+
+	if (_events.Num() > 0)
+		_applyEvents(step, false);
+}
+
+void FCPUBoidSimulation::copyTo(TArray<FVector4>& positions, TArray<FVector4>& directions) const
+{
+	positions.SetNumUninitialized(numBoids);
+	directions.SetNumUninitialized(numBoids);
+
+	const uint32 numBatches = FMath::DivideAndRoundUp(numBoids, batchSize);
+
+	ParallelFor(numBatches, [&](int32 batch)
+	{
+		const uint32 begin = batch * batchSize;
+		const uint32 end = FMath::Min(begin + batchSize, numBoids);
+
+		for (uint32 i = begin; i < end; ++i)
+		{
+			positions[i] = FVector4(positionX[i], positionY[i], positionZ[i], positionW[i]);
+			directions[i] = FVector4(directionX[i], directionY[i], directionZ[i], directionW[i]);
+		}
+	});
+}
+
+// rearrangePositions, but before the neighbour pass instead of after the integration. The boids end the step in the
+// same order, and the boids of every cell are contiguous while we look for neighbours.
+void FCPUBoidSimulation::_rearrange()
+{
+	const uint32 * order = grid.particleIndexBuffer.GetData();
+
+	TArray<float> * arrays[] = {
+		&positionX, &positionY, &positionZ, &positionW,
+		&directionX, &directionY, &directionZ, &directionW,
+		&steeringX, &steeringY, &steeringZ
+	};
+
+	for (TArray<float> * array : arrays)
+	{
+		SwarmCore::gather(numBoids, order, array->GetData(), _scratch.GetData(), FSwarmCoreParallelFor());
+
+		Swap(*array, _scratch);
+	}
+}
+
+static SwarmCore::Vec3 closestPointOnSegment(const SwarmCore::Vec3& p, const SwarmCore::Vec3& a, const SwarmCore::Vec3& b)
+{
+	const SwarmCore::Vec3 ab = b - a;
+	const float t = FMath::Clamp(SwarmCore::dot(p - a, ab) / FMath::Max(SwarmCore::dot(ab, ab), 1e-6f), 0.0f, 1.0f);
+
+	return a + ab * t;
+}
+
+void FCPUBoidSimulation::_applyInfluencers(const FCPUBoidSimulationStep& step)
+{
+	const uint32 numInfluencers = FMath::Min(uint32(FMath::Min(step.influencerPositions.Num(), step.influencerShapes.Num())), influencerGrid.maxItems);
+
+	if (numInfluencers == 0)
+		return;
+
+	influencerGrid.build(numInfluencers, step.influencerCellSize, step.influencerPositions.GetData());
+
+	const SwarmCore::BoidsSoA boids = _boids();
+
+	const uint32 sliceBegin = FMath::Min(step.sliceOffset, numBoids);
+	const uint32 sliceCount = FMath::Min(step.sliceSize, numBoids - sliceBegin);
+
+	SwarmCore::forEachChunk(FSwarmCoreParallelFor(), sliceCount, batchSize, [&](uint32 batchBegin, uint32 batchEnd)
+	{
+		for (uint32 i = sliceBegin + batchBegin; i < sliceBegin + batchEnd; ++i)
+		{
+			const SwarmCore::Vec3 position = boids.position(i);
+			const FIntVector cell = influencerGrid.positionToCellIndex(FVector(position.x, position.y, position.z));
+
+			SwarmCore::Vec3 urge;
+
+			// the influencers in the 27 cells around the boid, like Boid.usf's influencerUrge
+			for (int32 z = -1; z <= 1; ++z)
+			{
+				for (int32 y = -1; y <= 1; ++y)
+				{
+					for (int32 x = -1; x <= 1; ++x)
+					{
+						const uint32 flatCell = influencerGrid.getFlatCellIndex(cell + FIntVector(x, y, z));
+
+						for (uint32 iterator = influencerGrid.cellOffsetBuffer[flatCell]; iterator < numInfluencers; ++iterator)
+						{
+							const uint32 influencer = influencerGrid.particleIndexBuffer[iterator];
+
+							if (influencerGrid.cellIndexBuffer[influencer] != flatCell)
+								break;
+
+							const FVector4& centreRadius = step.influencerPositions[influencer];
+							const FVector4& axisStrength = step.influencerShapes[influencer];
+
+							const SwarmCore::Vec3 centre(centreRadius.X, centreRadius.Y, centreRadius.Z);
+							const SwarmCore::Vec3 axis(axisStrength.X, axisStrength.Y, axisStrength.Z);
+
+							const SwarmCore::Vec3 toward = closestPointOnSegment(position, centre - axis, centre + axis) - position;
+							const float dist = SwarmCore::length(toward);
+
+							if (dist < centreRadius.W && dist > 0.0f)
+								urge += (toward / dist) * (axisStrength.W * (1.0f - dist / centreRadius.W));
+						}
+					}
+				}
+			}
+
+			boids.setSteering(i, boids.steering(i) + SwarmCore::toSimulationPlane(urge, planar2D));
+		}
+	});
+}
+
+void FCPUBoidSimulation::_applyEvents(const FCPUBoidSimulationStep& step, bool applyImpulses)
+{
+	const SwarmCore::BoidsSoA boids = _boids();
+	const float dt = step.dt;
+
+	// a handful of events are live at a time, every boid tests all of them instead of bucketing them like the GPU
+	SwarmCore::forEachChunk(FSwarmCoreParallelFor(), numBoids, batchSize, [&](uint32 begin, uint32 end)
+	{
+		for (uint32 i = begin; i < end; ++i)
+		{
+			const SwarmCore::Vec3 position = boids.position(i);
+
+			SwarmCore::Vec3 dv;
+
+			for (const FBoidImpulseQueue::FEvent& event : _events)
+			{
+				if (event.isImpulse != applyImpulses)
+					continue;
+
+				const SwarmCore::Vec3 away = position - SwarmCore::Vec3(event.centre.X, event.centre.Y, event.centre.Z);
+				const float dist = SwarmCore::length(away);
+
+				if (dist >= event.radius || dist <= 0.0f)
+					continue;
+
+				const float falloff = 1.0f - dist / event.radius;
+
+				// an impulse is a change in velocity, a force field an acceleration
+				dv += (away / dist) * (event.strength * falloff * (event.isImpulse ? 1.0f : dt));
+			}
+
+			if (planar2D)
+				dv.z = 0.0f;
+
+			if (dv.x == 0.0f && dv.y == 0.0f && dv.z == 0.0f)
+				continue;
+
+			const SwarmCore::Vec3 direction = boids.direction(i);
+			const float speed = step.boidSpeed * step.speciesSpeedScale[boids.species(i)];
+
+			const SwarmCore::Vec3 heading = SwarmCore::safeNormal(direction * speed + dv, direction);
+
+			boids.setDirection(i, heading);
+			boids.setPosition(i, position + dv * dt);
+
+			// the kick turns the steering too, a boid outside of the slice would turn straight back otherwise
+			if (applyImpulses)
+				boids.setSteering(i, heading * SwarmCore::length(boids.steering(i)));
+		}
+	});
+}
+
+SwarmCore::BoidsSoA FCPUBoidSimulation::_boids()
+{
+	SwarmCore::BoidsSoA boids;
+	boids.px = positionX.GetData();
+	boids.py = positionY.GetData();
+	boids.pz = positionZ.GetData();
+	boids.pw = positionW.GetData();
+	boids.dx = directionX.GetData();
+	boids.dy = directionY.GetData();
+	boids.dz = directionZ.GetData();
+	boids.dw = directionW.GetData();
+	boids.sx = steeringX.GetData();
+	boids.sy = steeringY.GetData();
+	boids.sz = steeringZ.GetData();
+
+	return boids;
+}
+
+SwarmCore::BoidParameters FCPUBoidSimulation::_parameters(const FCPUBoidSimulationStep& step) const
+{
+	SwarmCore::BoidParameters parameters;
+	parameters.dt = step.dt;
+	parameters.totalTime = step.totalTime;
+	parameters.boidSpeed = step.boidSpeed;
+	parameters.boidSpeedVariation = step.boidSpeedVariation;
+	parameters.boidRotationSpeed = step.boidRotationSpeed;
+	parameters.neighbourhoodDistance = step.neighbourhoodDistance;
+	parameters.separationDistance = step.separationDistance;
+	parameters.homeInnerRadius = step.homeInnerRadius;
+	parameters.homeUrge = step.homeUrge;
+	parameters.separationUrge = step.separationUrge;
+	parameters.cohesionUrge = step.cohesionUrge;
+	parameters.alignmentUrge = step.alignmentUrge;
+	parameters.ruleMask = step.ruleMask;
+	parameters.integrator = step.integrator;
+	parameters.planar2D = planar2D;
+	parameters.sliceOffset = step.sliceOffset;
+	parameters.sliceSize = step.sliceSize;
+	parameters.numSpecies = step.numSpecies;
+
+	for (int32 species = 0; species < maxSpecies; ++species)
+		parameters.speciesSpeedScale[species] = step.speciesSpeedScale[species];
+
+	for (int32 i = 0; i < maxSpecies * maxSpecies; ++i)
+	{
+		const FVector4& interaction = step.speciesInteractions[i];
+
+		parameters.speciesInteractions[i] = SwarmCore::Float4{ interaction.X, interaction.Y, interaction.Z, interaction.W };
+	}
+
+	return parameters;
+}
@@ -0,0 +1,132 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidImpulseQueue.h"
+#include "CPUHashedGrid.h"
+#include "SwarmCore/SwarmCoreBoids.h"
+
+// The uniforms of one CPU simulation step, Boid.usf's parameters
+struct FCPUBoidSimulationStep
+{
+	float dt = 0.0f;
+	float totalTime = 0.0f;
+
+	float boidSpeed = 10.0f;
+	float boidSpeedVariation = 1.0f;
+	float boidRotationSpeed = 10.0f;
+
+	float neighbourhoodDistance = 10.0f;
+	float separationDistance = 3.0f;
+	float homeInnerRadius = 200.0f;
+
+	float homeUrge = 0.1f;
+	float separationUrge = 0.1f;
+	float cohesionUrge = 0.01f;
+	float alignmentUrge = 0.1f;
+
+	float cellSize = 5.0f;
+
+	// A mask of EBoidRule. Of the external rule only the influencers are simulated, the SDF and the fields need the GPU.
+	uint32 ruleMask = 31;
+
+	// Must match EBoidIntegrator
+	uint32 integrator = 0;
+
+	// The boids whose steering is updated this step
+	uint32 sliceOffset = 0;
+	uint32 sliceSize = ~0u;
+
+	int32 numSpecies = 1;
+	FVector4 speciesSpeedScale = FVector4(1.0f, 1.0f, 1.0f, 1.0f);
+
+	// Row-major by the boid's species and then its neighbour's, (separation, alignment, cohesion, pursuit)
+	FVector4 speciesInteractions[4 * 4];
+
+	// Gameplay influencers in simulation space, like FBoidSimulationInputs: centre and radius, half axis and strength
+	TArray<FVector4> influencerPositions;
+	TArray<FVector4> influencerShapes;
+	float influencerCellSize = 200.0f;
+};
+
+// The boid simulation on the CPU, for dedicated servers, headless runs and devices without compute shaders. Each step
+// mirrors the GPU passes: createUnsortedList and the sort (FCPUHashedGrid), rearrangePositions,
+// GridNeighboursBoidUpdate and IntegrateBoidPosition. The boids are held as arrays of components and are rearranged
+// into the grid's order before the neighbour pass, so every neighbour cell is a contiguous range that is tested four
+// boids at a time with vector registers. The rules are SwarmCore's (SwarmCoreBoids.h), split in batches over
+// ParallelFor. Influencers, impulses and force fields are applied around them like Boid.usf's influencerUrge,
+// applyImpulses and the force fields in IntegrateBoidPosition.
+struct UNREALGPUSWARM_API FCPUBoidSimulation
+{
+public:
+	// Copy in the initial boids, positions carry the species in w and directions the boid's id.
+	void init(uint32 numBoids, FIntVector gridDimensions, bool planar2D, const FVector4 * positions, const FVector4 * directions);
+
+	// Size the influencer grid and the impulse ring, like FBoidSimulationProxyInit
+	void initEffects(int32 maxInfluencers, FIntVector influencerGridDimensions, int32 impulseCapacity);
+
+	bool isInitialized() const { return numBoids > 0; }
+
+	void step(const FCPUBoidSimulationStep& step);
+
+	// The boids in their current order, like the GPU's position and direction buffers
+	void copyTo(TArray<FVector4>& positions, TArray<FVector4>& directions) const;
+
+	// Must match MAX_SPECIES in Boid.usf
+	static constexpr int32 maxSpecies = SwarmCore::maxSpecies;
+
+	// The boids per ParallelFor task
+	static constexpr uint32 batchSize = SwarmCore::boidBatchSize;
+
+protected:
+	void _rearrange();
+
+	// influencerUrge, added to the steering of the boids in the step's slice
+	void _applyInfluencers(const FCPUBoidSimulationStep& step);
+
+	// The impulses (applyImpulses) before the integration or the force fields after it
+	void _applyEvents(const FCPUBoidSimulationStep& step, bool impulses);
+
+	SwarmCore::BoidsSoA _boids();
+	SwarmCore::BoidParameters _parameters(const FCPUBoidSimulationStep& step) const;
+
+public:
+	uint32 numBoids = 0;
+
+	// Simulate in the xy plane, like the PLANAR_2D shaders
+	bool planar2D = false;
+
+	FCPUHashedGrid grid;
+
+	// Rows of three cells as one range of boids, fewer and longer ranges than the GPU's 27 cells
+	SwarmCore::NeighbourScan neighbourScan = SwarmCore::NeighbourScan::Ranges;
+
+	// In the grid's order after every step
+	TArray<float> positionX;
+	TArray<float> positionY;
+	TArray<float> positionZ;
+	TArray<float> positionW; // the species
+
+	TArray<float> directionX;
+	TArray<float> directionY;
+	TArray<float> directionZ;
+	TArray<float> directionW; // the boid's id
+
+	// The steering from the last neighbour update
+	TArray<float> steeringX;
+	TArray<float> steeringY;
+	TArray<float> steeringZ;
+
+	// Game thread, add impulses and force fields here in simulation space
+	FBoidImpulseQueue impulses;
+
+	FCPUHashedGrid influencerGrid;
+
+protected:
+	TArray<float> _scratch;
+
+	// The events of the current step
+	TArray<FBoidImpulseQueue::FEvent> _events;
+};
@@ -0,0 +1,118 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "CPUGridBenchmarkCommandlet.h"
+
+#include "CPUHashedGrid.h"
+#include "GPUSpatialIndexBenchmark.h"
+
+UCPUGridBenchmarkCommandlet::UCPUGridBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UCPUGridBenchmarkCommandlet::Main(const FString& params)
+{
+	int32 numItems = 1 << 20;
+	int32 repetitions = 10;
+	float extent = 4000.0f;
+	float cellSize = 40.0f;
+
+	FParse::Value(*params, TEXT("items="), numItems);
+	FParse::Value(*params, TEXT("repetitions="), repetitions);
+	FParse::Value(*params, TEXT("extent="), extent);
+	FParse::Value(*params, TEXT("cellSize="), cellSize);
+
+	numItems = FMath::Max(numItems, 1);
+	repetitions = FMath::Max(repetitions, 1);
+
+	FCPUHashedGrid grid;
+	grid.init(numItems, FIntVector(128, 128, 64));
+
+	FRandomStream random(1337);
+
+	bool valid = true;
+
+	const TCHAR * distributions[] = { TEXT("uniform"), TEXT("clustered") };
+
+	for (const TCHAR * distribution : distributions)
+	{
+		TArray<FVector4> positions;
+
+		if (FCString::Strcmp(distribution, TEXT("uniform")) == 0)
+			FGPUSpatialIndexBenchmark::uniformPositions(numItems, extent, random, positions);
+		else
+			FGPUSpatialIndexBenchmark::clusteredPositions(numItems, extent, random, positions);
+
+		// the grid build
+		double start = FPlatformTime::Seconds();
+
+		for (int32 r = 0; r < repetitions; ++r)
+			grid.build(numItems, cellSize, positions.GetData());
+
+		const double buildSeconds = (FPlatformTime::Seconds() - start) / repetitions;
+
+		// the radix sort on its own
+		TArray<uint32> keys, values, keysScratch, valuesScratch;
+		double radixSeconds = 0.0;
+
+		for (int32 r = 0; r < repetitions; ++r)
+		{
+			keys = grid.cellIndexBuffer;
+			values.SetNumUninitialized(numItems);
+
+			for (int32 i = 0; i < numItems; ++i)
+				values[i] = i;
+
+			start = FPlatformTime::Seconds();
+
+			FCPURadixSort::sortKeyValues(numItems, FMath::CeilLogTwo(grid.cellOffsetBufferSize()), keys, values, keysScratch, valuesScratch);
+
+			radixSeconds += FPlatformTime::Seconds() - start;
+		}
+
+		radixSeconds /= repetitions;
+
+		// the reference, a stable comparison sort
+		TArray<uint32> reference;
+		reference.SetNumUninitialized(numItems);
+
+		for (int32 i = 0; i < numItems; ++i)
+			reference[i] = i;
+
+		start = FPlatformTime::Seconds();
+
+		const TArray<uint32>& cells = grid.cellIndexBuffer;
+		reference.StableSort([&cells](uint32 a, uint32 b) { return cells[a] < cells[b]; });
+
+		const double referenceSeconds = FPlatformTime::Seconds() - start;
+
+		bool matches = reference == grid.particleIndexBuffer;
+
+		// every cell's offset is its first particle
+		for (int32 i = 0; i < numItems && matches; ++i)
+		{
+			const uint32 cell = cells[grid.particleIndexBuffer[i]];
+
+			if (i == 0 || cells[grid.particleIndexBuffer[i - 1]] != cell)
+				matches = grid.cellOffsetBuffer[cell] == uint32(i);
+		}
+
+		valid &= matches;
+
+		UE_LOG(LogTemp, Display, TEXT("CPU grid, %s, %d items: build %.3f ms (%.1f Mitems/s), radix sort %.3f ms (%.1f Mitems/s), stable comparison sort %.3f ms, %s"),
+			distribution,
+			numItems,
+			buildSeconds * 1000.0,
+			numItems / buildSeconds * 1e-6,
+			radixSeconds * 1000.0,
+			numItems / radixSeconds * 1e-6,
+			referenceSeconds * 1000.0,
+			matches ? TEXT("matches the reference") : TEXT("DOES NOT MATCH the reference")
+		);
+	}
+
+	return valid ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+
+#include "CPUGridBenchmarkCommandlet.generated.h"
+
+// Times the CPU hashed grid build and its radix sort on uniform and clustered positions, and checks them against a
+// reference built with a stable comparison sort. Headless, no RHI needed:
+//
+//     UE4Editor-Cmd UnrealGPUSwarm.uproject -run=CPUGridBenchmark -nullrhi [-items=1048576] [-repetitions=10]
+UCLASS()
+class UCPUGridBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UCPUGridBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& params) override;
+};
@@ -0,0 +1,114 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "CPUHashedGrid.h"
+
+void FCPURadixSort::sortKeyValues(
+	uint32 numItems,
+	uint32 keyBits,
+	TArray<uint32>& keys,
+	TArray<uint32>& values,
+	TArray<uint32>& keysScratch,
+	TArray<uint32>& valuesScratch)
+{
+	check(uint32(keys.Num()) >= numItems && uint32(values.Num()) >= numItems);
+
+	if (numItems <= 1)
+		return;
+
+	if (uint32(keysScratch.Num()) < numItems)
+		keysScratch.SetNumUninitialized(numItems);
+
+	if (uint32(valuesScratch.Num()) < numItems)
+		valuesScratch.SetNumUninitialized(numItems);
+
+	SwarmCore::RadixSort::sortKeyValues(numItems, keyBits, keys.GetData(), values.GetData(), keysScratch.GetData(), valuesScratch.GetData(), FSwarmCoreParallelFor());
+}
+
+void FCPUHashedGrid::init(uint32 maxItems_in, FIntVector dimensions)
+{
+	maxItems = FMath::Max(maxItems_in, 1u);
+	gridDimensions = dimensions;
+
+	particleIndexBuffer.SetNumZeroed(maxItems);
+	cellIndexBuffer.SetNumZeroed(maxItems);
+	cellOffsetBuffer.Init(emptyCell, cellOffsetBufferSize());
+	cellEnds.SetNumZeroed(maxItems);
+
+	_sortKeys.SetNumZeroed(maxItems);
+	_keysScratch.SetNumUninitialized(maxItems);
+	_valuesScratch.SetNumUninitialized(maxItems);
+}
+
+SwarmCore::GridShape FCPUHashedGrid::shape() const
+{
+	SwarmCore::GridShape result;
+	result.dimensions[0] = gridDimensions.X;
+	result.dimensions[1] = gridDimensions.Y;
+	result.dimensions[2] = gridDimensions.Z;
+	result.cellSize = cellSize;
+	result.planar2D = planar2D;
+
+	return result;
+}
+
+FIntVector FCPUHashedGrid::positionToCellIndex(const FVector& position) const
+{
+	int32_t cell[3];
+	shape().cellOf(position.X, position.Y, position.Z, cell);
+
+	return FIntVector(cell[0], cell[1], cell[2]);
+}
+
+uint32 FCPUHashedGrid::getFlatCellIndex(const FIntVector& cellIndex) const
+{
+	// HashedGrid.usf wraps with a float modulo, this is the exact integer modulo it approximates. They agree while the
+	// unwrapped index fits in a float's 24 bits of mantissa.
+	return shape().flatIndex(cellIndex.X, cellIndex.Y, cellIndex.Z);
+}
+
+void FCPUHashedGrid::build(uint32 numItems_in, float cellSize_in, const FVector4 * positions)
+{
+	check(numItems_in <= maxItems);
+
+	numItems = numItems_in;
+	cellSize = cellSize_in;
+
+	SwarmCore::PositionStream stream;
+	stream.x = &positions[0].X;
+	stream.y = &positions[0].Y;
+	stream.z = &positions[0].Z;
+	stream.stride = 4;
+
+	// createUnsortedList
+	SwarmCore::assignCells(shape(), numItems, stream, cellIndexBuffer.GetData(), _sortKeys.GetData(), particleIndexBuffer.GetData(), FSwarmCoreParallelFor());
+
+	_sortAndBuildOffsets();
+}
+
+void FCPUHashedGrid::build(uint32 numItems_in, float cellSize_in, const float * x, const float * y, const float * z)
+{
+	check(numItems_in <= maxItems);
+
+	numItems = numItems_in;
+	cellSize = cellSize_in;
+
+	SwarmCore::PositionStream stream;
+	stream.x = x;
+	stream.y = y;
+	stream.z = z;
+
+	// createUnsortedList
+	SwarmCore::assignCells(shape(), numItems, stream, cellIndexBuffer.GetData(), _sortKeys.GetData(), particleIndexBuffer.GetData(), FSwarmCoreParallelFor());
+
+	_sortAndBuildOffsets();
+}
+
+void FCPUHashedGrid::_sortAndBuildOffsets()
+{
+	const uint32 numCells = cellOffsetBufferSize();
+
+	SwarmCore::sortCells(SwarmCore::GridSort::Radix, numItems, numCells, _sortKeys.GetData(), particleIndexBuffer.GetData(), _keysScratch.GetData(), _valuesScratch.GetData(), _sortScratch, FSwarmCoreParallelFor());
+
+	// resetCellOffsetBuffer and createOffsetList
+	SwarmCore::buildCellOffsets(numItems, _sortKeys.GetData(), numCells, cellOffsetBuffer.GetData(), cellEnds.GetData(), FSwarmCoreParallelFor());
+}
@@ -0,0 +1,98 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/ParallelFor.h"
+
+#include "SwarmCore/SwarmCoreGrid.h"
+
+// SwarmCore's parallel-for over the task graph
+struct FSwarmCoreParallelFor
+{
+	template<typename Body>
+	void operator()(uint32_t count, const Body& body) const
+	{
+		ParallelFor(int32(count), [&body](int32 i) { body(uint32_t(i)); });
+	}
+};
+
+// SwarmCore::RadixSort over TArrays, a multithreaded, stable LSD radix sort of (key, value) pairs, 8 bits per pass.
+// Only the passes that keyBits needs are run.
+struct UNREALGPUSWARM_API FCPURadixSort
+{
+public:
+	// Sort the first numItems keys and values by the low keyBits bits of the keys. The scratch arrays are grown as
+	// needed, keep them around to avoid reallocating every sort.
+	static void sortKeyValues(
+		uint32 numItems,
+		uint32 keyBits,
+		TArray<uint32>& keys,
+		TArray<uint32>& values,
+		TArray<uint32>& keysScratch,
+		TArray<uint32>& valuesScratch
+	);
+
+	static constexpr uint32 radixBits = SwarmCore::RadixSort::radixBits;
+	static constexpr uint32 chunkSize = SwarmCore::RadixSort::chunkSize;
+};
+
+// The CPU twin of FGPUHashedGrid, for CPU simulation and validation. It bins the same positions into the same cells
+// as HashedGrid.usf and produces the same particleIndexBuffer, cellIndexBuffer and cellOffsetBuffer. Equal cells keep
+// their particle order, like the GPU sorts do. The binning, sort and offsets are SwarmCore's.
+struct UNREALGPUSWARM_API FCPUHashedGrid
+{
+public:
+	void init(uint32 maxItems, FIntVector dimensions);
+
+	// Bin the first numItems positions into cells of cellSize, sort particleIndexBuffer by cell and build the cell
+	// offsets.
+	void build(uint32 numItems, float cellSize, const FVector4 * positions);
+
+	// The same, from positions held as three arrays
+	void build(uint32 numItems, float cellSize, const float * x, const float * y, const float * z);
+
+	uint32 cellOffsetBufferSize() const { return gridDimensions.X * gridDimensions.Y * gridDimensions.Z; }
+
+	// HashedGrid.usf's positionToCellIndex and getFlatCellIndex
+	FIntVector positionToCellIndex(const FVector& position) const;
+
+	uint32 getFlatCellIndex(const FIntVector& cellIndex) const;
+
+	// The grid as SwarmCore sees it, for queries against the buffers
+	SwarmCore::GridShape shape() const;
+
+	static constexpr uint32 emptyCell = SwarmCore::emptyCell;
+
+public:
+	uint32 maxItems = 0;
+	uint32 numItems = 0;
+
+	FIntVector gridDimensions = FIntVector(0, 0, 0);
+	float cellSize = 1.0f;
+
+	// Hash on xy only, like the PLANAR_2D shaders
+	bool planar2D = false;
+
+	// Sorted by cell, the particle indices
+	TArray<uint32> particleIndexBuffer;
+
+	// Per particle, its flat cell index
+	TArray<uint32> cellIndexBuffer;
+
+	// Per cell, the first index in particleIndexBuffer, or emptyCell
+	TArray<uint32> cellOffsetBuffer;
+
+	// At the first index of every cell's run in particleIndexBuffer, the end of the run
+	TArray<uint32> cellEnds;
+
+protected:
+	// Sort the particles by the cells in cellIndexBuffer and build the cell offsets
+	void _sortAndBuildOffsets();
+
+protected:
+	TArray<uint32> _sortKeys;
+	TArray<uint32> _keysScratch;
+	TArray<uint32> _valuesScratch;
+	SwarmCore::SortScratch _sortScratch;
+};
@@ -3,17 +3,16 @@
 
 #include "ComputeShaderTestComponent.h"
 
-#include "ShaderParameterUtils.h"
-#include "RHIStaticStates.h"
-#include "Shader.h"
-#include "GlobalShader.h"
-#include "RenderGraphBuilder.h"
-#include "RenderGraphUtils.h"
-#include "ShaderParameterStruct.h"
-#include "UniformBuffer.h"
+#include "BoidSimulationViewExtension.h"
+
 #include "RHICommandList.h"
 
-#include "GPUBitonicSort.h"
+#include "GPUSpatialIndexBenchmark.h"
+#include "BoidSDFBaker.h"
+#include "BoidNavField.h"
+
+#include "Engine/Texture2D.h"
+#include "Components/SceneComponent.h"
 
 
 // Some useful links
@@ -23,590 +22,685 @@
 // [Useful tutorial on Unreal compute shaders](https://github.com/Temaran/UE4ShaderPluginDemo)
 
 
-class FBoidsComputeShader : public FGlobalShader
+// Sets default values for this component's properties
+UComputeShaderTestComponent::UComputeShaderTestComponent() 
 {
-public:
-	DECLARE_GLOBAL_SHADER(FBoidsComputeShader);
-	SHADER_USE_PARAMETER_STRUCT(FBoidsComputeShader, FGlobalShader);
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(float, dt)
-		SHADER_PARAMETER(float, totalTime)
-		SHADER_PARAMETER(float, boidSpeed)
-		SHADER_PARAMETER(float, boidSpeedVariation)
-		SHADER_PARAMETER(float, boidRotationSpeed)
-		SHADER_PARAMETER(float, homeInnerRadius)
-		SHADER_PARAMETER(float, separationDistance)
-		SHADER_PARAMETER(float, neighbourhoodDistance)
-
-		SHADER_PARAMETER(float, homeUrge)
-		SHADER_PARAMETER(float, separationUrge)
-		SHADER_PARAMETER(float, cohesionUrge)
-		SHADER_PARAMETER(float, alignmentUrge)
-
-
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float3>, newDirections)
-
-
-		SHADER_PARAMETER(uint32, numParticles)
-		SHADER_PARAMETER(float, cellSizeReciprocal)
-		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
-		SHADER_PARAMETER(FIntVector, gridDimensions)
-
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
-		
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
+	// off to improve performance if you don't need them.
+	PrimaryComponentTick.bCanEverTick = true;
+
+	// ...
+}
+
+static FVector unitVectorInSphere(FRandomStream& r)
+{
+	FVector s;
+	float dSqrd = 1.0f;
+
+	do 
 	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
-	}
-};
+		s.X = r.GetFraction() * 2.f - 1.f;
+		s.Y = r.GetFraction() * 2.f - 1.f;
+		s.Z = r.GetFraction() * 2.f - 1.f;
 
-IMPLEMENT_GLOBAL_SHADER(FBoidsComputeShader, "/ComputeShaderPlugin/Boid.usf", "GridNeighboursBoidUpdate", SF_Compute);
+		dSqrd = s.SizeSquared();
+	} while (dSqrd > 1.0f);
 
+	return s;
+}
 
-class FBoids_integratePosition_CS : public FGlobalShader
+// Called when the game starts
+void UComputeShaderTestComponent::BeginPlay()
 {
-public:
-	DECLARE_GLOBAL_SHADER(FBoids_integratePosition_CS);
-	SHADER_USE_PARAMETER_STRUCT(FBoids_integratePosition_CS, FGlobalShader);
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(float, dt)
-		SHADER_PARAMETER(float, totalTime)
-		SHADER_PARAMETER(float, boidSpeed)
-		SHADER_PARAMETER(float, boidSpeedVariation)
-		SHADER_PARAMETER(float, boidRotationSpeed)
-		SHADER_PARAMETER(uint32, numParticles)
-
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float3>, newDirections)
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	Super::BeginPlay();
+
+	FRandomStream rng(randomSeed);
+
+	// spawn positions
+	TResourceArray<FVector4> spawnPositions;
 	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+		const FVector4 zero(0.0f);
+		spawnPositions.Init(zero, numBoids);
+
+
+
+		// the species are spawned in proportion to their spawn weights
+		const int32 numSpecies = speciesCount();
+
+		float totalWeight = 0.0f;
+		for (int32 i = 0; i < numSpecies; ++i)
+			totalWeight += species.IsValidIndex(i) ? FMath::Max(species[i].spawnWeight, 0.0f) : 1.0f;
+
+		for (FVector4& position : spawnPositions)
+		{
+			position = unitVectorInSphere(rng) * spawnRadius;
+
+			if (planar2D)
+				position.Z = heightOffset;
+
+			float pick = rng.GetFraction() * totalWeight;
+			int32 speciesIndex = 0;
+
+			for (; speciesIndex < numSpecies - 1; ++speciesIndex)
+			{
+				pick -= species.IsValidIndex(speciesIndex) ? FMath::Max(species[speciesIndex].spawnWeight, 0.0f) : 1.0f;
+
+				if (pick < 0.0f)
+					break;
+			}
+
+			// the species lives in w, it also ends up in the instance origin's w (PerInstanceRandom in materials)
+			position.W = float(speciesIndex);
+		}
 	}
-};
 
-IMPLEMENT_GLOBAL_SHADER(FBoids_integratePosition_CS, "/ComputeShaderPlugin/Boid.usf", "IntegrateBoidPosition", SF_Compute);
+	// spawn directions
+	TResourceArray<FVector4> spawnDirections;
+	{
+		const FVector4 zero(0.0f);
 
+		spawnDirections.Init(zero, numBoids);
 
 
+		for (int32 i = 0; i < numBoids; ++i)
+		{
+			FVector direction = rng.GetUnitVector();
 
+			if (planar2D)
+				direction = FVector(direction.X, direction.Y, 0.0f).GetSafeNormal(SMALL_NUMBER, FVector::ForwardVector);
 
+			// w is the boid's stable id, it moves with the boid when we rearrange (exact up to 2^24 boids)
+			spawnDirections[i] = FVector4(direction, float(i));
+		}
+	}
 
-class FBoids_rearrangePositions_CS : public FGlobalShader
-{
-public:
-	DECLARE_GLOBAL_SHADER(FBoids_rearrangePositions_CS);
-	SHADER_USE_PARAMETER_STRUCT(FBoids_rearrangePositions_CS, FGlobalShader);
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(uint32, numParticles)
-
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions_other)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions_other)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float3>, particleIndexBuffer)
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	// the CPU backend needs none of the GPU resources
+	if (simulationBackend == ESimulationBackend::CPU)
 	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+		_cpuSimulation.init(numBoids, gridDimensions, planar2D, spawnPositions.GetData(), spawnDirections.GetData());
+		_cpuSimulation.initEffects(maxInfluencers, influencerGridDimensions, maxImpulses);
+		_cpuSimulation.copyTo(outputPositions, outputDirections);
+
+		return;
 	}
-};
 
-IMPLEMENT_GLOBAL_SHADER(FBoids_rearrangePositions_CS, "/ComputeShaderPlugin/Boid.usf", "rearrangePositions", SF_Compute);
+	// the GPU backend's buffers are created and owned by the render thread
+	_simulationProxy = MakeShared<FBoidSimulationProxy, ESPMode::ThreadSafe>();
 
+	FBoidSimulationProxyInit init;
+	init.scene = GetWorld()->Scene;
+	init.numBoids = numBoids;
+	// a 2D key for planar swarms, the offset buffer is only X * Y
+	init.gridDimensions = planar2D ? FIntVector(gridDimensions.X, gridDimensions.Y, 1) : gridDimensions;
+	init.planar2D = planar2D;
+	init.useLBVH = spatialIndex == ESpatialIndex::LBVH;
+	init.maxInfluencers = maxInfluencers;
+	init.influencerGridDimensions = influencerGridDimensions;
 
+	// obstacle avoidance volume
+	_hasSDF = sdfBakedResolution.X > 0 && sdfBakedResolution.Y > 0 && sdfBakedResolution.Z > 0
+		&& sdfDistances.Num() == sdfBakedResolution.X * sdfBakedResolution.Y * sdfBakedResolution.Z;
 
+	if (_hasSDF)
+	{
+		init.sdfDistances = sdfDistances;
+		init.sdfResolution = sdfBakedResolution;
+		init.sdfBounds = sdfBakedBounds;
+	}
 
+	// impulses and force fields
+	init.impulseCapacity = maxImpulses;
+	init.impulseBucketCount = impulseBucketCount;
 
+	// navigation field, on the SDF's grid so that the SDF can block voxels
+	init.useNavField = useNavField;
+	init.navResolution = _hasSDF ? sdfBakedResolution : sdfResolution;
+	init.navBounds = _hasSDF ? sdfBakedBounds : sdfBounds;
 
+	init.positions = MoveTemp(spawnPositions);
+	init.directions = MoveTemp(spawnDirections);
 
+	// from here on the render thread steps the simulation, once a frame
+	ENQUEUE_RENDER_COMMAND(FInitBoidSimulation)(
+	[proxy = _simulationProxy, init = MoveTemp(init), extension = FBoidSimulationViewExtension::get()](FRHICommandListImmediate& RHICommands) mutable
+	{
+		proxy->init(init);
 
+		extension->addProxy(proxy);
+	});
 
+	markParametersDirty();
 
+	if (outputPositions.Num() != numBoids)
+	{
+		const FVector zero(0.0f);
+		outputPositions.Init(zero, numBoids);
+	}
 
+	if (outputDirections.Num() != numBoids)
+	{
+		const FVector zero(0.0f);
+		outputDirections.Init(zero, numBoids);
+	}
+}
 
-class FHashedGrid_createUnsortedList_CS : public FGlobalShader
+void UComputeShaderTestComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
-public:
-	DECLARE_GLOBAL_SHADER(FHashedGrid_createUnsortedList_CS);
-	SHADER_USE_PARAMETER_STRUCT(FHashedGrid_createUnsortedList_CS, FGlobalShader);
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(uint32, numParticles)
-		SHADER_PARAMETER(float, cellSizeReciprocal)
-		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
-		SHADER_PARAMETER(FIntVector, gridDimensions)
-
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	// the render thread lets go of the proxy after any update still in flight
+	if (_simulationProxy.IsValid())
 	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+		ENQUEUE_RENDER_COMMAND(FReleaseBoidSimulation)(
+		[proxy = MoveTemp(_simulationProxy), extension = FBoidSimulationViewExtension::get()](FRHICommandListImmediate& RHICommands) mutable
+		{
+			extension->removeProxy(proxy);
+
+			proxy.Reset();
+		});
 	}
-};
 
-IMPLEMENT_GLOBAL_SHADER(FHashedGrid_createUnsortedList_CS, "/ComputeShaderPlugin/HashedGrid.usf", "createUnsortedList", SF_Compute);
+	_pendingEvents.Empty();
 
+	Super::EndPlay(EndPlayReason);
+}
 
+uint32 UComputeShaderTestComponent::activeRuleMask() const
+{
+	uint32 mask = 0;
 
+	if (separationUrge != 0.0f) mask |= EBoidRule::Separation;
+	if (alignmentUrge != 0.0f) mask |= EBoidRule::Alignment;
+	if (cohesionUrge != 0.0f) mask |= EBoidRule::Cohesion;
+	if (homeUrge != 0.0f) mask |= EBoidRule::Home;
 
-class FHashedGrid_createOffsetList_CS : public FGlobalShader
-{
-public:
-	DECLARE_GLOBAL_SHADER(FHashedGrid_createOffsetList_CS);
-	SHADER_USE_PARAMETER_STRUCT(FHashedGrid_createOffsetList_CS, FGlobalShader);
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(uint32, numParticles)
-		SHADER_PARAMETER(float, cellSizeReciprocal)
-		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
-		SHADER_PARAMETER(FIntVector, gridDimensions)
-
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
-	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
-	}
-};
+	const bool external = influencers.Num() > 0
+		|| (_hasSDF && sdfAvoidanceUrge != 0.0f)
+		|| (flowField && flowUrge != 0.0f)
+		|| (useNavField && navUrge != 0.0f);
+
+	if (external) mask |= EBoidRule::External;
+
+	return mask;
+}
 
-IMPLEMENT_GLOBAL_SHADER(FHashedGrid_createOffsetList_CS, "/ComputeShaderPlugin/HashedGrid.usf", "createOffsetList", SF_Compute);
+int32 UComputeShaderTestComponent::speciesCount() const
+{
+	return FMath::Clamp(species.Num(), 1, maxSpecies);
+}
 
-class FHashedGrid_resetCellOffsetBuffer_CS : public FGlobalShader
+void UComputeShaderTestComponent::_speciesParameters(FVector4& speedScale, FVector4 interactions[maxSpecies * maxSpecies]) const
 {
-public:
-	DECLARE_GLOBAL_SHADER(FHashedGrid_resetCellOffsetBuffer_CS);
-	SHADER_USE_PARAMETER_STRUCT(FHashedGrid_resetCellOffsetBuffer_CS, FGlobalShader);
+	const int32 numSpecies = speciesCount();
+
+	speedScale = FVector4(1.0f, 1.0f, 1.0f, 1.0f);
 
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
-	END_SHADER_PARAMETER_STRUCT()
+	for (int32 i = 0; i < numSpecies; ++i)
+		speedScale[i] = species.IsValidIndex(i) ? species[i].speedScale : 1.0f;
 
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	const FBoidSpeciesInteraction defaultInteraction;
+
+	for (int32 a = 0; a < maxSpecies; ++a)
 	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+		for (int32 b = 0; b < maxSpecies; ++b)
+		{
+			const int32 i = a * numSpecies + b;
+
+			const FBoidSpeciesInteraction& interaction = (a < numSpecies && b < numSpecies && speciesInteractions.IsValidIndex(i)) ? speciesInteractions[i] : defaultInteraction;
+
+			interactions[a * maxSpecies + b] = FVector4(
+				interaction.separationScale,
+				interaction.alignmentScale,
+				interaction.cohesionScale,
+				interaction.pursuitUrge
+			);
+		}
 	}
-};
+}
 
-IMPLEMENT_GLOBAL_SHADER(FHashedGrid_resetCellOffsetBuffer_CS, "/ComputeShaderPlugin/HashedGrid.usf", "resetCellOffsetBuffer", SF_Compute);
+void UComputeShaderTestComponent::bakeSDF()
+{
+	AActor * owner = GetOwner();
 
+	if (!owner)
+		return;
 
+	TArray<FVector> vertices;
+	TArray<int32> indices;
 
+	FBoidSDFBaker::gatherStaticGeometry(GetWorld(), sdfBounds, owner->GetActorTransform().Inverse(), vertices, indices, owner);
 
+	const FIntVector resolution(FMath::Max(sdfResolution.X, 2), FMath::Max(sdfResolution.Y, 2), FMath::Max(sdfResolution.Z, 2));
 
+	FBoidSDFBaker::bake(vertices, indices, sdfBounds, resolution, sdfDistances);
 
-// Sets default values for this component's properties
-UComputeShaderTestComponent::UComputeShaderTestComponent() 
+	sdfBakedBounds = sdfBounds;
+	sdfBakedResolution = resolution;
+
+	UE_LOG(LogTemp, Log, TEXT("UComputeShaderTestComponent: baked %d triangles into a %dx%dx%d SDF."), indices.Num() / 3, resolution.X, resolution.Y, resolution.Z);
+
+	MarkPackageDirty();
+}
+
+void UComputeShaderTestComponent::validateNavField()
 {
-	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
-	// off to improve performance if you don't need them.
-	PrimaryComponentTick.bCanEverTick = true;
+	if (!_simulationProxy.IsValid() || !useNavField)
+		return;
 
-	// ...
+	TArray<uint8> blocked;
+
+	if (_hasSDF)
+		FBoidNavField::blockedFromSDF(sdfDistances, navAgentRadius, blocked);
+
+	ENQUEUE_RENDER_COMMAND(FValidateNavField)(
+	[proxy = _simulationProxy, blocked](FRHICommandListImmediate& RHICommands)
+	{
+		proxy->validateNavField(blocked);
+	});
 }
 
-static FVector unitVectorInSphere(FRandomStream& r)
+void UComputeShaderTestComponent::benchmarkSpatialIndices()
 {
-	FVector s;
-	float dSqrd = 1.0f;
+	const uint32 numItems = FMath::Max(numBoids, 1);
+	const float extent = lbvhBounds.GetSize().GetMax();
+	const float radius = neighbourDistance;
 
-	do 
+	ENQUEUE_RENDER_COMMAND(FBenchmarkSpatialIndices)(
+	[numItems, extent, radius](FRHICommandListImmediate& RHICommands)
 	{
-		s.X = r.GetFraction() * 2.f - 1.f;
-		s.Y = r.GetFraction() * 2.f - 1.f;
-		s.Z = r.GetFraction() * 2.f - 1.f;
+		TArray<FGPUSpatialIndexBenchmark::FResult> results;
+		FGPUSpatialIndexBenchmark::run(numItems, extent, radius, 10, RHICommands, results);
 
-		dSqrd = s.SizeSquared();
-	} while (dSqrd > 1.0f);
+		for (const FGPUSpatialIndexBenchmark::FResult& result : results)
+		{
+			UE_LOG(LogTemp, Log, TEXT("UComputeShaderTestComponent: %s %s, %d items, build %.3f ms, query %.3f ms, %llu neighbours."),
+				*result.index, *result.distribution, numItems, result.buildMilliseconds, result.queryMilliseconds, result.neighbourCount);
+		}
+	});
+}
 
-	return s;
+void UComputeShaderTestComponent::addImpulse(FVector location, float radius, float strength)
+{
+	FBoidImpulseQueue::FEvent event;
+	event.strength = strength;
+	event.isImpulse = true;
+
+	_addEvent(event, location, radius);
 }
 
-// Called when the game starts
-void UComputeShaderTestComponent::BeginPlay()
+void UComputeShaderTestComponent::addForceField(FVector location, float radius, float strength, float duration)
 {
-	Super::BeginPlay();
+	FBoidImpulseQueue::FEvent event;
+	event.strength = strength;
+	event.timeRemaining = duration;
 
-    FRHICommandListImmediate& RHICommands = GRHICommandList.GetImmediateCommandList();
+	_addEvent(event, location, radius);
+}
+
+void UComputeShaderTestComponent::_addEvent(FBoidImpulseQueue::FEvent event, const FVector& location, float radius)
+{
+	const FTransform& simulationTransform = GetOwner()->GetActorTransform();
 
-	FRandomStream rng;
+	event.centre = simulationTransform.InverseTransformPosition(location);
+	event.radius = radius / simulationTransform.GetMaximumAxisScale();
 
-	// positions
+	// the CPU backend steps on the game thread, it takes the event directly
+	if (_cpuSimulation.isInitialized())
 	{
-		TResourceArray<FVector4> resourceArray;
-		const FVector4 zero(0.0f);
-		resourceArray.Init(zero, numBoids);
+		if (event.isImpulse)
+			_cpuSimulation.impulses.addImpulse(event.centre, event.radius, event.strength);
+		else
+			_cpuSimulation.impulses.addForceField(event.centre, event.radius, event.strength, event.timeRemaining);
 
+		return;
+	}
 
+	if (!_simulationProxy.IsValid())
+		return;
 
-		for (FVector4& position : resourceArray)
-		{
-			position = unitVectorInSphere(rng) * spawnRadius;
-		}
+	_pendingEvents.Add(event);
 
-		FRHIResourceCreateInfo createInfo;
-		createInfo.ResourceArray = &resourceArray;
+	markParametersDirty();
+}
 
-		const size_t size = sizeof(FVector4);
+void UComputeShaderTestComponent::setInfluencers(const TArray<FBoidInfluencer>& newInfluencers)
+{
+	influencers = newInfluencers;
 
-		for( int i = 0; i < 2; ++i )
-		{
-			_positionBuffer[i] = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
-			_positionBufferUAV[i] = RHICreateUnorderedAccessView(_positionBuffer[i], false, false);
-            
-            // On platforms, like iOS, the resource array is discarded during RHICreateStructuredBuffer. Kill it. We only need one
-            // for the first positionBuffer[0].
-            createInfo.ResourceArray = nullptr; 
-		}
-	}
-    
-	// directions
-	{
-		TResourceArray<FVector4> resourceArray;
-		const FVector4 zero(0.0f);
+	markParametersDirty();
+}
 
-		resourceArray.Init(zero, numBoids);
+void UComputeShaderTestComponent::setRuleUrges(float newSeparationUrge, float newAlignmentUrge, float newCohesionUrge, float newHomeUrge)
+{
+	separationUrge = newSeparationUrge;
+	alignmentUrge = newAlignmentUrge;
+	cohesionUrge = newCohesionUrge;
+	homeUrge = newHomeUrge;
 
+	markParametersDirty();
+}
 
-		for (FVector4& position : resourceArray)
-		{
-			position = rng.GetUnitVector();
-		}
+void UComputeShaderTestComponent::setBoidSpeed(float newBoidSpeed, float newBoidSpeedVariation, float newBoidRotationSpeed)
+{
+	boidSpeed = newBoidSpeed;
+	boidSpeedVariation = newBoidSpeedVariation;
+	boidRotationSpeed = newBoidRotationSpeed;
 
-		FRHIResourceCreateInfo createInfo;
-		createInfo.ResourceArray = &resourceArray;
+	markParametersDirty();
+}
 
-		const size_t size = sizeof(FVector4);
+void UComputeShaderTestComponent::setSpecies(const TArray<FBoidSpecies>& newSpecies, const TArray<FBoidSpeciesInteraction>& newSpeciesInteractions)
+{
+	species = newSpecies;
+	speciesInteractions = newSpeciesInteractions;
 
-		for( int i = 0; i < 2; ++i )
-		{
-			_directionsBuffer[i] = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
-			_directionsBufferUAV[i] = RHICreateUnorderedAccessView(_directionsBuffer[i], false, false);
-            
-            // only platforms, like iOS, the resource array is discarded during RHICreateStructuredBuffer. Kill it. We only need one.
-            createInfo.ResourceArray = nullptr;
-		}
+	markParametersDirty();
+}
 
+void UComputeShaderTestComponent::setFlowField(UBoidFlowField * newFlowField, float newFlowUrge)
+{
+	flowField = newFlowField;
+	flowUrge = newFlowUrge;
 
-		_newDirectionsBuffer = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
-		_newDirectionsBufferUAV = RHICreateUnorderedAccessView(_newDirectionsBuffer, false, false);
-	}
+	// copy the asset again, even if it's the same one it may have been edited
+	_flowFieldDataSource.Reset();
 
-	// particleIndexBuffer
-	{
-		TResourceArray<uint32_t> resourceArray;
-		resourceArray.Init(0, numBoids);
+	markParametersDirty();
+}
 
-		for( int i = 0; i < numBoids; ++i )
-			resourceArray[i] = i;
+void UComputeShaderTestComponent::setNavGoal(FVector newNavGoal)
+{
+	navGoal = newNavGoal;
+
+	markParametersDirty();
+}
 
-		FRHIResourceCreateInfo createInfo;
-		createInfo.ResourceArray = &resourceArray;
+void UComputeShaderTestComponent::markParametersDirty()
+{
+	_parametersDirty = true;
+}
 
-		const size_t size = sizeof(uint32_t);
+#if WITH_EDITOR
+void UComputeShaderTestComponent::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
 
-		_particleIndexBuffer = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
-		_particleIndexBufferUAV = RHICreateUnorderedAccessView(_particleIndexBuffer, false, false);
-	}
+	markParametersDirty();
+}
+#endif
 
-	// cellIndexBuffer
+// Called every frame
+void UComputeShaderTestComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	// the render thread steps the GPU backend, we only push what changed
+	if (_simulationProxy.IsValid())
 	{
-		TResourceArray<uint32_t> resourceArray;
-		resourceArray.Init(0, numBoids);
+		_pushParameters();
+
+		return;
+	}
 
-		FRHIResourceCreateInfo createInfo;
-		createInfo.ResourceArray = &resourceArray;
+	// work out how many simulation steps to take this frame
+	int numSteps = 1;
+	float dt = FMath::Min(1.0f / 60.0f, DeltaTime);
+	float totalTime = GetOwner()->GetWorld()->TimeSeconds;
+
+	if (deterministic)
+	{
+		// one step per tick, independent of the frame time
+		dt = 1.0f / FMath::Max(simulationRate, 1.0f);
 
-		const size_t size = sizeof(uint32_t);
+		interpolationAlpha = 1.0f;
 
-		_cellIndexBuffer = RHICreateStructuredBuffer(size, size * numBoids, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
-		_cellIndexBufferUAV = RHICreateUnorderedAccessView(_cellIndexBuffer, false, false);
+		totalTime = _simulationTime;
 	}
-	
-	// cellOffsetBuffer
+	else if (useFixedTimestep && simulationRate > 0.0f)
 	{
-		const size_t size = sizeof(uint32_t);
-		const size_t gridSize = gridDimensions.X * gridDimensions.Y * gridDimensions.Z;
+		dt = 1.0f / simulationRate;
 
-		TResourceArray<uint32_t> resourceArray;
-		resourceArray.Init(0, gridSize);
+		_timeAccumulator += DeltaTime;
 
-		FRHIResourceCreateInfo createInfo;
-		createInfo.ResourceArray = &resourceArray;
+		numSteps = FMath::Min(FMath::FloorToInt(_timeAccumulator / dt), FMath::Max(maxSubsteps, 1));
 
-		_cellOffsetBuffer = RHICreateStructuredBuffer(size, gridSize * size, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
-		_cellOffsetBufferUAV = RHICreateUnorderedAccessView(_cellOffsetBuffer, false, false);
-	}
+		_timeAccumulator -= numSteps * dt;
 
+		// if we can't keep up, drop the backlog rather than spiral
+		_timeAccumulator = FMath::Min(_timeAccumulator, dt);
 
-	if (outputPositions.Num() != numBoids)
+		// the fraction of a step between the previous and current states, for rendering
+		interpolationAlpha = FMath::Clamp(_timeAccumulator / dt, 0.0f, 1.0f);
+
+		totalTime = _simulationTime;
+	}
+	else
 	{
-		const FVector zero(0.0f);
-		outputPositions.Init(zero, numBoids);
+		interpolationAlpha = 1.0f;
 	}
 
-	if (outputDirections.Num() != numBoids)
+	if (numSteps == 0)
+		return;
+
+	// the CPU backend steps here, on the game thread
+	for (int i = 0; i < numSteps; ++i)
 	{
-		const FVector zero(0.0f);
-		outputDirections.Init(zero, numBoids);
+		_stepSimulationCPU(dt, totalTime, _simulationFrame++);
+
+		totalTime += dt;
+		_simulationTime += dt;
 	}
+
+	_cpuSimulation.copyTo(outputPositions, outputDirections);
 }
 
-static FIntVector groupSize(int numElements)
+void UComputeShaderTestComponent::_pushParameters()
 {
-	const int threadCount = 256;
+	_updateFlowFieldData();
 
-	int count = ((numElements - 1) / threadCount) + 1;
+	FBoidSimulationSettings settings;
+	_simulationSettings(settings);
 
-	return FIntVector(count, 1, 1);
+	const FTransform& simulationTransform = GetOwner()->GetActorTransform();
+
+	FBoidSimulationInputs inputs;
+	inputs.simulationTransform = simulationTransform;
+	inputs.navGoal = simulationTransform.InverseTransformPosition(navGoal);
+
+	// pack the influencers into simulation space
+	_packInfluencers(simulationTransform, inputs.influencerPositions, inputs.influencerShapes);
+
+	inputs.numInfluencers = inputs.influencerPositions.Num();
+
+	// Blueprints write the properties without marking them dirty, so compare with what we sent last
+	const bool changed = _parametersDirty
+		|| _pendingEvents.Num() > 0
+		|| settings != _pushedSettings
+		|| !inputs.simulationTransform.Equals(_pushedInputs.simulationTransform, 0.0f)
+		|| inputs.navGoal != _pushedInputs.navGoal
+		|| inputs.influencerPositions != _pushedInputs.influencerPositions
+		|| inputs.influencerShapes != _pushedInputs.influencerShapes;
+
+	if (!changed)
+		return;
+
+	_parametersDirty = false;
+
+	_pushedSettings = settings;
+	_pushedInputs = inputs;
+
+	inputs.events = MoveTemp(_pendingEvents);
+	_pendingEvents.Reset();
+
+	ENQUEUE_RENDER_COMMAND(FPushBoidSimulationParameters)(
+	[proxy = _simulationProxy, settings, inputs = MoveTemp(inputs)](FRHICommandListImmediate& RHICommands) mutable
+	{
+		proxy->push(settings, inputs);
+	});
 }
 
-// Called every frame
-void UComputeShaderTestComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+void UComputeShaderTestComponent::_updateFlowFieldData()
 {
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	if (_flowFieldDataSource == flowField && _flowFieldData.IsValid() == (flowField != nullptr))
+		return;
 
-	float totalTime = GetOwner()->GetWorld()->TimeSeconds;
-	const float dt = FMath::Min(1.0f / 60.0f, DeltaTime);
+	_flowFieldData.Reset();
 
-	ENQUEUE_RENDER_COMMAND(FComputeShaderRunner)(
-	[&, totalTime, dt](FRHICommandListImmediate& RHICommands)
+	if (flowField)
+		_flowFieldData = flowField->renderData();
+
+	_flowFieldDataSource = flowField;
+}
+
+void UComputeShaderTestComponent::_packInfluencers(const FTransform& simulationTransform, TArray<FVector4>& positions_out, TArray<FVector4>& shapes_out) const
+{
+	const int32 numInfluencers = FMath::Min(influencers.Num(), FMath::Max(maxInfluencers, 1));
+
+	positions_out.SetNumUninitialized(numInfluencers);
+	shapes_out.SetNumUninitialized(numInfluencers);
+
+	bool clamped = false;
+
+	for (int32 i = 0; i < numInfluencers; ++i)
 	{
-		QUICK_SCOPE_CYCLE_COUNTER(STAT_UComputeShaderTestComponent_TickComponent);
+		const FBoidInfluencer& influencer = influencers[i];
 
-		const uint32_t cellOffsetBufferSize = gridDimensions.X * gridDimensions.Y * gridDimensions.Z;
+		const FVector centre = simulationTransform.InverseTransformPosition(influencer.location);
+		FVector halfAxis = simulationTransform.InverseTransformVector(influencer.capsuleHalfAxis);
 
-		auto& positionsBufferUAV = _positionBufferUAV[dualBufferCount];
-		auto& directionsBufferUAV = _directionsBufferUAV[dualBufferCount];
+		// everything an influencer touches has to be within one influencer cell of its centre
+		halfAxis = halfAxis.GetClampedToMaxSize(influencerCellSize * 0.5f);
+		float radius = FMath::Max(influencer.radius, 0.0f);
 
-		// calculate the unsorted cell index buffer
+		if (radius + halfAxis.Size() > influencerCellSize)
 		{
-			FHashedGrid_createUnsortedList_CS::FParameters parameters;
-			parameters.numParticles = numBoids;
-			parameters.cellSizeReciprocal = 1.0f / gridCellSize;
-			parameters.cellOffsetBufferSize = cellOffsetBufferSize;
-			parameters.gridDimensions = gridDimensions;
-			parameters.positions = positionsBufferUAV;
-			parameters.particleIndexBuffer = _particleIndexBufferUAV;
-			parameters.cellIndexBuffer = _cellIndexBufferUAV;
-
-
-			TShaderMapRef<FHashedGrid_createUnsortedList_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
-			FComputeShaderUtils::Dispatch(
-				RHICommands,
-				*computeShader,
-				parameters,
-				groupSize(numBoids)
-			);
+			radius = influencerCellSize - halfAxis.Size();
+			clamped = true;
+		}
 
+		float strength = FMath::Abs(influencer.strength);
 
-			RHICommands.TransitionResource(
-				EResourceTransitionAccess::ERWBarrier,
-				EResourceTransitionPipeline::EGfxToCompute,
-				_cellIndexBufferUAV
-			);
-		}
+		if (influencer.type != EBoidInfluencerType::Attractor)
+			strength = -strength;
 
-		// sort the particle index buffer by cell index
-		{
-		 	FGPUBitonicSort gpuBitonicSort;
-
-		 	gpuBitonicSort.sort(
-				numBoids,
-				numBoids,
-				_cellIndexBufferUAV,
-				_particleIndexBufferUAV,
-				RHICommands
-			);
+		positions_out[i] = FVector4(centre, radius);
+		shapes_out[i] = FVector4(halfAxis, strength);
+	}
 
-			RHICommands.TransitionResource(
-				EResourceTransitionAccess::ERWBarrier,
-				EResourceTransitionPipeline::EGfxToCompute,
-				_particleIndexBufferUAV
-			);
+	UE_CLOG(clamped, LogTemp, Verbose, TEXT("UComputeShaderTestComponent: influencers larger than influencerCellSize were clamped."));
+}
 
+void UComputeShaderTestComponent::_simulationSettings(FBoidSimulationSettings& settings) const
+{
+	settings.useFixedTimestep = useFixedTimestep;
+	settings.deterministic = deterministic;
+	settings.simulationRate = simulationRate;
+	settings.maxSubsteps = maxSubsteps;
 
-		}
+	settings.neighbourDistance = neighbourDistance;
+	settings.separationDistance = separationDistance;
+	settings.homeInnerRadius = homeInnerRadius;
 
-		// reset the cell offset buffer
-		{
-			FHashedGrid_resetCellOffsetBuffer_CS::FParameters parameters;
-			parameters.cellOffsetBufferSize = cellOffsetBufferSize;
-			parameters.cellOffsetBuffer = _cellOffsetBufferUAV;
-
-			TShaderMapRef<FHashedGrid_resetCellOffsetBuffer_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
-			FComputeShaderUtils::Dispatch(
-				RHICommands,
-				*computeShader,
-				parameters,
-				groupSize(cellOffsetBufferSize)
-			);
+	settings.boidSpeed = boidSpeed;
+	settings.boidSpeedVariation = boidSpeedVariation;
+	settings.boidRotationSpeed = boidRotationSpeed;
 
-		}
+	settings.integrator = uint32(integrator);
 
-		// build the cell offset buffer
-		{
-			FHashedGrid_createOffsetList_CS::FParameters parameters;
-			parameters.numParticles = numBoids;
-			parameters.cellSizeReciprocal = 1.0f / gridCellSize;
-			parameters.cellOffsetBufferSize = cellOffsetBufferSize;
-			parameters.gridDimensions = gridDimensions;
-
-			parameters.particleIndexBuffer = _particleIndexBufferUAV;
-			parameters.cellIndexBuffer = _cellIndexBufferUAV;
-			parameters.cellOffsetBuffer = _cellOffsetBufferUAV;
-
-
-			TShaderMapRef<FHashedGrid_createOffsetList_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
-			FComputeShaderUtils::Dispatch(
-				RHICommands,
-				*computeShader,
-				parameters,
-				groupSize(numBoids)
-			);
+	settings.homeUrge = homeUrge;
+	settings.separationUrge = separationUrge;
+	settings.cohesionUrge = cohesionUrge;
+	settings.alignmentUrge = alignmentUrge;
 
+	settings.ruleMask = activeRuleMask();
 
-		}
+	settings.numSpecies = speciesCount();
+	_speciesParameters(settings.speciesSpeedScale, settings.speciesInteractions);
 
-		if (false)
-		{
-			TArray<uint32> cellIndexBuffer;
-			cellIndexBuffer.Init(0, numBoids);
+	settings.gridCellSize = gridCellSize;
+	settings.gridSortKeyValues = gridSortKeyValues;
+	settings.gridRadixSort = gridRadixSort;
+	settings.rearrangeBoids = rearrangeBoids;
 
-			TArray<uint32> particleIndexBuffer;
-			particleIndexBuffer.Init(0, numBoids);
+	settings.useLBVH = spatialIndex == ESpatialIndex::LBVH;
+	settings.lbvhBounds = lbvhBounds;
 
-			TArray<uint32> cellOffsetBuffer;
-			cellOffsetBuffer.Init(0, cellOffsetBufferSize);
+	settings.timeSliceCount = timeSliceCount;
 
-			uint8* cellIndexData = (uint8*)RHILockStructuredBuffer(_cellIndexBuffer, 0, numBoids * sizeof(uint32_t), RLM_ReadOnly);
-			FMemory::Memcpy(cellIndexBuffer.GetData(), cellIndexData, numBoids * sizeof(uint32_t));
-			RHIUnlockStructuredBuffer(_cellIndexBuffer);
+	settings.useSimulationLOD = useSimulationLOD;
+	settings.lodNearDistance = lodNearDistance;
+	settings.lodMidDistance = lodMidDistance;
+	settings.lodFarDistance = lodFarDistance;
+	settings.lodCullOffscreen = lodCullOffscreen;
+	settings.lodOffscreenMargin = lodOffscreenMargin;
 
-			uint8* particleIndexData = (uint8*)RHILockStructuredBuffer(_particleIndexBuffer, 0, numBoids * sizeof(uint32_t), RLM_ReadOnly);
-			FMemory::Memcpy(particleIndexBuffer.GetData(), particleIndexData, numBoids * sizeof(uint32_t));
-			RHIUnlockStructuredBuffer(_particleIndexBuffer);
+	settings.useSuperBoids = useSuperBoids;
+	settings.superBoidDistance = superBoidDistance;
+	settings.superBoidBlendTime = superBoidBlendTime;
 
-			uint8* cellOffsetData = (uint8*)RHILockStructuredBuffer(_cellOffsetBuffer, 0, cellOffsetBufferSize * sizeof(uint32_t), RLM_ReadOnly);
-			FMemory::Memcpy(cellOffsetBuffer.GetData(), cellOffsetData, cellOffsetBufferSize * sizeof(uint32_t));
-			RHIUnlockStructuredBuffer(_cellOffsetBuffer);
-		}
+	settings.influencerCellSize = influencerCellSize;
 
+	settings.sdfAvoidanceDistance = sdfAvoidanceDistance;
+	settings.sdfAvoidanceUrge = sdfAvoidanceUrge;
 
-		// execute the main compute shader
-		{
-			FBoidsComputeShader::FParameters parameters;
-			parameters.dt = dt;
-			parameters.totalTime = totalTime;
-			parameters.separationDistance = separationDistance;
-			parameters.boidSpeed = boidSpeed;
-			parameters.boidSpeedVariation = boidSpeedVariation;
-			parameters.separationDistance = separationDistance;
-			parameters.boidRotationSpeed = boidRotationSpeed;
-			parameters.homeInnerRadius = homeInnerRadius;
-			parameters.neighbourhoodDistance = neighbourDistance;
-
-			parameters.homeUrge = homeUrge;
-			parameters.separationUrge = separationUrge;
-			parameters.cohesionUrge = cohesionUrge;
-			parameters.alignmentUrge = alignmentUrge;
-
-			parameters.numParticles = numBoids;
-			parameters.cellSizeReciprocal = 1.0f / gridCellSize;
-			parameters.cellOffsetBufferSize = cellOffsetBufferSize;
-			parameters.gridDimensions = gridDimensions;
-
-			parameters.positions = positionsBufferUAV;
-			parameters.directions = directionsBufferUAV;
-			parameters.newDirections = _newDirectionsBufferUAV;
-			parameters.cellOffsetBuffer = _cellOffsetBufferUAV;
-			parameters.cellIndexBuffer = _cellIndexBufferUAV;
-			parameters.particleIndexBuffer = _particleIndexBufferUAV;
-
-
-			TShaderMapRef<FBoidsComputeShader> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
-			FComputeShaderUtils::Dispatch(
-				RHICommands,
-				*computeShader,
-				parameters,
-				groupSize(numBoids)
-			);
-		}
+	settings.flowField = _flowFieldData;
+	settings.flowUrge = flowUrge;
 
-		// integrate positions
-		{
-			FBoids_integratePosition_CS::FParameters parameters;
-			parameters.dt = dt;
-			parameters.totalTime = totalTime;
-			parameters.boidSpeed = boidSpeed;
-			parameters.boidSpeedVariation = boidSpeedVariation;
-
-			parameters.numParticles = numBoids;
-
-			parameters.positions = positionsBufferUAV;
-			parameters.directions = directionsBufferUAV;
-			parameters.newDirections = _newDirectionsBufferUAV;
-
-			TShaderMapRef<FBoids_integratePosition_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
-			FComputeShaderUtils::Dispatch(
-				RHICommands,
-				*computeShader,
-				parameters,
-				groupSize(numBoids)
-			);
-		}
+	settings.useNavField = useNavField;
+	settings.navUrge = navUrge;
+	settings.navAgentRadius = navAgentRadius;
+	settings.navIterationsPerStep = navIterationsPerStep;
+	settings.navIterationsPerGoal = navIterationsPerGoal;
 
-		// rearrange positions for better cache-coherence on the next run
-		{
-			FBoids_rearrangePositions_CS::FParameters parameters;
+	settings.impulseCellSize = impulseCellSize;
+	settings.impulseBucketCount = impulseBucketCount;
 
-			parameters.positions = positionsBufferUAV;
-			parameters.directions = directionsBufferUAV;
+	settings.heightfield = heightfield ? heightfield->Resource : nullptr;
+	settings.heightfieldOrigin = heightfieldOrigin;
+	settings.heightfieldSize = heightfieldSize;
+	settings.heightfieldScale = heightfieldScale;
+	settings.heightOffset = heightOffset;
+}
 
-			parameters.positions_other = _positionBufferUAV[(dualBufferCount + 1) % 2];
-			parameters.directions_other = _directionsBufferUAV[(dualBufferCount + 1) % 2];
+void UComputeShaderTestComponent::_stepSimulationCPU(float dt, float totalTime, uint32 frameIndex)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_UComputeShaderTestComponent_StepSimulationCPU);
 
-			parameters.particleIndexBuffer = _particleIndexBufferUAV;
-			parameters.numParticles = numBoids;
+	if (!_cpuSimulation.isInitialized())
+		return;
 
-			TShaderMapRef<FBoids_rearrangePositions_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
-			FComputeShaderUtils::Dispatch(
-				RHICommands,
-				*computeShader,
-				parameters,
-				groupSize(numBoids)
-			); 
+	FCPUBoidSimulationStep step;
+	step.dt = dt;
+	step.totalTime = totalTime;
 
-			// rotate our buffers
-			dualBufferCount = (dualBufferCount + 1) % 2;
-		}
-	});
-}
+	step.boidSpeed = boidSpeed;
+	step.boidSpeedVariation = boidSpeedVariation;
+	step.boidRotationSpeed = boidRotationSpeed;
 
+	step.neighbourhoodDistance = neighbourDistance;
+	step.separationDistance = separationDistance;
+	step.homeInnerRadius = homeInnerRadius;
 
+	step.homeUrge = homeUrge;
+	step.separationUrge = separationUrge;
+	step.cohesionUrge = cohesionUrge;
+	step.alignmentUrge = alignmentUrge;
 
+	step.cellSize = gridCellSize;
+	step.ruleMask = activeRuleMask();
+	step.integrator = uint32(integrator);
+
+	// time slicing, like the GPU
+	const uint32 numSlices = FMath::Clamp(timeSliceCount, 1, FMath::Max(numBoids, 1));
+	const uint32 sliceSize = (numBoids + numSlices - 1) / numSlices;
+
+	step.sliceOffset = (frameIndex % numSlices) * sliceSize;
+	step.sliceSize = sliceSize;
+
+	step.numSpecies = speciesCount();
+
+	_speciesParameters(step.speciesSpeedScale, step.speciesInteractions);
+
+	_packInfluencers(GetOwner()->GetActorTransform(), step.influencerPositions, step.influencerShapes);
+	step.influencerCellSize = influencerCellSize;
+
+	_cpuSimulation.step(step);
+}
@@ -9,10 +9,115 @@
 #include "UniformBuffer.h"
 #include "RHICommandList.h"
 
-#include <atomic>
+#include "BoidFlowField.h"
+#include "BoidImpulseQueue.h"
+#include "BoidSimulationProxy.h"
+#include "CPUBoidSimulation.h"
 
 #include "ComputeShaderTestComponent.generated.h"
 
+USTRUCT(BlueprintType)
+struct FBoidSpecies
+{
+	GENERATED_BODY()
+
+	// The relative share of the spawned boids
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float spawnWeight = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float speedScale = 1.0f;
+};
+
+// How a boid reacts to a neighbour of a given species. The scales multiply the component's urges.
+USTRUCT(BlueprintType)
+struct FBoidSpeciesInteraction
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float separationScale = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float alignmentScale = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float cohesionScale = 1.0f;
+
+	// Positive steers towards the neighbour (chase), negative away from it (flee)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float pursuitUrge = 0.0f;
+};
+
+class UTexture2D;
+
+// How IntegrateBoidPosition turns and moves the boids, must match the INTEGRATOR_* defines in Boid.usf
+UENUM(BlueprintType)
+enum class EBoidIntegrator : uint8
+{
+	// Lerp the direction towards the steering, the original scheme. Jitters at large timesteps.
+	Euler,
+	// Slerp the direction by an exact exponential fraction, then move along the new direction
+	SemiImplicit,
+	// Like SemiImplicit, but move along the direction at the middle of the step (midpoint RK2)
+	RK2
+};
+
+// How the neighbour pass finds neighbours
+UENUM(BlueprintType)
+enum class ESpatialIndex : uint8
+{
+	// Uniform cells of gridCellSize, cheapest when the boids are spread out
+	HashedGrid,
+	// A BVH over Morton codes inside lbvhBounds, holds up when the boids are tightly clustered
+	LBVH
+};
+
+// Where the simulation runs
+UENUM(BlueprintType)
+enum class ESimulationBackend : uint8
+{
+	// Compute shaders, the boids stay on the GPU
+	GPU,
+	// ParallelFor on the CPU, for dedicated servers (NullRHI), headless runs and devices without compute shaders. The
+	// boids are published in outputPositions and outputDirections. The flocking rules, the species, the integrators,
+	// the influencers and the impulses and force fields are simulated, the SDF and the flow and nav fields aren't.
+	CPU
+};
+
+UENUM(BlueprintType)
+enum class EBoidInfluencerType : uint8
+{
+	Attractor,
+	Repeller,
+	// A capsule repeller, for players, NPCs and projectiles
+	Collider
+};
+
+// A gameplay influence on the boids, in world space
+USTRUCT(BlueprintType)
+struct FBoidInfluencer
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EBoidInfluencerType type = EBoidInfluencerType::Attractor;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector location = FVector::ZeroVector;
+
+	// Half of the capsule's axis, from the location to one end. Zero for a sphere.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector capsuleHalfAxis = FVector::ZeroVector;
+
+	// The distance from the capsule's axis at which the influence falls off to zero
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float radius = 100.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float strength = 1.0f;
+};
+
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
 class UNREALGPUSWARM_API UComputeShaderTestComponent : public UActorComponent
 {
@@ -30,17 +135,100 @@ public:
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
-	FUnorderedAccessViewRHIRef currentPositionsBuffer()
-	{
-		return _positionBufferUAV[dualBufferCount];
-	}
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+	// The GPU backend's render thread state, null until BeginPlay. Hold on to the pointer in render commands, the
+	// buffers it publishes are only valid on the render thread.
+	TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe> simulationProxy() const { return _simulationProxy; }
+
+	int32 speciesCount() const;
+
+	// The rules with a non-zero urge, a mask of EBoidRule. Only these are compiled into the neighbour pass.
+	uint32 activeRuleMask() const;
+
+	// The GPU backend copies the properties to the render thread on the ticks they differ from the last copy, this
+	// copies them on the next tick regardless.
+	UFUNCTION(BlueprintCallable)
+	void markParametersDirty();
+
+	// Replace the gameplay influencers
+	UFUNCTION(BlueprintCallable)
+	void setInfluencers(const TArray<FBoidInfluencer>& newInfluencers);
+
+	// The urges of the flocking rules, a rule with a zero urge is compiled out
+	UFUNCTION(BlueprintCallable)
+	void setRuleUrges(float newSeparationUrge, float newAlignmentUrge, float newCohesionUrge, float newHomeUrge);
+
+	UFUNCTION(BlueprintCallable)
+	void setBoidSpeed(float newBoidSpeed, float newBoidSpeedVariation, float newBoidRotationSpeed);
+
+	// Replace the species and their interactions
+	UFUNCTION(BlueprintCallable)
+	void setSpecies(const TArray<FBoidSpecies>& newSpecies, const TArray<FBoidSpeciesInteraction>& newSpeciesInteractions);
+
+	UFUNCTION(BlueprintCallable)
+	void setFlowField(UBoidFlowField * newFlowField, float newFlowUrge);
+
+	// Move the navigation goal, in world space
+	UFUNCTION(BlueprintCallable)
+	void setNavGoal(FVector newNavGoal);
+
+	// Bake the static level geometry inside sdfBounds into the obstacle avoidance volume
+	UFUNCTION(CallInEditor)
+	void bakeSDF();
+
+	// Queue a one-shot spherical impulse, in world space. strength is a change in velocity, positive pushes boids
+	// away from the location.
+	UFUNCTION(BlueprintCallable)
+	void addImpulse(FVector location, float radius, float strength);
+
+	// Queue a spherical force field, in world space, that lasts for duration seconds. strength is an acceleration,
+	// positive pushes boids away from the location.
+	UFUNCTION(BlueprintCallable)
+	void addForceField(FVector location, float radius, float strength, float duration);
+
+	// Compare the GPU navigation field with the CPU reference solver, the result is logged
+	UFUNCTION(BlueprintCallable)
+	void validateNavField();
+
+	// Time the hashed grid against the LBVH on uniform and clustered positions, the results are logged
+	UFUNCTION(BlueprintCallable, CallInEditor)
+	void benchmarkSpatialIndices();
+
+	// Must match MAX_SPECIES in Boid.usf
+	static constexpr int32 maxSpecies = FBoidSimulationProxy::maxSpecies;
 
-	FUnorderedAccessViewRHIRef currentDirectionsBuffer()
-	{
-		return _directionsBufferUAV[dualBufferCount];
-	}
+protected:
+	// Game thread, copy the properties the render thread needs
+	void _simulationSettings(FBoidSimulationSettings& settings) const;
+
+	// Game thread, send the settings, the influencers and the queued impulses to the proxy when they changed
+	void _pushParameters();
+
+	// Game thread, copy flowField for the render thread when it isn't the asset of the last copy
+	void _updateFlowFieldData();
+
+	// Game thread, run one step of the CPU simulation
+	void _stepSimulationCPU(float dt, float totalTime, uint32 frameIndex);
+
+	// The species' speed scales and the interaction matrix, row-major with maxSpecies columns
+	void _speciesParameters(FVector4& speedScale, FVector4 interactions[maxSpecies * maxSpecies]) const;
+
+	// The influencers in simulation space, (centre, radius) and (half axis, signed strength)
+	void _packInfluencers(const FTransform& simulationTransform, TArray<FVector4>& positions_out, TArray<FVector4>& shapes_out) const;
+
+	// Queue an impulse or force field in world space for either backend
+	void _addEvent(FBoidImpulseQueue::FEvent event, const FVector& location, float radius);
 
 public:
+	// Chosen at BeginPlay
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	ESimulationBackend simulationBackend = ESimulationBackend::GPU;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	int numBoids = 1000;
 
@@ -62,6 +250,10 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	float boidRotationSpeed = 10.0f;
 
+	// SemiImplicit and RK2 stay stable at several times the default timestep
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EBoidIntegrator integrator = EBoidIntegrator::Euler;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	float homeUrge = 0.1f;
 
@@ -77,12 +269,208 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	float spawnRadius = 600.0f;
 
+	// Up to maxSpecies species share one grid and one neighbour pass. Leave empty for a single species.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FBoidSpecies> species;
+
+	// Row-major, speciesInteractions[self * species.Num() + other]. Missing entries use the defaults.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FBoidSpeciesInteraction> speciesInteractions;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	FIntVector gridDimensions = FIntVector(256, 256, 256);
 
+	// Simulate in the xy plane, for ground crowds and surface schools. The grid's Z dimension is ignored and boids
+	// look at 9 neighbour cells instead of 27.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool planar2D = false;
+
+	// Planar boids are projected onto this heightfield (red channel) after they move, leave empty for a flat plane
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	UTexture2D * heightfield = nullptr;
+
+	// The xy area the heightfield covers, in the actor's space
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector2D heightfieldOrigin = FVector2D(-5000.0f, -5000.0f);
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector2D heightfieldSize = FVector2D(10000.0f, 10000.0f);
+
+	// The height of a texel value of 1
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float heightfieldScale = 1000.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float heightOffset = 0.0f;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	float gridCellSize = 5.0;
 
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	ESpatialIndex spatialIndex = ESpatialIndex::HashedGrid;
+
+	// The LBVH quantises positions inside these bounds, boids outside of them still work but cost more to find
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FBox lbvhBounds = FBox(FVector(-2000.0f), FVector(2000.0f));
+
+	// Sort packed (cell, boid) pairs when building the hashed grid, so that the sort's compares read contiguous memory
+	// instead of gathering each cell index through the boid index buffer
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool gridSortKeyValues = true;
+
+	// Build the hashed grid with a radix sort, whose cost follows the boid count instead of the next power of two
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool gridRadixSort = false;
+
+	// Reorder the boid buffers into the spatial index's order after every step, so that neighbours are close in memory
+	// on the next step. The neighbour pass goes through the index either way, with few boids it may not pay for itself.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool rearrangeBoids = true;
+
+	// Simulation LOD. Boids inside lodNearDistance of the view update their steering every frame, boids inside
+	// lodMidDistance every 2nd frame and boids inside lodFarDistance every 4th frame. Boids beyond that, or
+	// off-screen, keep flying along their current heading.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool useSimulationLOD = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float lodNearDistance = 1000.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float lodMidDistance = 2000.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float lodFarDistance = 4000.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool lodCullOffscreen = true;
+
+	// Degrees added to the half field of view before a boid is considered off-screen
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float lodOffscreenMargin = 15.0f;
+
+	// Super-boid aggregation. Beyond superBoidDistance from the view, the boids in each grid cell merge into one
+	// simulated super-boid and the rest are drawn around it, so the simulated count stays roughly constant however many
+	// boids there are. They split back into individuals as the view approaches. Needs the hashed grid.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool useSuperBoids = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float superBoidDistance = 4000.0f;
+
+	// Seconds for a boid that joins a super-boid to ease into its place around the leader, 0 snaps it there
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float superBoidBlendTime = 0.25f;
+
+	// Gameplay attractors, repellers and colliders, in world space
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FBoidInfluencer> influencers;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int maxInfluencers = 4096;
+
+	// Influencers are found through their own hashed grid. An influencer's extent (radius plus half axis) is clamped
+	// to the influencer cell size.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float influencerCellSize = 200.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FIntVector influencerGridDimensions = FIntVector(64, 64, 64);
+
+	// Obstacle avoidance. The static level geometry inside sdfBounds (in the actor's space) is baked into a signed
+	// distance field with bakeSDF(). Boids closer than sdfAvoidanceDistance to the geometry steer away from it.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FBox sdfBounds = FBox(FVector(-1000.0f), FVector(1000.0f));
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FIntVector sdfResolution = FIntVector(64, 64, 64);
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float sdfAvoidanceDistance = 100.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float sdfAvoidanceUrge = 1.0f;
+
+	// The baked volume, empty until bakeSDF() is run
+	UPROPERTY()
+	TArray<float> sdfDistances;
+
+	UPROPERTY()
+	FBox sdfBakedBounds = FBox(ForceInit);
+
+	UPROPERTY()
+	FIntVector sdfBakedResolution = FIntVector(0, 0, 0);
+
+	// A vector field the boids follow, for wind, weather and choreographed shapes
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	UBoidFlowField * flowField = nullptr;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float flowUrge = 1.0f;
+
+	// Goal seeking. A distance-to-goal field is solved over the SDF's voxel grid (sdfBounds and sdfResolution), voxels
+	// closer than navAgentRadius to the baked geometry are blocked. Boids follow the field around the obstacles.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool useNavField = false;
+
+	// In world space
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector navGoal = FVector::ZeroVector;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float navUrge = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float navAgentRadius = 10.0f;
+
+	// The solve is spread over frames, each simulation step runs this many iterations until the field is published
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int navIterationsPerStep = 16;
+
+	// The iterations before a new goal's field replaces the old one. Zero uses twice the sum of the grid dimensions. A goal
+	// that moves continues from the current field, which is republished every step as it converges.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int navIterationsPerGoal = 0;
+
+	// The most impulses and force fields alive at once, the oldest are dropped beyond that
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int maxImpulses = 4096;
+
+	// Impulses are bucketed by the cells they overlap, hashed into impulseBucketCount buckets
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float impulseCellSize = 500.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int impulseBucketCount = 1024;
+
+	// Update the steering of a rotating 1/timeSliceCount of the boids each frame. Every boid still moves every frame.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int timeSliceCount = 1;
+
+	// Run the simulation at a fixed rate (in Hz), decoupled from the frame rate. Rendering interpolates between the
+	// last two simulation states.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool useFixedTimestep = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1.0"))
+	float simulationRate = 30.0f;
+
+	// The most simulation steps we will take in one frame, any time beyond that is dropped
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int maxSubsteps = 4;
+
+	// Reproducible runs, for comparing builds on an identical workload. Every frame takes exactly one step of
+	// 1 / simulationRate whatever the frame time, and the boids spawn from randomSeed. Two runs on the same GPU and
+	// driver reach bit-identical states after N frames, as long as the view (for the simulation LOD and super-boids)
+	// and the gameplay inputs match.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool deterministic = false;
+
+	// The seed of the spawn positions, directions and species
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 randomSeed = 0;
+
+	// The CPU backend's boids, updated every tick
 	TArray<FVector4> outputPositions;
 
 	TArray<FVector4> outputDirections;
@@ -90,25 +478,35 @@ public:
 
 
 public:
-	unsigned int dualBufferCount = 0;
+	// The CPU backend's clock, the GPU backend's runs on the render thread
+	uint32 _simulationFrame = 0;
+
+	// Fixed timestep
+	float _timeAccumulator = 0.0f;
+	float _simulationTime = 0.0f;
+
+	// How far we are from the previous to the current simulation state, the GPU backend's is on the proxy
+	float interpolationAlpha = 1.0f;
+
+	// Whether the proxy was given a baked obstacle volume
+	bool _hasSDF = false;
 
-	// GPU side
-	FStructuredBufferRHIRef _positionBuffer[2];
-	FUnorderedAccessViewRHIRef _positionBufferUAV[2];     // we need a UAV for writing
+	// CPU side, for the CPU backend
+	FCPUBoidSimulation _cpuSimulation;
 
-	FStructuredBufferRHIRef _directionsBuffer[2];
-	FUnorderedAccessViewRHIRef _directionsBufferUAV[2];
+	// GPU side, the buffers and the passes' state live on the render thread
+	TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe> _simulationProxy;
 
-	FStructuredBufferRHIRef _newDirectionsBuffer;
-	FUnorderedAccessViewRHIRef _newDirectionsBufferUAV;
+	// Impulses and force fields since the last push, in simulation space
+	TArray<FBoidImpulseQueue::FEvent> _pendingEvents;
 
-	// Hashed grid data structures
-	FStructuredBufferRHIRef _particleIndexBuffer;
-	FUnorderedAccessViewRHIRef _particleIndexBufferUAV;
+	// The render thread's copy of flowField and the asset it was made from
+	TSharedPtr<const FBoidFlowFieldData, ESPMode::ThreadSafe> _flowFieldData;
+	TWeakObjectPtr<const UBoidFlowField> _flowFieldDataSource;
 
-	FStructuredBufferRHIRef _cellIndexBuffer;
-	FUnorderedAccessViewRHIRef _cellIndexBufferUAV;
+	bool _parametersDirty = true;
 
-	FStructuredBufferRHIRef _cellOffsetBuffer;
-	FUnorderedAccessViewRHIRef _cellOffsetBufferUAV;
+	// What the proxy was last sent, without the events
+	FBoidSimulationSettings _pushedSettings;
+	FBoidSimulationInputs _pushedInputs;
 };
@@ -5,73 +5,9 @@
 
 #include "InstanceBufferMeshComponent.h"
 
-#include "ShaderParameterUtils.h"
-#include "RHIStaticStates.h"
-#include "Shader.h"
-#include "GlobalShader.h"
-#include "RenderGraphBuilder.h"
-#include "RenderGraphUtils.h"
-#include "ShaderParameterStruct.h"
-#include "UniformBuffer.h"
 #include "RHICommandList.h"
-#include "Private/InstanceBufferMesh.h"
 
 #include "ComputeShaderTestComponent.h"
-
-
-
-
-
-
-
-
-
-class FBoids_copyPositions_CS : public FGlobalShader
-{
-public:
-	DECLARE_GLOBAL_SHADER(FBoids_copyPositions_CS);
-	SHADER_USE_PARAMETER_STRUCT(FBoids_copyPositions_CS, FGlobalShader);
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		SHADER_PARAMETER(uint32, numParticles)
-		SHADER_PARAMETER(float, particleScale)
-
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions_other)
-
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, directions)
-		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, transforms_other)
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
-	{
-		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
-	}
-};
-
-IMPLEMENT_GLOBAL_SHADER(FBoids_copyPositions_CS, "/ComputeShaderPlugin/CopyPositions.usf", "copyPositions", SF_Compute);
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
 
 
 // Sets default values for this component's properties
@@ -94,13 +30,33 @@ void UDrawPositionsComponent::BeginPlay()
 }
 
 
+void UDrawPositionsComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (_simulationProxy.IsValid())
+	{
+		ENQUEUE_RENDER_COMMAND(FClearBoidInstanceTarget)(
+		[proxy = MoveTemp(_simulationProxy)](FRHICommandListImmediate& RHICommands)
+		{
+			proxy->setInstanceTarget(nullptr, 0.0f);
+		});
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
 // Called every frame
 void UDrawPositionsComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
-
-	_updateInstanceBuffers();
+	// once the simulation has our instance buffer the render thread does the rest, we only watch the size
+	if (_simulationProxy.IsValid())
+	{
+		if (size != _registeredSize)
+			_registerInstanceTarget();
+	}
+	else if (_registerInstanceTarget() && !_simulationProxy.IsValid())
+		SetComponentTickEnabled(false);
 }
 
 void UDrawPositionsComponent::_initISMC()
@@ -119,91 +75,35 @@ void UDrawPositionsComponent::_initISMC()
 	ismc->SetCollisionProfileName(TEXT("NoCollision"));
 }
 
-static FIntVector groupSize(int numElements)
-{
-	const int threadCount = 256;
-
-	int count = ((numElements - 1) / threadCount) + 1;
-
-	return FIntVector(count, 1, 1);
-}
-
-
-void UDrawPositionsComponent::_updateInstanceBuffers()
+bool UDrawPositionsComponent::_registerInstanceTarget()
 {
 	UInstanceBufferMeshComponent * ismc = GetOwner()->FindComponentByClass<UInstanceBufferMeshComponent>();
 
-	if (!ismc) return;
+	if (!ismc) return true;
 
 	UComputeShaderTestComponent * boidsComponent = GetOwner()->FindComponentByClass<UComputeShaderTestComponent>();
 
-	if (!boidsComponent) return;
+	if (!boidsComponent) return true;
 
-	// resize up/down the ismc
-	int toAdd = FMath::Max(0, boidsComponent->numBoids - ismc->GetInstanceCount());
-	int toRemove = FMath::Max(0, ismc->GetInstanceCount() - boidsComponent->numBoids);
+	// the CPU backend has no GPU buffers to copy, its boids are in outputPositions and outputDirections
+	if (boidsComponent->simulationBackend != ESimulationBackend::GPU) return true;
 
-	FTransform transform = FTransform::Identity;
+	// wait for the boids component to begin play
+	TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe> proxy = boidsComponent->simulationProxy();
 
-	transform.SetScale3D(FVector(size));
+	if (!proxy.IsValid() || !ismc->PerInstanceRenderData.IsValid()) return false;
 
+	// the instance buffer is reallocated with the render state, the proxy picks up the new buffers
 	ismc->SetNumInstances(boidsComponent->numBoids);
 
-	/*for (int i = 0; i < toAdd; ++i)
-	{
-		ismc->AddInstance(transform);
-	}
-
-	for (int i = 0; i < toRemove; ++i)
-		ismc->RemoveInstance(ismc->GetInstanceCount() - 1);*/
+	_simulationProxy = proxy;
+	_registeredSize = size;
 
-	// directly update the buffer
-	if (ismc->GetNumInstancesCurrentlyAllocated() == boidsComponent->numBoids)
+	ENQUEUE_RENDER_COMMAND(FSetBoidInstanceTarget)(
+	[proxy, renderData = ismc->PerInstanceRenderData, particleScale = size](FRHICommandListImmediate& RHICommands)
 	{
-		auto renderData = ismc->PerInstanceRenderData;
-
-		auto originSRV = renderData->InstanceBuffer.InstanceOriginSRV.GetReference();
-
-		int numParticles = boidsComponent->numBoids;
-
-		if (!_positionsUAV)
-		{
-			FRHIVertexBuffer * positionsVertexBuffer = renderData->InstanceBuffer.InstanceOriginBuffer.VertexBufferRHI.GetReference();
-
-			uint8 theFormat = PF_A32B32G32R32F;;
-
-			_positionsUAV = RHICreateUnorderedAccessView(positionsVertexBuffer, theFormat);
-		}
-
-		if (!_transformsUAV)
-		{
-			FRHIVertexBuffer * positionsVertexBuffer = renderData->InstanceBuffer.InstanceTransformBuffer.VertexBufferRHI.GetReference();
-
-			uint8 theFormat = PF_A32B32G32R32F;;
-
-			_transformsUAV = RHICreateUnorderedAccessView(positionsVertexBuffer, theFormat);
-		}
+		proxy->setInstanceTarget(renderData, particleScale);
+	});
 
-		FBoids_copyPositions_CS::FParameters parameters;
-		parameters.positions = boidsComponent->currentPositionsBuffer();
-		parameters.positions_other = _positionsUAV;
-		parameters.directions = boidsComponent->currentDirectionsBuffer();
-		parameters.transforms_other = _transformsUAV;
-		parameters.numParticles = numParticles;
-		parameters.particleScale = size;
-
-		ENQUEUE_RENDER_COMMAND(FComputeShaderRunner)(
-			[&, parameters, numParticles](FRHICommandListImmediate& RHICommands)
-		{
-			TShaderMapRef<FBoids_copyPositions_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
-			FComputeShaderUtils::Dispatch(
-				RHICommands,
-				*computeShader,
-				parameters,
-				groupSize(numParticles)
-			);
-		});
-	}
+	return true;
 }
-
-
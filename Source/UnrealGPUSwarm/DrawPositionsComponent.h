@@ -4,6 +4,9 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+
+#include "BoidSimulationProxy.h"
+
 #include "DrawPositionsComponent.generated.h"
 
 
@@ -21,12 +24,17 @@ protected:
 	virtual void BeginPlay() override;
 
 public:	
-	// Called every frame
+	// Called every frame, registers the instance buffer with the simulation and again when size changes
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 protected:
 	void _initISMC();
-	void _updateInstanceBuffers();
+
+	// Hand the instance buffer to the GPU simulation's proxy, which copies the boids into it after every update. False
+	// while the simulation isn't ready.
+	bool _registerInstanceTarget();
 
 public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
@@ -35,6 +43,7 @@ public:
 protected:
 	TArray<FTransform> _instanceTransforms;
 
-	FUnorderedAccessViewRHIRef _positionsUAV; // float4
-	FUnorderedAccessViewRHIRef _transformsUAV; // float4x4
+	// The proxy we registered with and the size we gave it, a new size registers again
+	TSharedPtr<FBoidSimulationProxy, ESPMode::ThreadSafe> _simulationProxy;
+	float _registeredSize = 0.0f;
 };
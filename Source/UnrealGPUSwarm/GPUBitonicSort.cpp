@@ -18,6 +18,11 @@ public:
 	DECLARE_GLOBAL_SHADER(FBitonicSort_sort);
 	SHADER_USE_PARAMETER_STRUCT(FBitonicSort_sort, FGlobalShader);
 
+	class FKeyValueDim : SHADER_PERMUTATION_BOOL("SORT_KEY_VALUE");
+	class FSortSizeDim : SHADER_PERMUTATION_SPARSE_INT("SORT_SIZE", 512, 1024, 2048, 4096);
+
+	using FPermutationDomain = TShaderPermutationDomain<FKeyValueDim, FSortSizeDim>;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(FIntVector, job_params)
 		SHADER_PARAMETER(uint32, itemCount) // the number of particles
@@ -25,11 +30,18 @@ public:
 
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, comparisonBuffer)
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, indexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, keyValueBuffer)
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
 	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
+		FPermutationDomain permutationVector(Parameters.PermutationId);
+
+		// see FGPUBitonicSort::maxTileSize
+		if (permutationVector.Get<FSortSizeDim>() > 512 && !IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5))
+			return false;
+
 		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
 	}
 };
@@ -46,17 +58,29 @@ public:
 	DECLARE_GLOBAL_SHADER(FBitonicSort_sortInner);
 	SHADER_USE_PARAMETER_STRUCT(FBitonicSort_sortInner, FGlobalShader);
 
+	class FKeyValueDim : SHADER_PERMUTATION_BOOL("SORT_KEY_VALUE");
+	class FSortSizeDim : SHADER_PERMUTATION_SPARSE_INT("SORT_SIZE", 512, 1024, 2048, 4096);
+
+	using FPermutationDomain = TShaderPermutationDomain<FKeyValueDim, FSortSizeDim>;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(FIntVector, job_params)
 		SHADER_PARAMETER(uint32, itemCount) // the number of particles
 
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint>, comparisonBuffer)
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint>, indexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, keyValueBuffer)
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
 	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
+		FPermutationDomain permutationVector(Parameters.PermutationId);
+
+		// see FGPUBitonicSort::maxTileSize
+		if (permutationVector.Get<FSortSizeDim>() > 512 && !IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5))
+			return false;
+
 		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
 	}
 };
@@ -74,12 +98,17 @@ public:
 	DECLARE_GLOBAL_SHADER(FBitonicSort_sortStep);
 	SHADER_USE_PARAMETER_STRUCT(FBitonicSort_sortStep, FGlobalShader);
 
+	class FKeyValueDim : SHADER_PERMUTATION_BOOL("SORT_KEY_VALUE");
+
+	using FPermutationDomain = TShaderPermutationDomain<FKeyValueDim>;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER(FIntVector, job_params)
 		SHADER_PARAMETER(uint32, itemCount) // the number of particles
 
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, comparisonBuffer)
 		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, indexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, keyValueBuffer)
 	END_SHADER_PARAMETER_STRUCT()
 
 public:
@@ -96,6 +125,19 @@ IMPLEMENT_GLOBAL_SHADER(FBitonicSort_sortStep, "/ComputeShaderPlugin/BitonicSort
 
 
 
+uint32_t FGPUBitonicSort::maxTileSize()
+{
+	// SM5 guarantees 32KB of groupshared memory and 1024 threads per group, room for 4096 8 byte elements
+	return GMaxRHIFeatureLevel >= ERHIFeatureLevel::SM5 ? 4096 : 512;
+}
+
+uint32_t FGPUBitonicSort::_tileSize() const
+{
+	const uint32_t maxSize = maxTileSize();
+
+	return tileSize == 0 ? maxSize : FMath::Clamp(FMath::RoundUpToPowerOfTwo(tileSize), 512u, maxSize);
+}
+
 void FGPUBitonicSort::sort(
 	uint32_t maxCount, 
 	uint32_t numItems,
@@ -103,7 +145,34 @@ void FGPUBitonicSort::sort(
 	FUnorderedAccessViewRHIRef indexBuffer_write,
     FRHICommandListImmediate& commands)
 {
-	int threadCount = ((numItems - 1) >> 9) + 1;
+	_sort(maxCount, numItems, comparisonBuffer_read, indexBuffer_write, nullptr, commands);
+}
+
+void FGPUBitonicSort::sortKeyValues(
+	uint32_t maxCount,
+	uint32_t numItems,
+	FUnorderedAccessViewRHIRef keyValueBuffer_readWrite,
+	FRHICommandListImmediate& commands)
+{
+	_sort(maxCount, numItems, nullptr, nullptr, keyValueBuffer_readWrite, commands);
+}
+
+void FGPUBitonicSort::_sort(
+	uint32_t maxCount,
+	uint32_t numItems,
+	FUnorderedAccessViewRHIRef comparisonBuffer_read,
+	FUnorderedAccessViewRHIRef indexBuffer_write,
+	FUnorderedAccessViewRHIRef keyValueBuffer,
+	FRHICommandListImmediate& commands)
+{
+	const bool keyValues = keyValueBuffer.IsValid();
+
+	// the presort tile, no bigger than the sort needs
+	uint32_t tile = 512;
+	while (tile < maxCount && tile < _tileSize())
+		tile *= 2;
+
+	int threadCount = ((numItems - 1) / tile) + 1;
 
 	bool done = true;
 
@@ -114,8 +183,9 @@ void FGPUBitonicSort::sort(
 
 		parameters.comparisonBuffer = comparisonBuffer_read;
 		parameters.indexBuffer = indexBuffer_write;
+		parameters.keyValueBuffer = keyValueBuffer;
 
-		unsigned int numThreadGroups = ((maxCount - 1) >> 9) + 1;
+		unsigned int numThreadGroups = ((maxCount - 1) / tile) + 1;
 
 		//assert(numThreadGroups <= 1024);
 
@@ -124,7 +194,11 @@ void FGPUBitonicSort::sort(
 			done = false;
 		}
 
-		TShaderMapRef<FBitonicSort_sort> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FBitonicSort_sort::FPermutationDomain permutationVector;
+		permutationVector.Set<FBitonicSort_sort::FKeyValueDim>(keyValues);
+		permutationVector.Set<FBitonicSort_sort::FSortSizeDim>(tile);
+
+		TShaderMapRef<FBitonicSort_sort> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), permutationVector);
 		FComputeShaderUtils::Dispatch(
 			commands,
 			*computeShader,
@@ -133,7 +207,7 @@ void FGPUBitonicSort::sort(
 		);
 	}
 
-	int presorted = 512;
+	int presorted = tile;
 	while (!done)
 	{
 		// Incremental sorting:
@@ -144,6 +218,7 @@ void FGPUBitonicSort::sort(
 
 		// prepare thread group description data
 		uint32_t numThreadGroups = 0;
+		uint32_t numInnerThreadGroups = 0;
 
 		if (maxCount > (uint32_t)presorted)
 		{
@@ -154,13 +229,14 @@ void FGPUBitonicSort::sort(
 			while (pow2 < maxCount)
 				pow2 *= 2;
 			numThreadGroups = pow2 >> 9;
+			numInnerThreadGroups = pow2 / tile;
 		}
 
 		FIntVector job_params;
 
-		// step-sort
+		// step-sort, until the merges fit in a tile
 		uint32_t nMergeSize = presorted * 2;
-		for (uint32_t nMergeSubSize = nMergeSize >> 1; nMergeSubSize > 256; nMergeSubSize = nMergeSubSize >> 1)
+		for (uint32_t nMergeSubSize = nMergeSize >> 1; nMergeSubSize > tile / 2; nMergeSubSize = nMergeSubSize >> 1)
 		{
 
 
@@ -183,9 +259,13 @@ void FGPUBitonicSort::sort(
 
 			parameters.comparisonBuffer = comparisonBuffer_read;
 			parameters.indexBuffer = indexBuffer_write;
+			parameters.keyValueBuffer = keyValueBuffer;
+
 
+			FBitonicSort_sortStep::FPermutationDomain permutationVector;
+			permutationVector.Set<FBitonicSort_sortStep::FKeyValueDim>(keyValues);
 
-			TShaderMapRef<FBitonicSort_sortStep> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			TShaderMapRef<FBitonicSort_sortStep> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), permutationVector);
 			FComputeShaderUtils::Dispatch(
 				commands,
 				*computeShader,
@@ -202,13 +282,18 @@ void FGPUBitonicSort::sort(
 
 			parameters.comparisonBuffer = comparisonBuffer_read;
 			parameters.indexBuffer = indexBuffer_write;
+			parameters.keyValueBuffer = keyValueBuffer;
 
-			TShaderMapRef<FBitonicSort_sortInner> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FBitonicSort_sortInner::FPermutationDomain permutationVector;
+			permutationVector.Set<FBitonicSort_sortInner::FKeyValueDim>(keyValues);
+			permutationVector.Set<FBitonicSort_sortInner::FSortSizeDim>(tile);
+
+			TShaderMapRef<FBitonicSort_sortInner> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), permutationVector);
 			FComputeShaderUtils::Dispatch(
 				commands,
 				*computeShader,
 				parameters,
-				FIntVector(numThreadGroups, 1, 1)
+				FIntVector(numInnerThreadGroups, 1, 1)
 			);
 		}
 
@@ -21,4 +21,33 @@ public:
 		FUnorderedAccessViewRHIRef indexBuffer_write,
 		FRHICommandListImmediate& commands
 	);
+
+	// Sort packed (key, value) uint2 pairs in place by key. The keys travel through the network with their values, so
+	// unlike sort() no compare gathers through an index buffer, and the keys can use all 32 bits.
+	void sortKeyValues(
+		uint32_t maxSize,
+		uint32_t numItems,
+		FUnorderedAccessViewRHIRef keyValueBuffer_readWrite,
+		FRHICommandListImmediate& commands
+	);
+
+	// The largest tile the device can sort in groupshared memory
+	static uint32_t maxTileSize();
+
+public:
+	// The tile that is sorted in groupshared memory before the global merges, a power of two from 512 to 4096. Every
+	// doubling saves a round of merge dispatches. 0 picks the largest the device supports.
+	uint32_t tileSize = 0;
+
+protected:
+	uint32_t _tileSize() const;
+
+	void _sort(
+		uint32_t maxSize,
+		uint32_t numItems,
+		FUnorderedAccessViewRHIRef comparisionBuffer_read,
+		FUnorderedAccessViewRHIRef indexBuffer_write,
+		FUnorderedAccessViewRHIRef keyValueBuffer,
+		FRHICommandListImmediate& commands
+	);
 };
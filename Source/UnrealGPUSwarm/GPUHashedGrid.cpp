@@ -0,0 +1,347 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "GPUHashedGrid.h"
+
+#include "ShaderParameterUtils.h"
+#include "RHIStaticStates.h"
+#include "Shader.h"
+#include "GlobalShader.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+#include "UniformBuffer.h"
+#include "RHICommandList.h"
+
+#include "GPUBitonicSort.h"
+
+class FHashedGrid_createUnsortedList_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FHashedGrid_createUnsortedList_CS);
+	SHADER_USE_PARAMETER_STRUCT(FHashedGrid_createUnsortedList_CS, FGlobalShader);
+
+	class FKeyValueDim : SHADER_PERMUTATION_BOOL("HASHED_GRID_KEY_VALUE");
+
+	using FPermutationDomain = TShaderPermutationDomain<FKeyValueDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, cellSizeReciprocal)
+		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
+		SHADER_PARAMETER(FIntVector, gridDimensions)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, cellKeyValueBuffer)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FHashedGrid_createUnsortedList_CS, "/ComputeShaderPlugin/HashedGrid.usf", "createUnsortedList", SF_Compute);
+
+
+
+
+class FHashedGrid_createOffsetList_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FHashedGrid_createOffsetList_CS);
+	SHADER_USE_PARAMETER_STRUCT(FHashedGrid_createOffsetList_CS, FGlobalShader);
+
+	class FKeyValueDim : SHADER_PERMUTATION_BOOL("HASHED_GRID_KEY_VALUE");
+
+	using FPermutationDomain = TShaderPermutationDomain<FKeyValueDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, cellSizeReciprocal)
+		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
+		SHADER_PARAMETER(FIntVector, gridDimensions)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, cellKeyValueBuffer)
+
+		SHADER_PARAMETER(FIntVector, blockDimensions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOccupancyBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, blockOccupancyBuffer)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FHashedGrid_createOffsetList_CS, "/ComputeShaderPlugin/HashedGrid.usf", "createOffsetList", SF_Compute);
+
+class FHashedGrid_resetCellOffsetBuffer_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FHashedGrid_resetCellOffsetBuffer_CS);
+	SHADER_USE_PARAMETER_STRUCT(FHashedGrid_resetCellOffsetBuffer_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
+
+		SHADER_PARAMETER(uint32, cellOccupancyBufferSize)
+		SHADER_PARAMETER(uint32, blockOccupancyBufferSize)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOccupancyBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, blockOccupancyBuffer)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FHashedGrid_resetCellOffsetBuffer_CS, "/ComputeShaderPlugin/HashedGrid.usf", "resetCellOffsetBuffer", SF_Compute);
+
+
+
+static FIntVector groupSize(int numElements)
+{
+	const int threadCount = 256;
+
+	int count = ((numElements - 1) / threadCount) + 1;
+
+	return FIntVector(count, 1, 1);
+}
+
+// numWords uint32s of initialValue, viewed as elements of stride bytes
+static void createStructuredBuffer(uint32 numWords, uint32 initialValue, FStructuredBufferRHIRef& buffer, FUnorderedAccessViewRHIRef& uav, uint32 stride = sizeof(uint32_t))
+{
+	const size_t size = sizeof(uint32_t);
+
+	TResourceArray<uint32_t> resourceArray;
+	resourceArray.Init(initialValue, numWords);
+
+	FRHIResourceCreateInfo createInfo;
+	createInfo.ResourceArray = &resourceArray;
+
+	buffer = RHICreateStructuredBuffer(stride, size * numWords, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+	uav = RHICreateUnorderedAccessView(buffer, false, false);
+}
+
+void FGPUHashedGrid::init(uint32 maxItems_in, FIntVector dimensions)
+{
+	gridDimensions = dimensions;
+
+	init(maxItems_in);
+}
+
+void FGPUHashedGrid::init(uint32 maxItems_in)
+{
+	maxItems = FMath::Max(maxItems_in, 1u);
+
+	// particleIndexBuffer
+	{
+		TResourceArray<uint32_t> resourceArray;
+		resourceArray.Init(0, maxItems);
+
+		for (uint32 i = 0; i < maxItems; ++i)
+			resourceArray[i] = i;
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &resourceArray;
+
+		const size_t size = sizeof(uint32_t);
+
+		particleIndexBuffer = RHICreateStructuredBuffer(size, size * maxItems, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		particleIndexBufferUAV = RHICreateUnorderedAccessView(particleIndexBuffer, false, false);
+	}
+
+	createStructuredBuffer(maxItems, 0, cellIndexBuffer, cellIndexBufferUAV);
+
+	// (cell index, particle index) pairs
+	createStructuredBuffer(maxItems * 2, 0, cellKeyValueBuffer, cellKeyValueBufferUAV, sizeof(uint32_t) * 2);
+	createStructuredBuffer(cellOffsetBufferSize(), 0, cellOffsetBuffer, cellOffsetBufferUAV);
+
+	// occupancy masks
+	createStructuredBuffer(cellOccupancyBufferSize(), 0, cellOccupancyBuffer, cellOccupancyBufferUAV);
+	createStructuredBuffer(blockOccupancyBufferSize(), 0, blockOccupancyBuffer, blockOccupancyBufferUAV);
+}
+
+FIntVector FGPUHashedGrid::blockDimensions() const
+{
+	// 4x4x4 cells per occupancy block
+	return FIntVector(
+		(gridDimensions.X + 3) / 4,
+		(gridDimensions.Y + 3) / 4,
+		(gridDimensions.Z + 3) / 4
+	);
+}
+
+uint32 FGPUHashedGrid::blockOccupancyBufferSize() const
+{
+	const FIntVector blocks = blockDimensions();
+
+	return (blocks.X * blocks.Y * blocks.Z + 31) / 32;
+}
+
+void FGPUHashedGrid::build(
+	uint32 numItems,
+	float cellSize_in,
+	FUnorderedAccessViewRHIRef positions,
+	FRHICommandListImmediate& commands)
+{
+	cellSize = cellSize_in;
+
+	build(numItems, positions, commands);
+}
+
+void FGPUHashedGrid::build(
+	uint32 numItems,
+	FUnorderedAccessViewRHIRef positions,
+	FRHICommandListImmediate& commands)
+{
+	check(numItems <= maxItems);
+
+	const uint32 offsetBufferSize = cellOffsetBufferSize();
+
+	const bool keyValues = sortKeyValues || radixSort;
+
+	if (radixSort && _radixSort.maxItems < maxItems)
+		_radixSort.init(maxItems);
+
+	// calculate the unsorted cell index buffer
+	if (numItems > 0)
+	{
+		FHashedGrid_createUnsortedList_CS::FParameters parameters;
+		parameters.numParticles = numItems;
+		parameters.cellSizeReciprocal = 1.0f / cellSize;
+		parameters.cellOffsetBufferSize = offsetBufferSize;
+		parameters.gridDimensions = gridDimensions;
+		parameters.positions = positions;
+		parameters.particleIndexBuffer = particleIndexBufferUAV;
+		parameters.cellIndexBuffer = cellIndexBufferUAV;
+		parameters.cellKeyValueBuffer = cellKeyValueBufferUAV;
+
+		FHashedGrid_createUnsortedList_CS::FPermutationDomain permutationVector;
+		permutationVector.Set<FHashedGrid_createUnsortedList_CS::FKeyValueDim>(keyValues);
+
+		TShaderMapRef<FHashedGrid_createUnsortedList_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), permutationVector);
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(numItems)
+		);
+
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EGfxToCompute,
+			cellIndexBufferUAV
+		);
+	}
+
+	// sort the particle index buffer by cell index
+	if (numItems > 0 && radixSort)
+	{
+		// the cell indices are below the offset buffer size
+		_radixSort.sortKeyValues(
+			numItems,
+			FMath::CeilLogTwo(offsetBufferSize),
+			cellKeyValueBufferUAV,
+			commands
+		);
+	}
+	else if (numItems > 0 && keyValues)
+	{
+		FGPUBitonicSort gpuBitonicSort;
+
+		// createOffsetList unpacks the particle index buffer from the sorted pairs
+		gpuBitonicSort.sortKeyValues(
+			numItems,
+			numItems,
+			cellKeyValueBufferUAV,
+			commands
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EGfxToCompute,
+			cellKeyValueBufferUAV
+		);
+	}
+	else if (numItems > 0)
+	{
+	 	FGPUBitonicSort gpuBitonicSort;
+
+	 	gpuBitonicSort.sort(
+			numItems,
+			numItems,
+			cellIndexBufferUAV,
+			particleIndexBufferUAV,
+			commands
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EGfxToCompute,
+			particleIndexBufferUAV
+		);
+	}
+
+	// reset the cell offset buffer
+	{
+		FHashedGrid_resetCellOffsetBuffer_CS::FParameters parameters;
+		parameters.cellOffsetBufferSize = offsetBufferSize;
+		parameters.cellOffsetBuffer = cellOffsetBufferUAV;
+
+		parameters.cellOccupancyBufferSize = cellOccupancyBufferSize();
+		parameters.blockOccupancyBufferSize = blockOccupancyBufferSize();
+		parameters.cellOccupancyBuffer = cellOccupancyBufferUAV;
+		parameters.blockOccupancyBuffer = blockOccupancyBufferUAV;
+
+		TShaderMapRef<FHashedGrid_resetCellOffsetBuffer_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(offsetBufferSize)
+		);
+	}
+
+	// build the cell offset buffer
+	if (numItems > 0)
+	{
+		FHashedGrid_createOffsetList_CS::FParameters parameters;
+		parameters.numParticles = numItems;
+		parameters.cellSizeReciprocal = 1.0f / cellSize;
+		parameters.cellOffsetBufferSize = offsetBufferSize;
+		parameters.gridDimensions = gridDimensions;
+
+		parameters.particleIndexBuffer = particleIndexBufferUAV;
+		parameters.cellIndexBuffer = cellIndexBufferUAV;
+		parameters.cellOffsetBuffer = cellOffsetBufferUAV;
+		parameters.cellKeyValueBuffer = cellKeyValueBufferUAV;
+
+		parameters.blockDimensions = blockDimensions();
+		parameters.cellOccupancyBuffer = cellOccupancyBufferUAV;
+		parameters.blockOccupancyBuffer = blockOccupancyBufferUAV;
+
+		FHashedGrid_createOffsetList_CS::FPermutationDomain permutationVector;
+		permutationVector.Set<FHashedGrid_createOffsetList_CS::FKeyValueDim>(keyValues);
+
+		TShaderMapRef<FHashedGrid_createOffsetList_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), permutationVector);
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(numItems)
+		);
+	}
+}
@@ -0,0 +1,78 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+#include "RHICommandList.h"
+
+#include "GPUSpatialIndex.h"
+#include "GPURadixSort.h"
+
+// A hashed grid over a buffer of float4 positions (see HashedGrid.usf). Build it once per frame, then look up the items
+// in a cell with cellOffsetBuffer and particleIndexBuffer.
+struct UNREALGPUSWARM_API FGPUHashedGrid : public FGPUSpatialIndex
+{
+public:
+	// Allocate the grid buffers for up to maxItems items, over a grid of gridDimensions.
+	virtual void init(uint32 maxItems) override;
+
+	void init(uint32 maxItems, FIntVector dimensions);
+
+	// Bin the first numItems positions into cells of cellSize, sort particleIndexBuffer by cell and build the cell
+	// offsets and occupancy masks.
+	virtual void build(
+		uint32 numItems,
+		FUnorderedAccessViewRHIRef positions,
+		FRHICommandListImmediate& commands
+	) override;
+
+	void build(
+		uint32 numItems,
+		float cellSize,
+		FUnorderedAccessViewRHIRef positions,
+		FRHICommandListImmediate& commands
+	);
+
+	uint32 cellOffsetBufferSize() const { return gridDimensions.X * gridDimensions.Y * gridDimensions.Z; }
+
+	// The number of 4x4x4 occupancy blocks along each axis of the grid
+	FIntVector blockDimensions() const;
+
+	uint32 cellOccupancyBufferSize() const { return (cellOffsetBufferSize() + 31) / 32; }
+
+	uint32 blockOccupancyBufferSize() const;
+
+public:
+	FIntVector gridDimensions = FIntVector(0, 0, 0);
+	float cellSize = 1.0f;
+
+	// Sort packed (cell index, particle index) pairs rather than gathering the cell indices through the particle index
+	// buffer on every compare.
+	bool sortKeyValues = true;
+
+	// Sort the (cell index, particle index) pairs with the radix sort instead of the bitonic sort, its cost follows the
+	// number of items and the bits of the cell index rather than the next power of two. Implies sortKeyValues.
+	bool radixSort = false;
+
+	FStructuredBufferRHIRef cellIndexBuffer;
+	FUnorderedAccessViewRHIRef cellIndexBufferUAV;
+
+	// The sorted (cell index, particle index) pairs, when sortKeyValues
+	FStructuredBufferRHIRef cellKeyValueBuffer;
+	FUnorderedAccessViewRHIRef cellKeyValueBufferUAV;
+
+	FStructuredBufferRHIRef cellOffsetBuffer;
+	FUnorderedAccessViewRHIRef cellOffsetBufferUAV;
+
+	// One bit per cell and one bit per 4x4x4 block of cells, rebuilt with the cell offset buffer
+	FStructuredBufferRHIRef cellOccupancyBuffer;
+	FUnorderedAccessViewRHIRef cellOccupancyBufferUAV;
+
+	FStructuredBufferRHIRef blockOccupancyBuffer;
+	FUnorderedAccessViewRHIRef blockOccupancyBufferUAV;
+
+protected:
+	// Allocated on the first build with radixSort
+	FGPURadixSort _radixSort;
+};
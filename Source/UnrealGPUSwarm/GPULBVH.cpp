@@ -0,0 +1,385 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "GPULBVH.h"
+
+#include "ShaderParameterUtils.h"
+#include "RHIStaticStates.h"
+#include "Shader.h"
+#include "GlobalShader.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+#include "UniformBuffer.h"
+#include "RHICommandList.h"
+
+class FLBVH_reset_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FLBVH_reset_CS);
+	SHADER_USE_PARAMETER_STRUCT(FLBVH_reset_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numLBVHItems)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, lbvhParents)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, lbvhFlags)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FLBVH_reset_CS, "/ComputeShaderPlugin/LBVH.usf", "resetLBVH", SF_Compute);
+
+class FLBVH_computeMortonCodes_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FLBVH_computeMortonCodes_CS);
+	SHADER_USE_PARAMETER_STRUCT(FLBVH_computeMortonCodes_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numLBVHItems)
+		SHADER_PARAMETER(FVector, lbvhBoundsMin)
+		SHADER_PARAMETER(FVector, lbvhBoundsSizeReciprocal)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, lbvhKeyValues)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FLBVH_computeMortonCodes_CS, "/ComputeShaderPlugin/LBVH.usf", "computeMortonCodes", SF_Compute);
+
+class FLBVH_buildNodes_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FLBVH_buildNodes_CS);
+	SHADER_USE_PARAMETER_STRUCT(FLBVH_buildNodes_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numLBVHItems)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, lbvhKeyValues)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, lbvhChildren)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, lbvhParents)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FLBVH_buildNodes_CS, "/ComputeShaderPlugin/LBVH.usf", "buildLBVHNodes", SF_Compute);
+
+class FLBVH_computeBounds_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FLBVH_computeBounds_CS);
+	SHADER_USE_PARAMETER_STRUCT(FLBVH_computeBounds_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numLBVHItems)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, lbvhKeyValues)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, lbvhChildren)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, lbvhParents)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, lbvhFlags)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, lbvhNodeMin)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, lbvhNodeMax)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FLBVH_computeBounds_CS, "/ComputeShaderPlugin/LBVH.usf", "computeLBVHBounds", SF_Compute);
+
+class FLBVH_kNearest_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FLBVH_kNearest_CS);
+	SHADER_USE_PARAMETER_STRUCT(FLBVH_kNearest_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, numLBVHItems)
+		SHADER_PARAMETER(float, lbvhMaxRadius)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, lbvhChildren)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, lbvhNodeMin)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, lbvhNodeMax)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, knnIndices)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float>, knnDistances)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FLBVH_kNearest_CS, "/ComputeShaderPlugin/LBVH.usf", "lbvhKNearest", SF_Compute);
+
+
+
+static FIntVector groupSize(int numElements, int threadCount = 256)
+{
+	int count = ((numElements - 1) / threadCount) + 1;
+
+	return FIntVector(count, 1, 1);
+}
+
+// Matches the uint2 of lbvhChildren
+struct FChildren
+{
+	uint32 left = 0;
+	uint32 right = 0;
+};
+
+// Matches the uint2 of lbvhKeyValues
+struct FMortonKeyValue
+{
+	uint32 mortonCode = 0;
+	uint32 item = 0;
+};
+
+template<typename T>
+static void createStructuredBuffer(uint32 numElements, const T& initialValue, FStructuredBufferRHIRef& buffer, FUnorderedAccessViewRHIRef& uav)
+{
+	const size_t size = sizeof(T);
+
+	TResourceArray<T> resourceArray;
+	resourceArray.Init(initialValue, numElements);
+
+	FRHIResourceCreateInfo createInfo;
+	createInfo.ResourceArray = &resourceArray;
+
+	buffer = RHICreateStructuredBuffer(size, size * numElements, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+	uav = RHICreateUnorderedAccessView(buffer, false, false);
+}
+
+void FGPULBVH::init(uint32 maxItems_in)
+{
+	// the traversal stack in LBVH.usf is sized for this many items
+	check(maxItems_in <= (1u << maxItemBits));
+
+	maxItems = FMath::Max(maxItems_in, 1u);
+	numItems = 0;
+
+	// particleIndexBuffer
+	{
+		TResourceArray<uint32_t> resourceArray;
+		resourceArray.Init(0, maxItems);
+
+		for (uint32 i = 0; i < maxItems; ++i)
+			resourceArray[i] = i;
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &resourceArray;
+
+		const size_t size = sizeof(uint32_t);
+
+		particleIndexBuffer = RHICreateStructuredBuffer(size, size * maxItems, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+		particleIndexBufferUAV = RHICreateUnorderedAccessView(particleIndexBuffer, false, false);
+	}
+
+	createStructuredBuffer<FMortonKeyValue>(maxItems, FMortonKeyValue(), keyValueBuffer, keyValueBufferUAV);
+
+	_radixSort.init(maxItems);
+
+	// the internal nodes, there's always at least one so the buffers are never empty
+	createStructuredBuffer<FChildren>(maxItems, FChildren(), childrenBuffer, childrenBufferUAV);
+	createStructuredBuffer<uint32>(maxItems, 0, flagBuffer, flagBufferUAV);
+
+	// all of the nodes
+	createStructuredBuffer<uint32>(numNodes(), 0xffffffff, parentBuffer, parentBufferUAV);
+	createStructuredBuffer<FVector4>(numNodes(), FVector4(0.0f, 0.0f, 0.0f, 0.0f), nodeMinBuffer, nodeMinBufferUAV);
+	createStructuredBuffer<FVector4>(numNodes(), FVector4(0.0f, 0.0f, 0.0f, 0.0f), nodeMaxBuffer, nodeMaxBufferUAV);
+}
+
+void FGPULBVH::build(
+	uint32 numItems_in,
+	FUnorderedAccessViewRHIRef positions,
+	FRHICommandListImmediate& commands)
+{
+	check(numItems_in <= maxItems);
+
+	numItems = numItems_in;
+
+	if (numItems == 0)
+		return;
+
+	// reset the arrival flags and the root's parent
+	{
+		FLBVH_reset_CS::FParameters parameters;
+		parameters.numLBVHItems = numItems;
+		parameters.lbvhParents = parentBufferUAV;
+		parameters.lbvhFlags = flagBufferUAV;
+
+		TShaderMapRef<FLBVH_reset_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(numItems)
+		);
+	}
+
+	// Morton codes
+	{
+		const FVector size = bounds.GetSize().ComponentMax(FVector(KINDA_SMALL_NUMBER));
+
+		FLBVH_computeMortonCodes_CS::FParameters parameters;
+		parameters.numLBVHItems = numItems;
+		parameters.lbvhBoundsMin = bounds.Min;
+		parameters.lbvhBoundsSizeReciprocal = FVector(1.0f) / size;
+		parameters.positions = positions;
+		parameters.lbvhKeyValues = keyValueBufferUAV;
+
+		TShaderMapRef<FLBVH_computeMortonCodes_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(numItems)
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			keyValueBufferUAV
+		);
+	}
+
+	// sort the (Morton code, item) pairs, computeLBVHBounds unpacks the items into the particle index buffer
+	_radixSort.sortKeyValues(
+		numItems,
+		mortonBits,
+		keyValueBufferUAV,
+		commands
+	);
+
+	// the hierarchy, one thread per internal node
+	if (numItems > 1)
+	{
+		FLBVH_buildNodes_CS::FParameters parameters;
+		parameters.numLBVHItems = numItems;
+		parameters.lbvhKeyValues = keyValueBufferUAV;
+		parameters.lbvhChildren = childrenBufferUAV;
+		parameters.lbvhParents = parentBufferUAV;
+
+		TShaderMapRef<FLBVH_buildNodes_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(numItems - 1)
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			childrenBufferUAV
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			parentBufferUAV
+		);
+	}
+
+	// the bounds, bottom up
+	{
+		FLBVH_computeBounds_CS::FParameters parameters;
+		parameters.numLBVHItems = numItems;
+		parameters.positions = positions;
+		parameters.particleIndexBuffer = particleIndexBufferUAV;
+		parameters.lbvhKeyValues = keyValueBufferUAV;
+		parameters.lbvhChildren = childrenBufferUAV;
+		parameters.lbvhParents = parentBufferUAV;
+		parameters.lbvhFlags = flagBufferUAV;
+		parameters.lbvhNodeMin = nodeMinBufferUAV;
+		parameters.lbvhNodeMax = nodeMaxBufferUAV;
+
+		TShaderMapRef<FLBVH_computeBounds_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(numItems)
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			nodeMinBufferUAV
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			nodeMaxBufferUAV
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			particleIndexBufferUAV
+		);
+	}
+}
+
+void FGPULBVH::queryKNearest(
+	float maxRadius,
+	FUnorderedAccessViewRHIRef positions,
+	FUnorderedAccessViewRHIRef indices_out,
+	FUnorderedAccessViewRHIRef distances_out,
+	FRHICommandListImmediate& commands)
+{
+	if (numItems == 0)
+		return;
+
+	FLBVH_kNearest_CS::FParameters parameters;
+	parameters.numLBVHItems = numItems;
+	parameters.lbvhMaxRadius = maxRadius;
+	parameters.positions = positions;
+	parameters.particleIndexBuffer = particleIndexBufferUAV;
+	parameters.lbvhChildren = childrenBufferUAV;
+	parameters.lbvhNodeMin = nodeMinBufferUAV;
+	parameters.lbvhNodeMax = nodeMaxBufferUAV;
+	parameters.knnIndices = indices_out;
+	parameters.knnDistances = distances_out;
+
+	TShaderMapRef<FLBVH_kNearest_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+	FComputeShaderUtils::Dispatch(
+		commands,
+		*computeShader,
+		parameters,
+		groupSize(numItems, 64)
+	);
+
+	commands.TransitionResource(
+		EResourceTransitionAccess::ERWBarrier,
+		EResourceTransitionPipeline::EComputeToCompute,
+		indices_out
+	);
+}
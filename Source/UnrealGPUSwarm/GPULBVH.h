@@ -0,0 +1,77 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+#include "RHICommandList.h"
+
+#include "GPUSpatialIndex.h"
+#include "GPURadixSort.h"
+
+// A linear BVH over the Morton codes of a buffer of float4 positions (see LBVH.usf). Unlike the hashed grid its cost
+// doesn't depend on how the items are spread over the grid, so it holds up better for tightly clustered flocks.
+//
+// Positions are quantised to 10 bits per axis inside bounds (30 bit Morton codes), items outside of bounds are clamped
+// to its faces. That only costs traversal time, never correctness. The (code, item) pairs are sorted with the radix
+// sort.
+struct UNREALGPUSWARM_API FGPULBVH : public FGPUSpatialIndex
+{
+public:
+	virtual void init(uint32 maxItems) override;
+
+	// Compute the Morton codes, sort the items by them and build the hierarchy and its bounds.
+	virtual void build(
+		uint32 numItems,
+		FUnorderedAccessViewRHIRef positions,
+		FRHICommandListImmediate& commands
+	) override;
+
+	// Render thread, the LBVH_K (8) nearest neighbours within maxRadius of each of the items in the last build. Writes
+	// LBVH_K indices and distances per item, unused slots are 0xffffffff.
+	void queryKNearest(
+		float maxRadius,
+		FUnorderedAccessViewRHIRef positions,
+		FUnorderedAccessViewRHIRef indices_out,
+		FUnorderedAccessViewRHIRef distances_out,
+		FRHICommandListImmediate& commands
+	);
+
+	static constexpr uint32 k = 8;
+
+	static constexpr uint32 mortonBits = 30;
+
+	// The most items is 2^maxItemBits, the traversal stack in LBVH.usf is sized for the depth of such a tree
+	static constexpr uint32 maxItemBits = 24;
+
+	uint32 numNodes() const { return FMath::Max(2 * maxItems - 1, 1u); }
+
+public:
+	FBox bounds = FBox(FVector(-2000.0f), FVector(2000.0f));
+
+	uint32 numItems = 0;
+
+	// The (Morton code, item) pairs, sorted by code after a build
+	FStructuredBufferRHIRef keyValueBuffer;
+	FUnorderedAccessViewRHIRef keyValueBufferUAV;
+
+	// Per internal node, the left and right children. Indices >= numItems - 1 are leaves.
+	FStructuredBufferRHIRef childrenBuffer;
+	FUnorderedAccessViewRHIRef childrenBufferUAV;
+
+	FStructuredBufferRHIRef parentBuffer;
+	FUnorderedAccessViewRHIRef parentBufferUAV;
+
+	FStructuredBufferRHIRef flagBuffer;
+	FUnorderedAccessViewRHIRef flagBufferUAV;
+
+	// Per node, the min and max corners of its bounding box
+	FStructuredBufferRHIRef nodeMinBuffer;
+	FUnorderedAccessViewRHIRef nodeMinBufferUAV;
+
+	FStructuredBufferRHIRef nodeMaxBuffer;
+	FUnorderedAccessViewRHIRef nodeMaxBufferUAV;
+
+protected:
+	FGPURadixSort _radixSort;
+};
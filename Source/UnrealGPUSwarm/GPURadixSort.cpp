@@ -0,0 +1,513 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "GPURadixSort.h"
+
+#include "ShaderParameterUtils.h"
+#include "RHIStaticStates.h"
+#include "Shader.h"
+#include "GlobalShader.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+#include "UniformBuffer.h"
+#include "RHICommandList.h"
+
+class FRadixSort_prepare_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FRadixSort_prepare_CS);
+	SHADER_USE_PARAMETER_STRUCT(FRadixSort_prepare_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, maxItems)
+		SHADER_PARAMETER(uint32, itemCount)
+		SHADER_PARAMETER(uint32, useItemCountBuffer)
+		SHADER_PARAMETER(uint32, itemCountOffset)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, itemCountBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, radixSortState)
+		SHADER_PARAMETER_UAV(RWBuffer<uint>, radixSortArgs)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FRadixSort_prepare_CS, "/ComputeShaderPlugin/RadixSort.usf", "radixSortPrepare", SF_Compute);
+
+class FRadixSort_count_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FRadixSort_count_CS);
+	SHADER_USE_PARAMETER_STRUCT(FRadixSort_count_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, radixShift)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, radixSortState)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, keyValuesIn)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, radixHistograms)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FRadixSort_count_CS, "/ComputeShaderPlugin/RadixSort.usf", "radixSortCount", SF_Compute);
+
+class FRadixSort_scan_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FRadixSort_scan_CS);
+	SHADER_USE_PARAMETER_STRUCT(FRadixSort_scan_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, radixSortState)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, radixHistograms)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FRadixSort_scan_CS, "/ComputeShaderPlugin/RadixSort.usf", "radixSortScan", SF_Compute);
+
+class FRadixSort_scatter_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FRadixSort_scatter_CS);
+	SHADER_USE_PARAMETER_STRUCT(FRadixSort_scatter_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, radixShift)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, radixSortState)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, keyValuesIn)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, keyValuesOut)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, radixHistograms)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FRadixSort_scatter_CS, "/ComputeShaderPlugin/RadixSort.usf", "radixSortScatter", SF_Compute);
+
+class FRadixSort_copy_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FRadixSort_copy_CS);
+	SHADER_USE_PARAMETER_STRUCT(FRadixSort_copy_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, radixSortState)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, keyValuesIn)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, keyValuesOut)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FRadixSort_copy_CS, "/ComputeShaderPlugin/RadixSort.usf", "radixSortCopy", SF_Compute);
+
+class FRadixSort_tagSegments_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FRadixSort_tagSegments_CS);
+	SHADER_USE_PARAMETER_STRUCT(FRadixSort_tagSegments_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, itemCount)
+		SHADER_PARAMETER(uint32, numSegments)
+		SHADER_PARAMETER(uint32, segmentKeyBits)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, sortSegments)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, segmentGapKeys)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, segmentKeyValues)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FRadixSort_tagSegments_CS, "/ComputeShaderPlugin/RadixSort.usf", "radixSortTagSegments", SF_Compute);
+
+class FRadixSort_untagSegments_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FRadixSort_untagSegments_CS);
+	SHADER_USE_PARAMETER_STRUCT(FRadixSort_untagSegments_CS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(uint32, itemCount)
+		SHADER_PARAMETER(uint32, segmentKeyBits)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, segmentGapKeys)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, segmentKeyValues)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FRadixSort_untagSegments_CS, "/ComputeShaderPlugin/RadixSort.usf", "radixSortUntagSegments", SF_Compute);
+
+
+
+static FIntVector groupSize(int numElements)
+{
+	const int threadCount = 256;
+
+	int count = ((numElements - 1) / threadCount) + 1;
+
+	return FIntVector(count, 1, 1);
+}
+
+static void createStructuredBuffer(uint32 numWords, uint32 stride, FStructuredBufferRHIRef& buffer, FUnorderedAccessViewRHIRef& uav)
+{
+	const size_t size = sizeof(uint32_t);
+
+	TResourceArray<uint32_t> resourceArray;
+	resourceArray.Init(0, numWords);
+
+	FRHIResourceCreateInfo createInfo;
+	createInfo.ResourceArray = &resourceArray;
+
+	buffer = RHICreateStructuredBuffer(stride, size * numWords, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+	uav = RHICreateUnorderedAccessView(buffer, false, false);
+}
+
+void FGPURadixSort::init(uint32 maxItems_in)
+{
+	maxItems = FMath::Max(maxItems_in, 1u);
+
+	const uint32 radix = 1 << radixBits;
+
+	createStructuredBuffer(maxItems * 2, sizeof(uint32_t) * 2, tempBuffer, tempBufferUAV);
+	createStructuredBuffer(numBlocks() * radix, sizeof(uint32_t), histogramBuffer, histogramBufferUAV);
+	createStructuredBuffer(2, sizeof(uint32_t), stateBuffer, stateBufferUAV);
+	createStructuredBuffer(maxItems, sizeof(uint32_t), gapKeyBuffer, gapKeyBufferUAV);
+
+	// indirect dispatch arguments
+	{
+		const size_t size = sizeof(uint32_t);
+
+		TResourceArray<uint32_t> argsArray;
+		argsArray.Init(1, 3);
+
+		FRHIResourceCreateInfo createInfo;
+		createInfo.ResourceArray = &argsArray;
+
+		argsBuffer = RHICreateVertexBuffer(size * 3, BUF_Static | BUF_DrawIndirect | BUF_UnorderedAccess, createInfo);
+		argsBufferUAV = RHICreateUnorderedAccessView(argsBuffer, PF_R32_UINT);
+	}
+}
+
+void FGPURadixSort::sortKeyValues(
+	uint32 numItems,
+	uint32 keyBits,
+	FUnorderedAccessViewRHIRef keyValueBuffer_readWrite,
+	FRHICommandListImmediate& commands)
+{
+	_sort(numItems, nullptr, 0, keyBits, keyValueBuffer_readWrite, commands);
+}
+
+void FGPURadixSort::sortKeyValues(
+	FUnorderedAccessViewRHIRef itemCountBuffer,
+	uint32 itemCountOffset,
+	uint32 keyBits,
+	FUnorderedAccessViewRHIRef keyValueBuffer_readWrite,
+	FRHICommandListImmediate& commands)
+{
+	_sort(0, itemCountBuffer, itemCountOffset, keyBits, keyValueBuffer_readWrite, commands);
+}
+
+void FGPURadixSort::_sort(
+	uint32 numItems,
+	FUnorderedAccessViewRHIRef itemCountBuffer,
+	uint32 itemCountOffset,
+	uint32 keyBits,
+	FUnorderedAccessViewRHIRef keyValueBuffer,
+	FRHICommandListImmediate& commands)
+{
+	check(isInitialized());
+
+	const bool countOnGPU = itemCountBuffer.IsValid();
+
+	if (!countOnGPU && numItems == 0)
+		return;
+
+	// read the item count and build the indirect arguments, the previous sort left them readable
+	{
+		commands.TransitionResource(
+			EResourceTransitionAccess::EWritable,
+			EResourceTransitionPipeline::EComputeToCompute,
+			argsBufferUAV
+		);
+
+		FRadixSort_prepare_CS::FParameters parameters;
+		parameters.maxItems = maxItems;
+		parameters.itemCount = numItems;
+		parameters.useItemCountBuffer = countOnGPU ? 1 : 0;
+		parameters.itemCountOffset = itemCountOffset;
+
+		// the count buffer isn't read without useItemCountBuffer, but it has to be bound
+		parameters.itemCountBuffer = countOnGPU ? itemCountBuffer : stateBufferUAV;
+		parameters.radixSortState = stateBufferUAV;
+		parameters.radixSortArgs = argsBufferUAV;
+
+		TShaderMapRef<FRadixSort_prepare_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			FIntVector(1, 1, 1)
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			stateBufferUAV
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::EReadable,
+			EResourceTransitionPipeline::EComputeToCompute,
+			argsBufferUAV
+		);
+	}
+
+	const uint32 numPasses = FMath::DivideAndRoundUp(FMath::Clamp(keyBits, 1u, 32u), radixBits);
+
+	FUnorderedAccessViewRHIRef from = keyValueBuffer;
+	FUnorderedAccessViewRHIRef to = tempBufferUAV;
+
+	for (uint32 pass = 0; pass < numPasses; ++pass)
+	{
+		const uint32 shift = pass * radixBits;
+
+		// count the digits per block
+		{
+			FRadixSort_count_CS::FParameters parameters;
+			parameters.radixShift = shift;
+			parameters.radixSortState = stateBufferUAV;
+			parameters.keyValuesIn = from;
+			parameters.radixHistograms = histogramBufferUAV;
+
+			TShaderMapRef<FRadixSort_count_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::DispatchIndirect(
+				commands,
+				*computeShader,
+				parameters,
+				argsBuffer,
+				0
+			);
+
+			commands.TransitionResource(
+				EResourceTransitionAccess::ERWBarrier,
+				EResourceTransitionPipeline::EComputeToCompute,
+				histogramBufferUAV
+			);
+		}
+
+		// the digit offsets of every block
+		{
+			FRadixSort_scan_CS::FParameters parameters;
+			parameters.radixSortState = stateBufferUAV;
+			parameters.radixHistograms = histogramBufferUAV;
+
+			TShaderMapRef<FRadixSort_scan_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::Dispatch(
+				commands,
+				*computeShader,
+				parameters,
+				FIntVector(1, 1, 1)
+			);
+
+			commands.TransitionResource(
+				EResourceTransitionAccess::ERWBarrier,
+				EResourceTransitionPipeline::EComputeToCompute,
+				histogramBufferUAV
+			);
+		}
+
+		// scatter
+		{
+			FRadixSort_scatter_CS::FParameters parameters;
+			parameters.radixShift = shift;
+			parameters.radixSortState = stateBufferUAV;
+			parameters.keyValuesIn = from;
+			parameters.keyValuesOut = to;
+			parameters.radixHistograms = histogramBufferUAV;
+
+			TShaderMapRef<FRadixSort_scatter_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			FComputeShaderUtils::DispatchIndirect(
+				commands,
+				*computeShader,
+				parameters,
+				argsBuffer,
+				0
+			);
+
+			commands.TransitionResource(
+				EResourceTransitionAccess::ERWBarrier,
+				EResourceTransitionPipeline::EComputeToCompute,
+				to
+			);
+		}
+
+		Swap(from, to);
+	}
+
+	// an odd number of passes leaves the result in the temp buffer
+	if (from != keyValueBuffer)
+	{
+		FRadixSort_copy_CS::FParameters parameters;
+		parameters.radixSortState = stateBufferUAV;
+		parameters.keyValuesIn = from;
+		parameters.keyValuesOut = keyValueBuffer;
+
+		TShaderMapRef<FRadixSort_copy_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::DispatchIndirect(
+			commands,
+			*computeShader,
+			parameters,
+			argsBuffer,
+			0
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			keyValueBuffer
+		);
+	}
+}
+
+void FGPURadixSort::sortSegments(
+	const TArray<FGPUSortSegment>& segments_in,
+	uint32 keyBits,
+	FUnorderedAccessViewRHIRef keyValueBuffer,
+	FRHICommandListImmediate& commands)
+{
+	check(isInitialized());
+
+	TArray<FGPUSortSegment> segments;
+
+	for (const FGPUSortSegment& segment : segments_in)
+	{
+		if (segment.count > 0)
+			segments.Add(segment);
+	}
+
+	if (segments.Num() == 0)
+		return;
+
+	segments.Sort([](const FGPUSortSegment& a, const FGPUSortSegment& b) { return a.offset < b.offset; });
+
+	uint32 end = 0;
+
+	for (const FGPUSortSegment& segment : segments)
+	{
+		checkf(segment.offset >= end, TEXT("FGPURadixSort::sortSegments, the segments overlap"));
+
+		end = segment.offset + segment.count;
+	}
+
+	check(end <= maxItems);
+
+	const uint32 numSegments = segments.Num();
+	const uint32 regionBits = FMath::CeilLogTwo(2 * numSegments + 1);
+
+	keyBits = FMath::Clamp(keyBits, 1u, 32u);
+
+	checkf(keyBits + regionBits <= 32, TEXT("FGPURadixSort::sortSegments, %d key bits and %d segments don't fit in 32 bits"), keyBits, numSegments);
+
+	// upload the segments
+	if (numSegments > segmentCapacity)
+	{
+		segmentCapacity = FMath::RoundUpToPowerOfTwo(numSegments);
+
+		createStructuredBuffer(segmentCapacity * 2, sizeof(uint32_t) * 2, segmentBuffer, segmentBufferUAV);
+	}
+
+	{
+		void * segmentData = RHILockStructuredBuffer(segmentBuffer, 0, sizeof(FGPUSortSegment) * numSegments, RLM_WriteOnly);
+		FMemory::Memcpy(segmentData, segments.GetData(), sizeof(FGPUSortSegment) * numSegments);
+		RHIUnlockStructuredBuffer(segmentBuffer);
+	}
+
+	// tag the keys with their regions
+	{
+		FRadixSort_tagSegments_CS::FParameters parameters;
+		parameters.itemCount = end;
+		parameters.numSegments = numSegments;
+		parameters.segmentKeyBits = keyBits;
+
+		parameters.sortSegments = segmentBufferUAV;
+		parameters.segmentGapKeys = gapKeyBufferUAV;
+		parameters.segmentKeyValues = keyValueBuffer;
+
+		TShaderMapRef<FRadixSort_tagSegments_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(end)
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			keyValueBuffer
+		);
+	}
+
+	_sort(end, nullptr, 0, keyBits + regionBits, keyValueBuffer, commands);
+
+	// restore the keys
+	{
+		FRadixSort_untagSegments_CS::FParameters parameters;
+		parameters.itemCount = end;
+		parameters.segmentKeyBits = keyBits;
+
+		parameters.segmentGapKeys = gapKeyBufferUAV;
+		parameters.segmentKeyValues = keyValueBuffer;
+
+		TShaderMapRef<FRadixSort_untagSegments_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+		FComputeShaderUtils::Dispatch(
+			commands,
+			*computeShader,
+			parameters,
+			groupSize(end)
+		);
+
+		commands.TransitionResource(
+			EResourceTransitionAccess::ERWBarrier,
+			EResourceTransitionPipeline::EComputeToCompute,
+			keyValueBuffer
+		);
+	}
+}
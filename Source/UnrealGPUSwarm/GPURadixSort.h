@@ -0,0 +1,96 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+#include "RHICommandList.h"
+
+// A run of items [offset, offset + count) that is sorted on its own
+struct FGPUSortSegment
+{
+	uint32 offset = 0;
+	uint32 count = 0;
+};
+
+// A stable LSD radix sort of packed (key, value) uint2 pairs (see RadixSort.usf). Its cost follows the number of items
+// and the number of key bits, there is no padding to a power of two. The item count can be read on the GPU, so a
+// count produced by another pass never has to come back to the CPU.
+struct UNREALGPUSWARM_API FGPURadixSort
+{
+public:
+	// Allocate the scratch buffers for up to maxItems pairs.
+	void init(uint32 maxItems);
+
+	bool isInitialized() const { return maxItems > 0; }
+
+	// Sort the first numItems pairs by the low keyBits bits of their keys.
+	void sortKeyValues(
+		uint32 numItems,
+		uint32 keyBits,
+		FUnorderedAccessViewRHIRef keyValueBuffer_readWrite,
+		FRHICommandListImmediate& commands
+	);
+
+	// Sort the first itemCountBuffer[itemCountOffset] pairs, clamped to maxItems, by the low keyBits bits of their keys.
+	void sortKeyValues(
+		FUnorderedAccessViewRHIRef itemCountBuffer,
+		uint32 itemCountOffset,
+		uint32 keyBits,
+		FUnorderedAccessViewRHIRef keyValueBuffer_readWrite,
+		FRHICommandListImmediate& commands
+	);
+
+	// Sort each of the segments of keyValueBuffer independently, in one sequence of passes. Many small swarms sharing a
+	// buffer then pay for one sort instead of one each. The keys in the segments must fit in keyBits bits, and keyBits
+	// plus the bits of 2 * segments.Num() + 1 must fit in 32. The segments must not overlap, the items between them are
+	// left as they are.
+	void sortSegments(
+		const TArray<FGPUSortSegment>& segments,
+		uint32 keyBits,
+		FUnorderedAccessViewRHIRef keyValueBuffer_readWrite,
+		FRHICommandListImmediate& commands
+	);
+
+	static constexpr uint32 radixBits = 4;
+	static constexpr uint32 blockSize = 1024;
+
+	uint32 numBlocks() const { return (maxItems + blockSize - 1) / blockSize; }
+
+protected:
+	void _sort(
+		uint32 numItems,
+		FUnorderedAccessViewRHIRef itemCountBuffer,
+		uint32 itemCountOffset,
+		uint32 keyBits,
+		FUnorderedAccessViewRHIRef keyValueBuffer,
+		FRHICommandListImmediate& commands
+	);
+
+public:
+	uint32 maxItems = 0;
+
+	// The ping-pong partner of the caller's buffer
+	FStructuredBufferRHIRef tempBuffer;
+	FUnorderedAccessViewRHIRef tempBufferUAV;
+
+	// Per digit, per block, the digit counts and then their offsets
+	FStructuredBufferRHIRef histogramBuffer;
+	FUnorderedAccessViewRHIRef histogramBufferUAV;
+
+	// The item count and the number of blocks, as read on the GPU
+	FStructuredBufferRHIRef stateBuffer;
+	FUnorderedAccessViewRHIRef stateBufferUAV;
+
+	FVertexBufferRHIRef argsBuffer;
+	FUnorderedAccessViewRHIRef argsBufferUAV;
+
+	// Segmented sorts, the segments and the keys of the items between them
+	uint32 segmentCapacity = 0;
+
+	FStructuredBufferRHIRef segmentBuffer;
+	FUnorderedAccessViewRHIRef segmentBufferUAV;
+
+	FStructuredBufferRHIRef gapKeyBuffer;
+	FUnorderedAccessViewRHIRef gapKeyBufferUAV;
+};
@@ -0,0 +1,33 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+#include "RHICommandList.h"
+
+// A spatial index over a buffer of float4 positions, rebuilt every frame. Every index sorts the items spatially into
+// particleIndexBuffer, the simulation also uses that order to rearrange the boids for cache coherence.
+struct UNREALGPUSWARM_API FGPUSpatialIndex
+{
+public:
+	virtual ~FGPUSpatialIndex() {}
+
+	// Allocate the buffers for up to maxItems items.
+	virtual void init(uint32 maxItems) = 0;
+
+	// Index the first numItems positions.
+	virtual void build(
+		uint32 numItems,
+		FUnorderedAccessViewRHIRef positions,
+		FRHICommandListImmediate& commands
+	) = 0;
+
+	bool isInitialized() const { return particleIndexBuffer.IsValid(); }
+
+public:
+	uint32 maxItems = 0;
+
+	FStructuredBufferRHIRef particleIndexBuffer;
+	FUnorderedAccessViewRHIRef particleIndexBufferUAV;
+};
@@ -0,0 +1,275 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#include "GPUSpatialIndexBenchmark.h"
+
+#include "ShaderParameterUtils.h"
+#include "RHIStaticStates.h"
+#include "Shader.h"
+#include "GlobalShader.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+#include "UniformBuffer.h"
+#include "RHICommandList.h"
+
+#include "GPUHashedGrid.h"
+#include "GPULBVH.h"
+
+class FSpatialIndexBenchmark_countNeighbours_CS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FSpatialIndexBenchmark_countNeighbours_CS);
+	SHADER_USE_PARAMETER_STRUCT(FSpatialIndexBenchmark_countNeighbours_CS, FGlobalShader);
+
+	class FSpatialIndexDim : SHADER_PERMUTATION_BOOL("USE_LBVH");
+
+	using FPermutationDomain = TShaderPermutationDomain<FSpatialIndexDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER(float, queryRadius)
+
+		SHADER_PARAMETER(uint32, numParticles)
+		SHADER_PARAMETER(float, cellSizeReciprocal)
+		SHADER_PARAMETER(uint32, cellOffsetBufferSize)
+		SHADER_PARAMETER(FIntVector, gridDimensions)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, positions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, particleIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellIndexBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOffsetBuffer)
+
+		SHADER_PARAMETER(FIntVector, blockDimensions)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, cellOccupancyBuffer)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, blockOccupancyBuffer)
+
+		SHADER_PARAMETER(uint32, numLBVHItems)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint2>, lbvhChildren)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, lbvhNodeMin)
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<float4>, lbvhNodeMax)
+
+		SHADER_PARAMETER_UAV(RWStructuredBuffer<uint32>, neighbourCounts)
+	END_SHADER_PARAMETER_STRUCT()
+
+public:
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+	}
+};
+
+IMPLEMENT_GLOBAL_SHADER(FSpatialIndexBenchmark_countNeighbours_CS, "/ComputeShaderPlugin/SpatialIndexBenchmark.usf", "countNeighbours", SF_Compute);
+
+
+
+static FIntVector groupSize(int numElements)
+{
+	const int threadCount = 256;
+
+	int count = ((numElements - 1) / threadCount) + 1;
+
+	return FIntVector(count, 1, 1);
+}
+
+void FGPUSpatialIndexBenchmark::uniformPositions(uint32 numItems, float extent, FRandomStream& random, TArray<FVector4>& positions_out)
+{
+	positions_out.SetNumUninitialized(numItems);
+
+	const float half = extent * 0.5f;
+
+	for (uint32 i = 0; i < numItems; ++i)
+	{
+		positions_out[i] = FVector4(
+			random.FRandRange(-half, half),
+			random.FRandRange(-half, half),
+			random.FRandRange(-half, half),
+			0.0f
+		);
+	}
+}
+
+void FGPUSpatialIndexBenchmark::clusteredPositions(uint32 numItems, float extent, FRandomStream& random, TArray<FVector4>& positions_out)
+{
+	positions_out.SetNumUninitialized(numItems);
+
+	const float half = extent * 0.5f;
+
+	const int32 numClusters = 8;
+	const float clusterSigma = extent * 0.02f;
+
+	TArray<FVector> centres;
+
+	for (int32 c = 0; c < numClusters; ++c)
+		centres.Add(FVector(random.FRandRange(-half, half), random.FRandRange(-half, half), random.FRandRange(-half, half)) * 0.8f);
+
+	for (uint32 i = 0; i < numItems; ++i)
+	{
+		FVector p;
+
+		// 5% stragglers
+		if (random.FRand() < 0.05f)
+		{
+			p = FVector(random.FRandRange(-half, half), random.FRandRange(-half, half), random.FRandRange(-half, half));
+		}
+		else
+		{
+			// Box-Muller
+			const FVector& centre = centres[random.RandHelper(numClusters)];
+
+			FVector gaussian;
+
+			for (int32 axis = 0; axis < 3; ++axis)
+			{
+				const float u = FMath::Max(random.FRand(), SMALL_NUMBER);
+				const float v = random.FRand();
+
+				gaussian[axis] = FMath::Sqrt(-2.0f * FMath::Loge(u)) * FMath::Cos(2.0f * PI * v);
+			}
+
+			p = centre + gaussian * clusterSigma;
+		}
+
+		p = p.BoundToCube(half);
+
+		positions_out[i] = FVector4(p, 0.0f);
+	}
+}
+
+void FGPUSpatialIndexBenchmark::run(
+	uint32 numItems,
+	float extent,
+	float radius,
+	int32 repetitions,
+	FRHICommandListImmediate& commands,
+	TArray<FResult>& results_out)
+{
+	numItems = FMath::Max(numItems, 1u);
+	repetitions = FMath::Max(repetitions, 1);
+
+	const size_t positionSize = sizeof(FVector4);
+	const size_t countSize = sizeof(uint32);
+
+	FRHIResourceCreateInfo createInfo;
+
+	FStructuredBufferRHIRef positionBuffer = RHICreateStructuredBuffer(positionSize, positionSize * numItems, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+	FUnorderedAccessViewRHIRef positionBufferUAV = RHICreateUnorderedAccessView(positionBuffer, false, false);
+
+	FStructuredBufferRHIRef countBuffer = RHICreateStructuredBuffer(countSize, countSize * numItems, BUF_UnorderedAccess | BUF_ShaderResource, createInfo);
+	FUnorderedAccessViewRHIRef countBufferUAV = RHICreateUnorderedAccessView(countBuffer, false, false);
+
+	// one cell per radius, with enough cells that the hash never wraps inside the cube
+	const int32 cellsPerSide = FMath::Min(FMath::CeilToInt(extent / radius) + 3, 256);
+
+	FGPUHashedGrid grid;
+	grid.init(numItems, FIntVector(cellsPerSide));
+	grid.cellSize = radius;
+
+	FGPULBVH lbvh;
+	lbvh.bounds = FBox(FVector(-extent * 0.5f), FVector(extent * 0.5f));
+	lbvh.init(numItems);
+
+	FRandomStream random(1337);
+
+	const TCHAR * distributions[] = { TEXT("uniform"), TEXT("clustered") };
+
+	for (const TCHAR * distribution : distributions)
+	{
+		TArray<FVector4> positions;
+
+		if (FCString::Strcmp(distribution, TEXT("uniform")) == 0)
+			uniformPositions(numItems, extent, random, positions);
+		else
+			clusteredPositions(numItems, extent, random, positions);
+
+		void * positionData = RHILockStructuredBuffer(positionBuffer, 0, positionSize * numItems, RLM_WriteOnly);
+		FMemory::Memcpy(positionData, positions.GetData(), positionSize * numItems);
+		RHIUnlockStructuredBuffer(positionBuffer);
+
+		for (int32 useLBVH = 0; useLBVH < 2; ++useLBVH)
+		{
+			FGPUSpatialIndex& index = useLBVH ? static_cast<FGPUSpatialIndex&>(lbvh) : static_cast<FGPUSpatialIndex&>(grid);
+
+			FRenderQueryRHIRef startQuery = RHICreateRenderQuery(RQT_AbsoluteTime);
+			FRenderQueryRHIRef builtQuery = RHICreateRenderQuery(RQT_AbsoluteTime);
+			FRenderQueryRHIRef queriedQuery = RHICreateRenderQuery(RQT_AbsoluteTime);
+
+			commands.EndRenderQuery(startQuery);
+
+			for (int32 r = 0; r < repetitions; ++r)
+				index.build(numItems, positionBufferUAV, commands);
+
+			commands.EndRenderQuery(builtQuery);
+
+			for (int32 r = 0; r < repetitions; ++r)
+			{
+				FSpatialIndexBenchmark_countNeighbours_CS::FParameters parameters;
+				parameters.queryRadius = radius;
+
+				parameters.numParticles = numItems;
+				parameters.cellSizeReciprocal = 1.0f / radius;
+				parameters.cellOffsetBufferSize = grid.cellOffsetBufferSize();
+				parameters.gridDimensions = grid.gridDimensions;
+
+				parameters.positions = positionBufferUAV;
+				parameters.particleIndexBuffer = index.particleIndexBufferUAV;
+				parameters.cellIndexBuffer = grid.cellIndexBufferUAV;
+				parameters.cellOffsetBuffer = grid.cellOffsetBufferUAV;
+
+				parameters.blockDimensions = grid.blockDimensions();
+				parameters.cellOccupancyBuffer = grid.cellOccupancyBufferUAV;
+				parameters.blockOccupancyBuffer = grid.blockOccupancyBufferUAV;
+
+				parameters.numLBVHItems = numItems;
+				parameters.lbvhChildren = lbvh.childrenBufferUAV;
+				parameters.lbvhNodeMin = lbvh.nodeMinBufferUAV;
+				parameters.lbvhNodeMax = lbvh.nodeMaxBufferUAV;
+
+				parameters.neighbourCounts = countBufferUAV;
+
+				FSpatialIndexBenchmark_countNeighbours_CS::FPermutationDomain permutationVector;
+				permutationVector.Set<FSpatialIndexBenchmark_countNeighbours_CS::FSpatialIndexDim>(useLBVH != 0);
+
+				TShaderMapRef<FSpatialIndexBenchmark_countNeighbours_CS> computeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), permutationVector);
+				FComputeShaderUtils::Dispatch(
+					commands,
+					*computeShader,
+					parameters,
+					groupSize(numItems)
+				);
+
+				commands.TransitionResource(
+					EResourceTransitionAccess::ERWBarrier,
+					EResourceTransitionPipeline::EComputeToCompute,
+					countBufferUAV
+				);
+			}
+
+			commands.EndRenderQuery(queriedQuery);
+
+			// the readback waits for the GPU
+			FResult result;
+			result.distribution = distribution;
+			result.index = useLBVH ? TEXT("LBVH") : TEXT("HashedGrid");
+
+			const uint32 * counts = (const uint32*)RHILockStructuredBuffer(countBuffer, 0, countSize * numItems, RLM_ReadOnly);
+
+			for (uint32 i = 0; i < numItems; ++i)
+				result.neighbourCount += counts[i];
+
+			RHIUnlockStructuredBuffer(countBuffer);
+
+			// absolute time queries are in microseconds
+			uint64 start = 0, built = 0, queried = 0;
+
+			if (GSupportsTimestampRenderQueries
+				&& RHIGetRenderQueryResult(startQuery, start, true)
+				&& RHIGetRenderQueryResult(builtQuery, built, true)
+				&& RHIGetRenderQueryResult(queriedQuery, queried, true))
+			{
+				result.buildMilliseconds = float(built - start) / (1000.0f * repetitions);
+				result.queryMilliseconds = float(queried - built) / (1000.0f * repetitions);
+			}
+
+			results_out.Add(result);
+		}
+	}
+}
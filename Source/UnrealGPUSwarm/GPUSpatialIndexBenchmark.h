@@ -0,0 +1,41 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+#include "RHICommandList.h"
+
+// Times the hashed grid against the LBVH, building each index and counting the neighbours within a radius of every
+// item, on a uniform and on a clustered distribution of positions. The neighbour counts of both indices must agree.
+struct UNREALGPUSWARM_API FGPUSpatialIndexBenchmark
+{
+public:
+	struct FResult
+	{
+		FString distribution;
+		FString index;
+
+		// GPU time, averaged over the repetitions. Zero when the RHI has no timestamp queries.
+		float buildMilliseconds = 0.0f;
+		float queryMilliseconds = 0.0f;
+
+		// The sum of the neighbour counts, for validation
+		uint64 neighbourCount = 0;
+	};
+
+	// Render thread, benchmark numItems items in a cube of side extent, with neighbours within radius
+	static void run(
+		uint32 numItems,
+		float extent,
+		float radius,
+		int32 repetitions,
+		FRHICommandListImmediate& commands,
+		TArray<FResult>& results_out
+	);
+
+	static void uniformPositions(uint32 numItems, float extent, FRandomStream& random, TArray<FVector4>& positions_out);
+
+	// A few tight gaussian clusters and some stragglers, like a real flock
+	static void clusteredPositions(uint32 numItems, float extent, FRandomStream& random, TArray<FVector4>& positions_out);
+};
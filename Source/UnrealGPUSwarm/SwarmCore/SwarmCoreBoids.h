@@ -0,0 +1,596 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "SwarmCoreGrid.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SWARMCORE_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SWARMCORE_NEON 1
+#endif
+
+namespace SwarmCore
+{
+	struct Vec3
+	{
+		float x = 0.0f;
+		float y = 0.0f;
+		float z = 0.0f;
+
+		Vec3() = default;
+		Vec3(float x_in, float y_in, float z_in) : x(x_in), y(y_in), z(z_in) {}
+
+		Vec3 operator+(const Vec3& o) const { return Vec3(x + o.x, y + o.y, z + o.z); }
+		Vec3 operator-(const Vec3& o) const { return Vec3(x - o.x, y - o.y, z - o.z); }
+		Vec3 operator-() const { return Vec3(-x, -y, -z); }
+		Vec3 operator*(float s) const { return Vec3(x * s, y * s, z * s); }
+		Vec3 operator/(float s) const { return Vec3(x / s, y / s, z / s); }
+
+		Vec3& operator+=(const Vec3& o) { x += o.x; y += o.y; z += o.z; return *this; }
+		Vec3& operator-=(const Vec3& o) { x -= o.x; y -= o.y; z -= o.z; return *this; }
+	};
+
+	// Layout compatible with float4 and FVector4
+	struct Float4
+	{
+		float x;
+		float y;
+		float z;
+		float w;
+	};
+
+	// Boid.usf's helpers
+	inline float dot(const Vec3& a, const Vec3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	inline Vec3 cross(const Vec3& a, const Vec3& b)
+	{
+		return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+
+	inline float length(const Vec3& v)
+	{
+		return std::sqrt(dot(v, v));
+	}
+
+	inline Vec3 lerp(const Vec3& a, const Vec3& b, float t)
+	{
+		return a + (b - a) * t;
+	}
+
+	inline float lerp(float a, float b, float t)
+	{
+		return a + (b - a) * t;
+	}
+
+	inline Vec3 safeNormal(const Vec3& vec, const Vec3& safe)
+	{
+		const float l = length(vec);
+
+		return l > 0.0f ? vec / l : safe;
+	}
+
+	inline Vec3 toSimulationPlane(const Vec3& v, bool planar2D)
+	{
+		return planar2D ? Vec3(v.x, v.y, 0.0f) : v;
+	}
+
+	inline float hash(float n)
+	{
+		const float s = std::sin(n) * 43758.5453f;
+
+		return s - std::floor(s);
+	}
+
+	// In the range 0 to 1
+	inline float noise1(const Vec3& x)
+	{
+		const Vec3 p(std::floor(x.x), std::floor(x.y), std::floor(x.z));
+		Vec3 f = x - p;
+
+		f = Vec3(f.x * f.x * (3.0f - 2.0f * f.x), f.y * f.y * (3.0f - 2.0f * f.y), f.z * f.z * (3.0f - 2.0f * f.z));
+		const float n = p.x + p.y * 57.0f + 113.0f * p.z;
+
+		return lerp(
+			lerp(lerp(hash(n + 0.0f), hash(n + 1.0f), f.x), lerp(hash(n + 57.0f), hash(n + 58.0f), f.x), f.y),
+			lerp(lerp(hash(n + 113.0f), hash(n + 114.0f), f.x), lerp(hash(n + 170.0f), hash(n + 171.0f), f.x), f.y),
+			f.z
+		);
+	}
+
+	// Rotate the unit vector a towards the unit vector b by the fraction t of the angle between them
+	inline Vec3 slerpUnit(const Vec3& a, Vec3 b, float t)
+	{
+		float cosAngle = dot(a, b);
+		cosAngle = cosAngle < -1.0f ? -1.0f : (cosAngle > 1.0f ? 1.0f : cosAngle);
+
+		if (cosAngle > 0.9995f)
+			return safeNormal(lerp(a, b, t), a);
+
+		// opposite directions, turn about any axis perpendicular to a
+		if (cosAngle < -0.9995f)
+		{
+			const Vec3 axis = std::fabs(a.x) < 0.9f ? Vec3(1.0f, 0.0f, 0.0f) : Vec3(0.0f, 1.0f, 0.0f);
+			b = safeNormal(cross(a, axis), a);
+			cosAngle = 0.0f;
+			t *= 2.0f;
+		}
+
+		const float angle = std::acos(cosAngle);
+		const Vec3 perpendicular = safeNormal(b - a * cosAngle, a);
+
+		return a * std::cos(angle * t) + perpendicular * std::sin(angle * t);
+	}
+
+	// Must match MAX_SPECIES in Boid.usf
+	static const int32_t maxSpecies = 4;
+
+	inline int32_t speciesOf(float w)
+	{
+		const int32_t s = int32_t(w);
+
+		return s < 0 ? 0 : (s > maxSpecies - 1 ? maxSpecies - 1 : s);
+	}
+
+	// Must match the BOID_RULE_* defines in Boid.usf
+	static const uint32_t ruleSeparation = 1;
+	static const uint32_t ruleAlignment = 2;
+	static const uint32_t ruleCohesion = 4;
+	static const uint32_t ruleHome = 8;
+	static const uint32_t ruleExternal = 16; // not simulated by the core, FCPUBoidSimulation applies the influencers
+
+	// Must match the INTEGRATOR_* defines in Boid.usf
+	static const uint32_t integratorEuler = 0;
+	static const uint32_t integratorSemiImplicit = 1;
+	static const uint32_t integratorRK2 = 2;
+
+	// The uniforms of one step, Boid.usf's parameters
+	struct BoidParameters
+	{
+		float dt = 0.0f;
+		float totalTime = 0.0f;
+
+		float boidSpeed = 10.0f;
+		float boidSpeedVariation = 1.0f;
+		float boidRotationSpeed = 10.0f;
+
+		float neighbourhoodDistance = 10.0f;
+		float separationDistance = 3.0f;
+		float homeInnerRadius = 200.0f;
+
+		float homeUrge = 0.1f;
+		float separationUrge = 0.1f;
+		float cohesionUrge = 0.01f;
+		float alignmentUrge = 0.1f;
+
+		// A mask of the rule* bits, the external rule needs textures and the GPU
+		uint32_t ruleMask = ruleSeparation | ruleAlignment | ruleCohesion | ruleHome;
+
+		uint32_t integrator = integratorEuler;
+
+		// Simulate in the xy plane, like the PLANAR_2D shaders. Must match the grid's shape.
+		bool planar2D = false;
+
+		// The boids whose steering is updated this step
+		uint32_t sliceOffset = 0;
+		uint32_t sliceSize = 0xFFFFFFFF;
+
+		int32_t numSpecies = 1;
+		float speciesSpeedScale[maxSpecies] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+		// Row-major by the boid's species and then its neighbour's, (separation, alignment, cohesion, pursuit)
+		Float4 speciesInteractions[maxSpecies * maxSpecies];
+
+		BoidParameters()
+		{
+			for (Float4& interaction : speciesInteractions)
+				interaction = Float4{ 1.0f, 1.0f, 1.0f, 0.0f };
+		}
+	};
+
+	// The boids as separate arrays of components, the distance tests read four positions at a time
+	struct BoidsSoA
+	{
+		float * px = nullptr;
+		float * py = nullptr;
+		float * pz = nullptr;
+		float * pw = nullptr; // the species
+
+		float * dx = nullptr;
+		float * dy = nullptr;
+		float * dz = nullptr;
+		float * dw = nullptr; // the boid's id
+
+		// the steering from the last neighbour update
+		float * sx = nullptr;
+		float * sy = nullptr;
+		float * sz = nullptr;
+
+		Vec3 position(uint32_t i) const { return Vec3(px[i], py[i], pz[i]); }
+		Vec3 direction(uint32_t i) const { return Vec3(dx[i], dy[i], dz[i]); }
+		Vec3 steering(uint32_t i) const { return Vec3(sx[i], sy[i], sz[i]); }
+		int32_t species(uint32_t i) const { return speciesOf(pw[i]); }
+
+		void setPosition(uint32_t i, const Vec3& v) const { px[i] = v.x; py[i] = v.y; pz[i] = v.z; }
+		void setDirection(uint32_t i, const Vec3& v) const { dx[i] = v.x; dy[i] = v.y; dz[i] = v.z; }
+		void setSteering(uint32_t i, const Vec3& v) const { sx[i] = v.x; sy[i] = v.y; sz[i] = v.z; }
+
+		PositionStream positions() const { return PositionStream{ px, py, pz, 1 }; }
+	};
+
+	// The boids as float4s, like the GPU buffers
+	struct BoidsAoS
+	{
+		Float4 * positionData = nullptr;  // w is the species
+		Float4 * directionData = nullptr; // w is the boid's id
+		Float4 * steeringData = nullptr;
+
+		Vec3 position(uint32_t i) const { return Vec3(positionData[i].x, positionData[i].y, positionData[i].z); }
+		Vec3 direction(uint32_t i) const { return Vec3(directionData[i].x, directionData[i].y, directionData[i].z); }
+		Vec3 steering(uint32_t i) const { return Vec3(steeringData[i].x, steeringData[i].y, steeringData[i].z); }
+		int32_t species(uint32_t i) const { return speciesOf(positionData[i].w); }
+
+		void setPosition(uint32_t i, const Vec3& v) const { positionData[i].x = v.x; positionData[i].y = v.y; positionData[i].z = v.z; }
+		void setDirection(uint32_t i, const Vec3& v) const { directionData[i].x = v.x; directionData[i].y = v.y; directionData[i].z = v.z; }
+		void setSteering(uint32_t i, const Vec3& v) const { steeringData[i].x = v.x; steeringData[i].y = v.y; steeringData[i].z = v.z; }
+
+		PositionStream positions() const { return PositionStream{ &positionData[0].x, &positionData[0].y, &positionData[0].z, 4 }; }
+	};
+
+	// Call visit(j, distSqrd) for the boids j in [begin, end) closer than sqrt(radiusSqrd) to a. zScale is 0 in the
+	// plane. The SoA positions are tested four at a time, most of the boids in a stencil are out of range.
+	template<typename Visit>
+	void forEachInRange(const BoidsSoA& boids, uint32_t begin, uint32_t end, const Vec3& a, float radiusSqrd, float zScale, const Visit& visit)
+	{
+		uint32_t j = begin;
+
+#if SWARMCORE_SSE
+		const __m128 ax = _mm_set1_ps(a.x);
+		const __m128 ay = _mm_set1_ps(a.y);
+		const __m128 az = _mm_set1_ps(a.z);
+		const __m128 zs = _mm_set1_ps(zScale);
+		const __m128 r2 = _mm_set1_ps(radiusSqrd);
+
+		for (; j + 4 <= end; j += 4)
+		{
+			const __m128 dx = _mm_sub_ps(_mm_loadu_ps(boids.px + j), ax);
+			const __m128 dy = _mm_sub_ps(_mm_loadu_ps(boids.py + j), ay);
+			const __m128 dz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boids.pz + j), az), zs);
+
+			const __m128 distSqrd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+			const int hits = _mm_movemask_ps(_mm_cmplt_ps(distSqrd, r2));
+
+			if (hits == 0)
+				continue;
+
+			float distances[4];
+			_mm_storeu_ps(distances, distSqrd);
+
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				if (hits & (1 << lane))
+					visit(j + lane, distances[lane]);
+			}
+		}
+#elif SWARMCORE_NEON
+		const float32x4_t ax = vdupq_n_f32(a.x);
+		const float32x4_t ay = vdupq_n_f32(a.y);
+		const float32x4_t az = vdupq_n_f32(a.z);
+		const float32x4_t zs = vdupq_n_f32(zScale);
+		const float32x4_t r2 = vdupq_n_f32(radiusSqrd);
+
+		for (; j + 4 <= end; j += 4)
+		{
+			const float32x4_t dx = vsubq_f32(vld1q_f32(boids.px + j), ax);
+			const float32x4_t dy = vsubq_f32(vld1q_f32(boids.py + j), ay);
+			const float32x4_t dz = vmulq_f32(vsubq_f32(vld1q_f32(boids.pz + j), az), zs);
+
+			const float32x4_t distSqrd = vmlaq_f32(vmlaq_f32(vmulq_f32(dx, dx), dy, dy), dz, dz);
+
+			uint32_t hits[4];
+			vst1q_u32(hits, vcltq_f32(distSqrd, r2));
+
+			if ((hits[0] | hits[1] | hits[2] | hits[3]) == 0)
+				continue;
+
+			float distances[4];
+			vst1q_f32(distances, distSqrd);
+
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				if (hits[lane])
+					visit(j + lane, distances[lane]);
+			}
+		}
+#endif
+
+		for (; j < end; ++j)
+		{
+			const float dx = boids.px[j] - a.x;
+			const float dy = boids.py[j] - a.y;
+			const float dz = (boids.pz[j] - a.z) * zScale;
+
+			const float distSqrd = dx * dx + dy * dy + dz * dz;
+
+			if (distSqrd < radiusSqrd)
+				visit(j, distSqrd);
+		}
+	}
+
+	// The AoS positions are strided, one test at a time
+	template<typename Visit>
+	void forEachInRange(const BoidsAoS& boids, uint32_t begin, uint32_t end, const Vec3& a, float radiusSqrd, float zScale, const Visit& visit)
+	{
+		for (uint32_t j = begin; j < end; ++j)
+		{
+			const Float4& p = boids.positionData[j];
+
+			const float dx = p.x - a.x;
+			const float dy = p.y - a.y;
+			const float dz = (p.z - a.z) * zScale;
+
+			const float distSqrd = dx * dx + dy * dy + dz * dz;
+
+			if (distSqrd < radiusSqrd)
+				visit(j, distSqrd);
+		}
+	}
+
+	// The boids per parallel-for task
+	static const uint32_t boidBatchSize = 1024;
+
+	// GridNeighboursBoidUpdate. The boids must be in the grid's sorted order, so that a cell's boids are the range
+	// [cellOffsets[cell], cellEnds[cellOffsets[cell]]) of the boids. The neighbour ranges are reused while consecutive
+	// boids are in the same cell.
+	template<typename Boids, typename ParallelFor = SerialFor>
+	void updateSteering(
+		const GridShape& shape,
+		NeighbourScan scan,
+		const uint32_t * cellOffsets,
+		const uint32_t * cellEnds,
+		const Boids& boids,
+		uint32_t numBoids,
+		const BoidParameters& p,
+		const ParallelFor& parallelFor = ParallelFor()
+	)
+	{
+		const bool separation = (p.ruleMask & ruleSeparation) != 0;
+		const bool alignment = (p.ruleMask & ruleAlignment) != 0;
+		const bool cohesion = (p.ruleMask & ruleCohesion) != 0;
+		const bool home = (p.ruleMask & ruleHome) != 0;
+
+		const bool useSpecies = p.numSpecies > 1;
+		const bool useNeighbours = separation || alignment || cohesion || useSpecies;
+
+		const float zScale = p.planar2D ? 0.0f : 1.0f;
+		const float radiusSqrd = p.neighbourhoodDistance * p.neighbourhoodDistance;
+
+		const Float4 defaultInteraction = { 1.0f, 1.0f, 1.0f, 0.0f };
+
+		const uint32_t sliceBegin = p.sliceOffset < numBoids ? p.sliceOffset : numBoids;
+		const uint32_t sliceCount = p.sliceSize < numBoids - sliceBegin ? p.sliceSize : numBoids - sliceBegin;
+
+		forEachChunk(parallelFor, sliceCount, boidBatchSize, [&](uint32_t batchBegin, uint32_t batchEnd)
+		{
+			NeighbourRanges ranges;
+
+			int32_t rangesCell[3] = { 0, 0, 0 };
+			bool hasRanges = false;
+
+			for (uint32_t i = sliceBegin + batchBegin; i < sliceBegin + batchEnd; ++i)
+			{
+				const Vec3 position_a = toSimulationPlane(boids.position(i), p.planar2D);
+				const int32_t species_a = boids.species(i);
+
+				Vec3 separationSum;
+				Vec3 alignmentSum;
+				Vec3 centre = position_a;
+				float cohesionWeight = 1.0f;
+
+				Vec3 pursuit;
+				uint32_t pursuitCount = 0;
+
+				auto visit = [&](uint32_t b, float distSqrd)
+				{
+					if (b == i)
+						return;
+
+					const float dist = std::sqrt(distSqrd);
+					const Vec3 position_b = toSimulationPlane(boids.position(b), p.planar2D);
+
+					const Float4& interaction = useSpecies ? p.speciesInteractions[species_a * maxSpecies + boids.species(b)] : defaultInteraction;
+
+					if (cohesion)
+					{
+						centre += position_b * interaction.z;
+						cohesionWeight += interaction.z;
+					}
+
+					if (alignment)
+						alignmentSum += boids.direction(b) * interaction.y;
+
+					const Vec3 dir = position_b - position_a;
+
+					if (separation && dist < p.separationDistance && dist > 0.0f)
+						separationSum -= (dir / dist) * ((p.separationDistance - dist) * interaction.x);
+
+					if (useSpecies && interaction.w != 0.0f && dist > 0.0f)
+					{
+						pursuit += (dir / dist) * interaction.w;
+						pursuitCount++;
+					}
+				};
+
+				if (useNeighbours)
+				{
+					int32_t cell[3];
+					shape.cellOf(position_a.x, position_a.y, position_a.z, cell);
+
+					if (!hasRanges || cell[0] != rangesCell[0] || cell[1] != rangesCell[1] || cell[2] != rangesCell[2])
+					{
+						neighbourRanges(shape, scan, cell, cellOffsets, cellEnds, ranges);
+
+						rangesCell[0] = cell[0];
+						rangesCell[1] = cell[1];
+						rangesCell[2] = cell[2];
+						hasRanges = true;
+					}
+
+					for (int32_t r = 0; r < ranges.count; ++r)
+						forEachInRange(boids, ranges.begins[r], ranges.ends[r], position_a, radiusSqrd, zScale, visit);
+				}
+
+				Vec3 cohesionDirection;
+
+				if (cohesionWeight > 0.0f)
+					cohesionDirection = centre * (1.0f / cohesionWeight) - position_a;
+
+				const Vec3 alignmentDirection = safeNormal(alignmentSum, Vec3());
+
+				Vec3 homeDirection;
+
+				if (home && length(position_a) > p.homeInnerRadius)
+					homeDirection = safeNormal(-position_a, Vec3());
+
+				Vec3 newDirection = alignmentDirection * p.alignmentUrge
+					+ separationSum * p.separationUrge
+					+ cohesionDirection * p.cohesionUrge
+					+ homeDirection * p.homeUrge;
+
+				if (pursuitCount > 0)
+					newDirection += pursuit * (1.0f / float(pursuitCount));
+
+				boids.setSteering(i, toSimulationPlane(newDirection, p.planar2D));
+			}
+		});
+	}
+
+	// IntegrateBoidPosition, turn towards the steering and move
+	template<typename Boids, typename ParallelFor = SerialFor>
+	void integrate(const Boids& boids, uint32_t numBoids, const BoidParameters& p, const ParallelFor& parallelFor = ParallelFor())
+	{
+		const float dt = p.dt;
+
+		forEachChunk(parallelFor, numBoids, boidBatchSize, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				const Vec3 steering = boids.steering(i);
+				const Vec3 previousDirection = boids.direction(i);
+
+				Vec3 direction = previousDirection;
+
+				// the direction we move along during this step
+				Vec3 moveDirection;
+
+				if (p.integrator == integratorEuler)
+				{
+					const float ip = std::exp(-p.boidRotationSpeed * dt);
+
+					direction = safeNormal(lerp(steering, direction, ip), previousDirection);
+
+					moveDirection = direction;
+				}
+				else
+				{
+					const Vec3 target = safeNormal(steering, direction);
+
+					// turn at a rate proportional to the steering, the turned fraction is exact for any dt
+					const float steeringLength = length(steering);
+					const float rate = p.boidRotationSpeed * (steeringLength < 1.0f ? steeringLength : 1.0f);
+
+					const Vec3 turned = slerpUnit(direction, target, 1.0f - std::exp(-rate * dt));
+
+					// RK2 moves along the heading at the middle of the step
+					if (p.integrator == integratorRK2)
+						moveDirection = slerpUnit(direction, target, 1.0f - std::exp(-rate * dt * 0.5f));
+					else
+						moveDirection = turned;
+
+					direction = turned;
+				}
+
+				if (p.planar2D)
+				{
+					direction = safeNormal(toSimulationPlane(direction, true), safeNormal(toSimulationPlane(previousDirection, true), Vec3(1.0f, 0.0f, 0.0f)));
+					moveDirection = safeNormal(toSimulationPlane(moveDirection, true), direction);
+				}
+
+				boids.setDirection(i, direction);
+
+				const float noiseOffset = hash(float(i));
+				const float n = p.totalTime / 100.0f + noiseOffset;
+
+				float noise = noise1(Vec3(n, n, n));
+				noise = (noise < -1.0f ? -1.0f : (noise > 1.0f ? 1.0f : noise)) * 2.0f - 1.0f;
+
+				const float velocity = p.boidSpeed * (1.0f + noise * p.boidSpeedVariation) * p.speciesSpeedScale[boids.species(i)];
+
+				Vec3 velocityVector = moveDirection * velocity;
+
+				if (p.planar2D)
+					velocityVector.z = 0.0f;
+
+				boids.setPosition(i, boids.position(i) + velocityVector * dt);
+			}
+		});
+	}
+
+	// The number of neighbours within radius of each of the first numQueries boids, the query cost of the grid alone
+	template<typename Boids, typename ParallelFor = SerialFor>
+	uint64_t countNeighbours(
+		const GridShape& shape,
+		NeighbourScan scan,
+		const uint32_t * cellOffsets,
+		const uint32_t * cellEnds,
+		const Boids& boids,
+		uint32_t numQueries,
+		float radius,
+		const ParallelFor& parallelFor = ParallelFor()
+	)
+	{
+		const float zScale = shape.planar2D ? 0.0f : 1.0f;
+		const uint32_t numBatches = divideAndRoundUp(numQueries, boidBatchSize);
+
+		std::vector<uint64_t> counts(numBatches, 0);
+
+		parallelFor(numBatches, [&](uint32_t batch)
+		{
+			const uint32_t begin = batch * boidBatchSize;
+			const uint32_t end = numQueries - begin < boidBatchSize ? numQueries : begin + boidBatchSize;
+
+			NeighbourRanges ranges;
+			uint64_t count = 0;
+
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				const Vec3 a = toSimulationPlane(boids.position(i), shape.planar2D);
+
+				int32_t cell[3];
+				shape.cellOf(a.x, a.y, a.z, cell);
+
+				neighbourRanges(shape, scan, cell, cellOffsets, cellEnds, ranges);
+
+				for (int32_t r = 0; r < ranges.count; ++r)
+					forEachInRange(boids, ranges.begins[r], ranges.ends[r], a, radius * radius, zScale, [&](uint32_t j, float) { count += j != i ? 1 : 0; });
+			}
+
+			counts[batch] = count;
+		});
+
+		uint64_t total = 0;
+
+		for (uint64_t count : counts)
+			total += count;
+
+		return total;
+	}
+}
@@ -0,0 +1,395 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "SwarmCoreSort.h"
+
+#include <cmath>
+
+namespace SwarmCore
+{
+	static const uint32_t emptyCell = 0xFFFFFFFF;
+
+	// How a cell's coordinates become its key in the offset buffer
+	enum class CellKey : uint8_t
+	{
+		// HashedGrid.usf's x + y * X + z * X * Y, wrapped to the grid's size
+		Linear,
+		// The coordinates wrapped to a power of two and interleaved (Morton order), neighbouring cells get close keys
+		// along every axis
+		Morton
+	};
+
+	enum class GridSort : uint8_t
+	{
+		Radix,
+		Counting,
+		Bitonic
+	};
+
+	// How a query walks the cells around a point
+	enum class NeighbourScan : uint8_t
+	{
+		// Each of the 27 cells of the stencil (9 in the plane), like the GPU
+		Cells,
+		// Each row of three cells along x as one range of the sorted items, 9 ranges (3 in the plane). Linear keys only,
+		// the cells of a row have consecutive keys.
+		Ranges
+	};
+
+	// Positions read from three strided arrays, a stride of 1 for separate arrays and 4 for arrays of float4s
+	struct PositionStream
+	{
+		const float * x = nullptr;
+		const float * y = nullptr;
+		const float * z = nullptr;
+		uint32_t stride = 1;
+	};
+
+	struct GridShape
+	{
+		// For planar grids the z dimension is 1
+		int32_t dimensions[3] = { 256, 256, 256 };
+		float cellSize = 1.0f;
+
+		// Hash on xy only, like the PLANAR_2D shaders
+		bool planar2D = false;
+
+		CellKey key = CellKey::Linear;
+
+		// The bits per axis of a Morton key, enough for the largest dimension
+		uint32_t mortonBits() const
+		{
+			int32_t largest = dimensions[0] > dimensions[1] ? dimensions[0] : dimensions[1];
+
+			if (!planar2D && dimensions[2] > largest)
+				largest = dimensions[2];
+
+			const uint32_t bits = ceilLogTwo(uint32_t(largest));
+
+			// the key has to fit in 32 bits, with room for emptyCell
+			const uint32_t maxBits = planar2D ? 15 : 10;
+
+			return bits < maxBits ? bits : maxBits;
+		}
+
+		// The size of the offset buffer
+		uint32_t numCells() const
+		{
+			if (key == CellKey::Morton)
+				return uint32_t(1) << (mortonBits() * (planar2D ? 2 : 3));
+
+			return uint32_t(dimensions[0]) * uint32_t(dimensions[1]) * uint32_t(planar2D ? 1 : dimensions[2]);
+		}
+
+		void cellOf(float x, float y, float z, int32_t cell[3]) const
+		{
+			const float cellSizeReciprocal = 1.0f / cellSize;
+
+			cell[0] = int32_t(std::floor(x * cellSizeReciprocal));
+			cell[1] = int32_t(std::floor(y * cellSizeReciprocal));
+			cell[2] = planar2D ? 0 : int32_t(std::floor(z * cellSizeReciprocal));
+		}
+
+		uint32_t flatIndex(int32_t x, int32_t y, int32_t z) const
+		{
+			if (key == CellKey::Morton)
+				return mortonIndex(x, y, z);
+
+			const int64_t size = numCells();
+
+			const int64_t n = int64_t(x) + int64_t(y) * dimensions[0] + int64_t(z) * dimensions[0] * dimensions[1];
+
+			// HashedGrid.usf wraps with a float modulo, this is the exact integer modulo it approximates
+			return uint32_t(((n % size) + size) % size);
+		}
+
+		uint32_t mortonIndex(int32_t x, int32_t y, int32_t z) const
+		{
+			const uint32_t mask = (uint32_t(1) << mortonBits()) - 1;
+
+			// two's complement, the and wraps negative coordinates too
+			if (planar2D)
+				return spreadBy1(uint32_t(x) & mask) | (spreadBy1(uint32_t(y) & mask) << 1);
+
+			return spreadBy2(uint32_t(x) & mask) | (spreadBy2(uint32_t(y) & mask) << 1) | (spreadBy2(uint32_t(z) & mask) << 2);
+		}
+
+		// 16 bits to the even bits
+		static uint32_t spreadBy1(uint32_t v)
+		{
+			v &= 0x0000FFFF;
+			v = (v | (v << 8)) & 0x00FF00FF;
+			v = (v | (v << 4)) & 0x0F0F0F0F;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+
+			return v;
+		}
+
+		// 10 bits to every third bit
+		static uint32_t spreadBy2(uint32_t v)
+		{
+			v &= 0x000003FF;
+			v = (v | (v << 16)) & 0x030000FF;
+			v = (v | (v << 8)) & 0x0300F00F;
+			v = (v | (v << 4)) & 0x030C30C3;
+			v = (v | (v << 2)) & 0x09249249;
+
+			return v;
+		}
+	};
+
+	// createUnsortedList, the cell of every item, and the (cell, item) pairs to sort
+	template<typename ParallelFor = SerialFor>
+	void assignCells(
+		const GridShape& shape,
+		uint32_t numItems,
+		const PositionStream& positions,
+		uint32_t * cellIndices,
+		uint32_t * keys,
+		uint32_t * values,
+		const ParallelFor& parallelFor = ParallelFor()
+	)
+	{
+		forEachChunk(parallelFor, numItems, 4096, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				const size_t p = size_t(i) * positions.stride;
+
+				int32_t cell[3];
+				shape.cellOf(positions.x[p], positions.y[p], positions.z[p], cell);
+
+				const uint32_t flatCellIndex = shape.flatIndex(cell[0], cell[1], cell[2]);
+
+				cellIndices[i] = flatCellIndex;
+				keys[i] = flatCellIndex;
+				values[i] = i;
+			}
+		});
+	}
+
+	// The scratch the sorts need beyond the key and value scratch arrays
+	struct SortScratch
+	{
+		std::vector<uint32_t> counts;
+		std::vector<uint64_t> packed;
+	};
+
+	// Sort the (cell, item) pairs by cell. All three sorts keep the items of a cell in their order.
+	template<typename ParallelFor = SerialFor>
+	void sortCells(
+		GridSort sort,
+		uint32_t numItems,
+		uint32_t numCells,
+		uint32_t * keys,
+		uint32_t * values,
+		uint32_t * keysScratch,
+		uint32_t * valuesScratch,
+		SortScratch& scratch,
+		const ParallelFor& parallelFor = ParallelFor()
+	)
+	{
+		switch (sort)
+		{
+		case GridSort::Counting:
+			CountingSort::sortKeyValues(numItems, numCells, keys, values, keysScratch, valuesScratch, scratch.counts);
+			break;
+		case GridSort::Bitonic:
+			BitonicSort::sortKeyValues(numItems, keys, values, scratch.packed, parallelFor);
+			break;
+		default:
+			// the cell indices are below the offset buffer size
+			RadixSort::sortKeyValues(numItems, ceilLogTwo(numCells), keys, values, keysScratch, valuesScratch, parallelFor);
+			break;
+		}
+	}
+
+	// createOffsetList. Per cell the first index of its run in the sorted keys, or emptyCell, and at that index the end
+	// of the run (cellEnds may be null).
+	template<typename ParallelFor = SerialFor>
+	void buildCellOffsets(
+		uint32_t numItems,
+		const uint32_t * sortedKeys,
+		uint32_t numCells,
+		uint32_t * cellOffsets,
+		uint32_t * cellEnds,
+		const ParallelFor& parallelFor = ParallelFor()
+	)
+	{
+		forEachChunk(parallelFor, numCells, 1 << 16, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t cell = begin; cell < end; ++cell)
+				cellOffsets[cell] = emptyCell;
+		});
+
+		forEachChunk(parallelFor, numItems, 4096, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				if (i == 0 || sortedKeys[i - 1] != sortedKeys[i])
+					cellOffsets[sortedKeys[i]] = i;
+			}
+		});
+
+		if (!cellEnds)
+			return;
+
+		forEachChunk(parallelFor, numItems, 4096, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				if (i + 1 == numItems || sortedKeys[i + 1] != sortedKeys[i])
+					cellEnds[cellOffsets[sortedKeys[i]]] = i + 1;
+			}
+		});
+	}
+
+	// At most 27 ranges of sorted items that may hold the neighbours of a cell
+	struct NeighbourRanges
+	{
+		uint32_t begins[27];
+		uint32_t ends[27];
+		int32_t count = 0;
+	};
+
+	inline void neighbourRanges(
+		const GridShape& shape,
+		NeighbourScan scan,
+		const int32_t cell[3],
+		const uint32_t * cellOffsets,
+		const uint32_t * cellEnds,
+		NeighbourRanges& ranges
+	)
+	{
+		const int32_t stencilZ = shape.planar2D ? 0 : 1;
+		const bool rows = scan == NeighbourScan::Ranges && shape.key == CellKey::Linear;
+		const uint32_t numCells = shape.numCells();
+
+		ranges.count = 0;
+
+		for (int32_t z = -stencilZ; z <= stencilZ; ++z)
+		{
+			for (int32_t y = -1; y <= 1; ++y)
+			{
+				if (rows)
+				{
+					const uint32_t centre = shape.flatIndex(cell[0], cell[1] + y, cell[2] + z);
+
+					// the linear key of x + 1 is the key of x plus one, unless the row wraps around the buffer
+					if (centre > 0 && centre + 1 < numCells)
+					{
+						uint32_t begin = emptyCell;
+						uint32_t end = 0;
+
+						for (uint32_t key = centre - 1; key <= centre + 1; ++key)
+						{
+							const uint32_t first = cellOffsets[key];
+
+							if (first == emptyCell)
+								continue;
+
+							if (begin == emptyCell)
+								begin = first;
+
+							end = cellEnds[first];
+						}
+
+						if (begin != emptyCell)
+						{
+							ranges.begins[ranges.count] = begin;
+							ranges.ends[ranges.count] = end;
+							ranges.count++;
+						}
+
+						continue;
+					}
+				}
+
+				for (int32_t x = -1; x <= 1; ++x)
+				{
+					const uint32_t first = cellOffsets[shape.flatIndex(cell[0] + x, cell[1] + y, cell[2] + z)];
+
+					if (first == emptyCell)
+						continue;
+
+					ranges.begins[ranges.count] = first;
+					ranges.ends[ranges.count] = cellEnds[first];
+					ranges.count++;
+				}
+			}
+		}
+	}
+
+	// gather, to[i] = from[order[i]], rearrangePositions for one array
+	template<typename T, typename ParallelFor = SerialFor>
+	void gather(uint32_t numItems, const uint32_t * order, const T * from, T * to, const ParallelFor& parallelFor = ParallelFor())
+	{
+		forEachChunk(parallelFor, numItems, 4096, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+				to[i] = from[order[i]];
+		});
+	}
+
+	// A hashed grid that owns its buffers. particleIndices is sorted by cell, cellIndices is per item.
+	struct HashedGrid
+	{
+		GridShape shape;
+		GridSort sort = GridSort::Radix;
+
+		uint32_t numItems = 0;
+
+		std::vector<uint32_t> particleIndices;
+		std::vector<uint32_t> cellIndices;
+		std::vector<uint32_t> sortedKeys;
+		std::vector<uint32_t> cellOffsets;
+		std::vector<uint32_t> cellEnds;
+
+		std::vector<uint32_t> keysScratch;
+		std::vector<uint32_t> valuesScratch;
+		SortScratch sortScratch;
+
+		void init(uint32_t maxItems)
+		{
+			particleIndices.resize(maxItems);
+			cellIndices.resize(maxItems);
+			sortedKeys.resize(maxItems);
+			cellEnds.resize(maxItems);
+			keysScratch.resize(maxItems);
+			valuesScratch.resize(maxItems);
+
+			cellOffsets.assign(shape.numCells(), emptyCell);
+		}
+
+		// The three stages are separate so that they can be timed
+		template<typename ParallelFor = SerialFor>
+		void assign(uint32_t numItems_in, const PositionStream& positions, const ParallelFor& parallelFor = ParallelFor())
+		{
+			numItems = numItems_in;
+
+			assignCells(shape, numItems, positions, cellIndices.data(), sortedKeys.data(), particleIndices.data(), parallelFor);
+		}
+
+		template<typename ParallelFor = SerialFor>
+		void sortItems(const ParallelFor& parallelFor = ParallelFor())
+		{
+			sortCells(sort, numItems, shape.numCells(), sortedKeys.data(), particleIndices.data(), keysScratch.data(), valuesScratch.data(), sortScratch, parallelFor);
+		}
+
+		template<typename ParallelFor = SerialFor>
+		void buildOffsets(const ParallelFor& parallelFor = ParallelFor())
+		{
+			buildCellOffsets(numItems, sortedKeys.data(), shape.numCells(), cellOffsets.data(), cellEnds.data(), parallelFor);
+		}
+
+		template<typename ParallelFor = SerialFor>
+		void build(uint32_t numItems_in, const PositionStream& positions, const ParallelFor& parallelFor = ParallelFor())
+		{
+			assign(numItems_in, positions, parallelFor);
+			sortItems(parallelFor);
+			buildOffsets(parallelFor);
+		}
+	};
+}
@@ -0,0 +1,406 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+#include "SwarmCoreBoids.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace SwarmCore
+{
+	struct SDFGrid
+	{
+		int32_t resolution[3] = { 2, 2, 2 };
+		Vec3 origin;
+		Vec3 dx;
+
+		int32_t numNodes() const
+		{
+			return resolution[0] * resolution[1] * resolution[2];
+		}
+
+		int32_t flatIndex(int32_t i, int32_t j, int32_t k) const
+		{
+			return i + j * resolution[0] + k * resolution[0] * resolution[1];
+		}
+
+		Vec3 position(int32_t i, int32_t j, int32_t k) const
+		{
+			return Vec3(origin.x + i * dx.x, origin.y + j * dx.y, origin.z + k * dx.z);
+		}
+	};
+
+	inline float component(const Vec3& v, int32_t axis)
+	{
+		return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+	}
+
+	// Ericson's closest point on the triangle abc to p, by the Voronoi region of p
+	inline Vec3 closestPointOnTriangle(const Vec3& p, const Vec3& a, const Vec3& b, const Vec3& c)
+	{
+		const Vec3 ab = b - a;
+		const Vec3 ac = c - a;
+		const Vec3 ap = p - a;
+
+		const float d1 = dot(ab, ap);
+		const float d2 = dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f)
+			return a;
+
+		const Vec3 bp = p - b;
+		const float d3 = dot(ab, bp);
+		const float d4 = dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3)
+			return b;
+
+		const float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			return a + ab * (d1 / (d1 - d3));
+
+		const Vec3 cp = p - c;
+		const float d5 = dot(ab, cp);
+		const float d6 = dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6)
+			return c;
+
+		const float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			return a + ac * (d2 / (d2 - d6));
+
+		const float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		const float denominator = 1.0f / (va + vb + vc);
+
+		return a + ab * (vb * denominator) + ac * (vc * denominator);
+	}
+
+	namespace SDFDetail
+	{
+		struct Mesh
+		{
+			const float * vertices;
+			const int32_t * indices;
+
+			Vec3 vertex(int32_t triangle, int32_t corner) const
+			{
+				const float * v = vertices + indices[triangle * 3 + corner] * 3;
+
+				return Vec3(v[0], v[1], v[2]);
+			}
+
+			float distance(const Vec3& point, int32_t triangle) const
+			{
+				return length(point - closestPointOnTriangle(point, vertex(triangle, 0), vertex(triangle, 1), vertex(triangle, 2)));
+			}
+		};
+
+		// Robust orientation of the 2D triangle (0, 1, 2), with SDFGen's tie breaking so that a ray through an edge or
+		// a vertex counts exactly one crossing.
+		inline int32_t orientation(double x1, double y1, double x2, double y2, double& twiceSignedArea)
+		{
+			twiceSignedArea = y1 * x2 - x1 * y2;
+
+			if (twiceSignedArea > 0) return 1;
+			else if (twiceSignedArea < 0) return -1;
+			else if (y2 > y1) return 1;
+			else if (y2 < y1) return -1;
+			else if (x1 > x2) return 1;
+			else if (x1 < x2) return -1;
+			else return 0;
+		}
+
+		inline bool pointInTriangle2D(
+			double x0, double y0,
+			double x1, double y1,
+			double x2, double y2,
+			double x3, double y3,
+			double& a, double& b, double& c)
+		{
+			x1 -= x0; x2 -= x0; x3 -= x0;
+			y1 -= y0; y2 -= y0; y3 -= y0;
+
+			const int32_t signA = orientation(x2, y2, x3, y3, a);
+			if (signA == 0)
+				return false;
+
+			const int32_t signB = orientation(x3, y3, x1, y1, b);
+			if (signB != signA)
+				return false;
+
+			const int32_t signC = orientation(x1, y1, x2, y2, c);
+			if (signC != signA)
+				return false;
+
+			const double sum = a + b + c;
+
+			a /= sum;
+			b /= sum;
+			c /= sum;
+
+			return true;
+		}
+
+		inline void checkNeighbour(
+			const SDFGrid& grid,
+			const Mesh& mesh,
+			float * phi,
+			std::vector<int32_t>& closestTriangle,
+			const Vec3& point,
+			int32_t i0, int32_t j0, int32_t k0,
+			int32_t i1, int32_t j1, int32_t k1)
+		{
+			const int32_t neighbourTriangle = closestTriangle[grid.flatIndex(i1, j1, k1)];
+
+			if (neighbourTriangle < 0)
+				return;
+
+			const int32_t flat = grid.flatIndex(i0, j0, k0);
+			const float d = mesh.distance(point, neighbourTriangle);
+
+			if (d < phi[flat])
+			{
+				phi[flat] = d;
+				closestTriangle[flat] = neighbourTriangle;
+			}
+		}
+
+		inline void sweep(
+			const SDFGrid& grid,
+			const Mesh& mesh,
+			float * phi,
+			std::vector<int32_t>& closestTriangle,
+			int32_t di, int32_t dj, int32_t dk)
+		{
+			const int32_t * n = grid.resolution;
+
+			const int32_t i0 = di > 0 ? 1 : n[0] - 2, i1 = di > 0 ? n[0] : -1;
+			const int32_t j0 = dj > 0 ? 1 : n[1] - 2, j1 = dj > 0 ? n[1] : -1;
+			const int32_t k0 = dk > 0 ? 1 : n[2] - 2, k1 = dk > 0 ? n[2] : -1;
+
+			for (int32_t k = k0; k != k1; k += dk)
+			{
+				for (int32_t j = j0; j != j1; j += dj)
+				{
+					for (int32_t i = i0; i != i1; i += di)
+					{
+						const Vec3 point = grid.position(i, j, k);
+
+						checkNeighbour(grid, mesh, phi, closestTriangle, point, i, j, k, i - di, j, k);
+						checkNeighbour(grid, mesh, phi, closestTriangle, point, i, j, k, i, j - dj, k);
+						checkNeighbour(grid, mesh, phi, closestTriangle, point, i, j, k, i - di, j - dj, k);
+						checkNeighbour(grid, mesh, phi, closestTriangle, point, i, j, k, i, j, k - dk);
+						checkNeighbour(grid, mesh, phi, closestTriangle, point, i, j, k, i - di, j, k - dk);
+						checkNeighbour(grid, mesh, phi, closestTriangle, point, i, j, k, i, j - dj, k - dk);
+						checkNeighbour(grid, mesh, phi, closestTriangle, point, i, j, k, i - di, j - dj, k - dk);
+					}
+				}
+			}
+		}
+
+		// The parity of the triangles crossed by the rays along one axis. parity has one entry per node, flipped by a
+		// crossing in the interval that ends at the node (crossings before the volume land on the first node), and
+		// beyond one per ray, flipped by the crossings after the last node.
+		struct AxisCrossings
+		{
+			std::vector<uint8_t> parity;
+			std::vector<uint8_t> beyond;
+		};
+	}
+
+	// Bakes a triangle soup into a signed distance field, after Batty's SDFGen. Distances are exact within exactBand
+	// cells of a triangle and propagated outwards with fast sweeping.
+	//
+	// The sign is a majority vote over six rays from each node, both ways along x, y and z: a ray that crosses the
+	// surface an odd number of times votes inside, and the node is inside with four or more votes. For a closed mesh
+	// the rays agree. The open, non-watertight meshes of a level only cost the votes of the rays that pass through a
+	// gap, so a box with a missing face stays inside and the space behind a lone wall stays outside.
+	//
+	// vertices are xyz triples (FVector's layout) and indices three per triangle. The field has
+	// grid.numNodes() nodes, x fastest.
+	inline void bakeSDF(
+		const float * vertices,
+		const int32_t * indices,
+		int32_t numTriangles,
+		const SDFGrid& grid,
+		float * distances_out,
+		int32_t exactBand = 1)
+	{
+		using namespace SDFDetail;
+
+		const Mesh mesh{ vertices, indices };
+
+		const int32_t * n = grid.resolution;
+		const int32_t numNodes = grid.numNodes();
+
+		// further than anything in the volume
+		const Vec3 size(grid.dx.x * (n[0] - 1), grid.dx.y * (n[1] - 1), grid.dx.z * (n[2] - 1));
+		const float farAway = length(size) * 2.0f + 1.0f;
+
+		float * phi = distances_out;
+		std::fill(phi, phi + numNodes, farAway);
+
+		std::vector<int32_t> closestTriangle(numNodes, -1);
+
+		AxisCrossings crossings[3];
+
+		for (int32_t axis = 0; axis < 3; ++axis)
+		{
+			crossings[axis].parity.assign(numNodes, 0);
+			crossings[axis].beyond.assign(numNodes / n[axis], 0);
+		}
+
+		for (int32_t t = 0; t < numTriangles; ++t)
+		{
+			// in grid units
+			Vec3 corners[3];
+			for (int32_t c = 0; c < 3; ++c)
+			{
+				const Vec3 v = mesh.vertex(t, c) - grid.origin;
+
+				corners[c] = Vec3(v.x / grid.dx.x, v.y / grid.dx.y, v.z / grid.dx.z);
+			}
+
+			float lo[3], hi[3];
+			for (int32_t axis = 0; axis < 3; ++axis)
+			{
+				lo[axis] = std::min(std::min(component(corners[0], axis), component(corners[1], axis)), component(corners[2], axis));
+				hi[axis] = std::max(std::max(component(corners[0], axis), component(corners[1], axis)), component(corners[2], axis));
+			}
+
+			// exact distances near the triangle
+			{
+				int32_t first[3], last[3];
+				for (int32_t axis = 0; axis < 3; ++axis)
+				{
+					first[axis] = std::min(std::max(int32_t(std::floor(lo[axis])) - exactBand, 0), n[axis] - 1);
+					last[axis] = std::min(std::max(int32_t(std::ceil(hi[axis])) + exactBand, 0), n[axis] - 1);
+				}
+
+				for (int32_t k = first[2]; k <= last[2]; ++k)
+				{
+					for (int32_t j = first[1]; j <= last[1]; ++j)
+					{
+						for (int32_t i = first[0]; i <= last[0]; ++i)
+						{
+							const int32_t flat = grid.flatIndex(i, j, k);
+							const float d = mesh.distance(grid.position(i, j, k), t);
+
+							if (d < phi[flat])
+							{
+								phi[flat] = d;
+								closestTriangle[flat] = t;
+							}
+						}
+					}
+				}
+			}
+
+			// crossings of the rays along each axis, through the nodes of the other two axes under the triangle
+			for (int32_t axis = 0; axis < 3; ++axis)
+			{
+				const int32_t u = (axis + 1) % 3;
+				const int32_t v = (axis + 2) % 3;
+
+				const int32_t u0 = std::max(int32_t(std::ceil(lo[u])), 0);
+				const int32_t u1 = std::min(int32_t(std::floor(hi[u])), n[u] - 1);
+				const int32_t v0 = std::max(int32_t(std::ceil(lo[v])), 0);
+				const int32_t v1 = std::min(int32_t(std::floor(hi[v])), n[v] - 1);
+
+				for (int32_t iv = v0; iv <= v1; ++iv)
+				{
+					for (int32_t iu = u0; iu <= u1; ++iu)
+					{
+						double wa, wb, wc;
+
+						if (!pointInTriangle2D(
+							iu, iv,
+							component(corners[0], u), component(corners[0], v),
+							component(corners[1], u), component(corners[1], v),
+							component(corners[2], u), component(corners[2], v),
+							wa, wb, wc))
+							continue;
+
+						const double x = wa * component(corners[0], axis) + wb * component(corners[1], axis) + wc * component(corners[2], axis);
+						const int32_t interval = int32_t(std::ceil(x));
+
+						if (interval >= n[axis])
+						{
+							crossings[axis].beyond[iu + iv * n[u]] ^= 1;
+							continue;
+						}
+
+						int32_t node[3];
+						node[axis] = std::max(interval, 0);
+						node[u] = iu;
+						node[v] = iv;
+
+						crossings[axis].parity[grid.flatIndex(node[0], node[1], node[2])] ^= 1;
+					}
+				}
+			}
+		}
+
+		// propagate the closest triangles out from the band, two passes over the eight sweep directions
+		for (int32_t pass = 0; pass < 2; ++pass)
+		{
+			sweep(grid, mesh, phi, closestTriangle, +1, +1, +1);
+			sweep(grid, mesh, phi, closestTriangle, -1, -1, -1);
+			sweep(grid, mesh, phi, closestTriangle, +1, +1, -1);
+			sweep(grid, mesh, phi, closestTriangle, -1, -1, +1);
+			sweep(grid, mesh, phi, closestTriangle, +1, -1, +1);
+			sweep(grid, mesh, phi, closestTriangle, -1, +1, -1);
+			sweep(grid, mesh, phi, closestTriangle, +1, -1, -1);
+			sweep(grid, mesh, phi, closestTriangle, -1, +1, +1);
+		}
+
+		// the inside votes, the crossings before a node are the negative ray's and the rest of the line's the
+		// positive ray's
+		std::vector<uint8_t> votes(numNodes, 0);
+
+		for (int32_t axis = 0; axis < 3; ++axis)
+		{
+			const int32_t u = (axis + 1) % 3;
+			const int32_t v = (axis + 2) % 3;
+
+			for (int32_t iv = 0; iv < n[v]; ++iv)
+			{
+				for (int32_t iu = 0; iu < n[u]; ++iu)
+				{
+					int32_t node[3];
+					node[u] = iu;
+					node[v] = iv;
+
+					uint8_t total = crossings[axis].beyond[iu + iv * n[u]];
+
+					for (int32_t i = 0; i < n[axis]; ++i)
+					{
+						node[axis] = i;
+						total ^= crossings[axis].parity[grid.flatIndex(node[0], node[1], node[2])];
+					}
+
+					uint8_t before = 0;
+
+					for (int32_t i = 0; i < n[axis]; ++i)
+					{
+						node[axis] = i;
+
+						const int32_t flat = grid.flatIndex(node[0], node[1], node[2]);
+
+						before ^= crossings[axis].parity[flat];
+
+						votes[flat] += before + (total ^ before);
+					}
+				}
+			}
+		}
+
+		for (int32_t i = 0; i < numNodes; ++i)
+		{
+			if (votes[i] >= 4)
+				phi[i] = -phi[i];
+		}
+	}
+}
@@ -0,0 +1,268 @@
+// Copyright 2020 Timothy Davison, all rights reserved.
+
+#pragma once
+
+// The engine-independent core of the swarm: the sorts, the hashed grid, the boid rules and the SDF baker. It is
+// header-only standard C++14 with no engine types, so that the algorithms can be built, tested and benchmarked without
+// the editor or a GPU (see Benchmarks/). The engine's CPU classes (CPUHashedGrid.h, CPUBoidSimulation.h and
+// BoidSDFBaker.h) wrap it.
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace SwarmCore
+{
+	// Runs body(i) for every i in [0, count) on the calling thread. The parallel algorithms take any parallel-for with
+	// this signature, the engine passes one over ParallelFor and the benchmark one over its own thread pool.
+	struct SerialFor
+	{
+		template<typename Body>
+		void operator()(uint32_t count, const Body& body) const
+		{
+			for (uint32_t i = 0; i < count; ++i)
+				body(i);
+		}
+	};
+
+	inline uint32_t divideAndRoundUp(uint32_t a, uint32_t b)
+	{
+		return (a + b - 1) / b;
+	}
+
+	// The bits needed to hold the values below n
+	inline uint32_t ceilLogTwo(uint32_t n)
+	{
+		uint32_t bits = 0;
+
+		while (bits < 32 && (uint64_t(1) << bits) < n)
+			bits++;
+
+		return bits;
+	}
+
+	// Runs body(begin, end) over [0, count) in chunks of chunkSize, one task per chunk
+	template<typename ParallelFor, typename Body>
+	void forEachChunk(const ParallelFor& parallelFor, uint32_t count, uint32_t chunkSize, const Body& body)
+	{
+		const uint32_t numChunks = divideAndRoundUp(count, chunkSize);
+
+		parallelFor(numChunks, [&](uint32_t chunk)
+		{
+			const uint32_t begin = chunk * chunkSize;
+			const uint32_t end = count - begin < chunkSize ? count : begin + chunkSize;
+
+			body(begin, end);
+		});
+	}
+
+	// A multithreaded, stable LSD radix sort of (key, value) pairs held as two arrays, 8 bits per pass. Each pass splits
+	// the items in chunks, counts the digits of every chunk in parallel, scans the counts in digit-major order and
+	// scatters the chunks in parallel. Only the passes that keyBits needs are run.
+	struct RadixSort
+	{
+		static const uint32_t radixBits = 8;
+		static const uint32_t chunkSize = 1 << 14;
+
+		// Sort the first numItems keys and values by the low keyBits bits of the keys. The scratch arrays hold at least
+		// numItems items.
+		template<typename ParallelFor = SerialFor>
+		static void sortKeyValues(
+			uint32_t numItems,
+			uint32_t keyBits,
+			uint32_t * keys,
+			uint32_t * values,
+			uint32_t * keysScratch,
+			uint32_t * valuesScratch,
+			const ParallelFor& parallelFor = ParallelFor()
+		)
+		{
+			if (numItems <= 1)
+				return;
+
+			const uint32_t radix = 1 << radixBits;
+			const uint32_t chunk = chunkSize;
+
+			const uint32_t clampedBits = keyBits < 1 ? 1 : (keyBits > 32 ? 32 : keyBits);
+			const uint32_t numPasses = divideAndRoundUp(clampedBits, radixBits);
+			const uint32_t numChunks = divideAndRoundUp(numItems, chunk);
+
+			// per digit, per chunk
+			std::vector<uint32_t> offsets(radix * numChunks);
+
+			uint32_t * keysFrom = keys;
+			uint32_t * valuesFrom = values;
+			uint32_t * keysTo = keysScratch;
+			uint32_t * valuesTo = valuesScratch;
+
+			for (uint32_t pass = 0; pass < numPasses; ++pass)
+			{
+				const uint32_t shift = pass * radixBits;
+
+				// count the digits of every chunk
+				parallelFor(numChunks, [&](uint32_t c)
+				{
+					uint32_t counts[radix] = { 0 };
+
+					const uint32_t begin = c * chunk;
+					const uint32_t end = numItems - begin < chunk ? numItems : begin + chunk;
+
+					for (uint32_t i = begin; i < end; ++i)
+						counts[(keysFrom[i] >> shift) & (radix - 1)]++;
+
+					for (uint32_t digit = 0; digit < radix; ++digit)
+						offsets[digit * numChunks + c] = counts[digit];
+				});
+
+				// digit-major exclusive scan, so every chunk's digits land after the earlier chunks' equal digits
+				uint32_t sum = 0;
+
+				for (uint32_t& offset : offsets)
+				{
+					const uint32_t count = offset;
+
+					offset = sum;
+					sum += count;
+				}
+
+				// scatter
+				parallelFor(numChunks, [&](uint32_t c)
+				{
+					uint32_t cursors[radix];
+
+					for (uint32_t digit = 0; digit < radix; ++digit)
+						cursors[digit] = offsets[digit * numChunks + c];
+
+					const uint32_t begin = c * chunk;
+					const uint32_t end = numItems - begin < chunk ? numItems : begin + chunk;
+
+					for (uint32_t i = begin; i < end; ++i)
+					{
+						const uint32_t to = cursors[(keysFrom[i] >> shift) & (radix - 1)]++;
+
+						keysTo[to] = keysFrom[i];
+						valuesTo[to] = valuesFrom[i];
+					}
+				});
+
+				std::swap(keysFrom, keysTo);
+				std::swap(valuesFrom, valuesTo);
+			}
+
+			// an odd number of passes leaves the result in the scratch arrays
+			if (keysFrom != keys)
+			{
+				std::memcpy(keys, keysFrom, sizeof(uint32_t) * numItems);
+				std::memcpy(values, valuesFrom, sizeof(uint32_t) * numItems);
+			}
+		}
+	};
+
+	// A stable counting sort of (key, value) pairs whose keys are below numKeys, in one pass over the items. It costs
+	// O(numItems + numKeys) and a counter per key, so it only pays off when there are few keys (cells) per item. It runs
+	// on the calling thread, a parallel scatter would need a counter per key per chunk.
+	struct CountingSort
+	{
+		static void sortKeyValues(
+			uint32_t numItems,
+			uint32_t numKeys,
+			uint32_t * keys,
+			uint32_t * values,
+			uint32_t * keysScratch,
+			uint32_t * valuesScratch,
+			std::vector<uint32_t>& counts
+		)
+		{
+			if (numItems <= 1)
+				return;
+
+			counts.assign(numKeys, 0);
+
+			for (uint32_t i = 0; i < numItems; ++i)
+				counts[keys[i]]++;
+
+			uint32_t sum = 0;
+
+			for (uint32_t& count : counts)
+			{
+				const uint32_t c = count;
+
+				count = sum;
+				sum += c;
+			}
+
+			for (uint32_t i = 0; i < numItems; ++i)
+			{
+				const uint32_t to = counts[keys[i]]++;
+
+				keysScratch[to] = keys[i];
+				valuesScratch[to] = values[i];
+			}
+
+			std::memcpy(keys, keysScratch, sizeof(uint32_t) * numItems);
+			std::memcpy(values, valuesScratch, sizeof(uint32_t) * numItems);
+		}
+	};
+
+	// GPUBitonicSort's network on the CPU. The pairs are packed key above value in 64 bits, so equal keys are ordered by
+	// their values like the GPU's compares, and padded to the next power of two, whose n log^2 n compares it always
+	// pays for.
+	struct BitonicSort
+	{
+		static const uint32_t chunkSize = 1 << 14;
+
+		template<typename ParallelFor = SerialFor>
+		static void sortKeyValues(
+			uint32_t numItems,
+			uint32_t * keys,
+			uint32_t * values,
+			std::vector<uint64_t>& scratch,
+			const ParallelFor& parallelFor = ParallelFor()
+		)
+		{
+			if (numItems <= 1)
+				return;
+
+			const uint32_t n = uint32_t(1) << ceilLogTwo(numItems);
+
+			scratch.resize(n);
+
+			for (uint32_t i = 0; i < numItems; ++i)
+				scratch[i] = (uint64_t(keys[i]) << 32) | values[i];
+
+			for (uint32_t i = numItems; i < n; ++i)
+				scratch[i] = ~uint64_t(0);
+
+			uint64_t * items = scratch.data();
+
+			for (uint32_t k = 2; k <= n; k <<= 1)
+			{
+				for (uint32_t j = k >> 1; j > 0; j >>= 1)
+				{
+					forEachChunk(parallelFor, n, chunkSize, [&](uint32_t begin, uint32_t end)
+					{
+						for (uint32_t i = begin; i < end; ++i)
+						{
+							const uint32_t l = i ^ j;
+
+							if (l <= i)
+								continue;
+
+							const bool ascending = (i & k) == 0;
+
+							if ((items[i] > items[l]) == ascending)
+								std::swap(items[i], items[l]);
+						}
+					});
+				}
+			}
+
+			for (uint32_t i = 0; i < numItems; ++i)
+			{
+				keys[i] = uint32_t(scratch[i] >> 32);
+				values[i] = uint32_t(scratch[i]);
+			}
+		}
+	};
+}